@@ -0,0 +1,239 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sched.h>
+#include "affinity.h"
+
+/* Most NUMA nodes looked at */
+#define MAX_NODES  64
+
+
+/*
+ * Parses a list of CPUs such as "0-3,8,10-11" into cpus. Returns the
+ * number of CPUs or -1 if the list is malformed or longer than max.
+ */
+static int parse_list(const char *list, int *cpus, int max)
+{
+	const char *p = list;
+	char *end;
+	long first, last;
+	int count = 0;
+
+	while (*p)
+	{
+		first = strtol(p, &end, 10);
+		if ((end == p) || (first < 0))
+			return -1;
+		last = first;
+		p = end;
+		if (*p == '-')
+		{
+			last = strtol(p + 1, &end, 10);
+			if ((end == p + 1) || (last < first))
+				return -1;
+			p = end;
+		}
+		if (last >= CPU_SETSIZE)
+			return -1;
+		for (; first <= last; first++)
+		{
+			if (count == max)
+				return -1;
+			cpus[count++] = (int)first;
+		}
+
+		if ((*p == ',') && (p[1] != '\0') && (p[1] != '\n'))
+			p++;
+		else if ((*p != '\0') && (*p != '\n'))
+			return -1;
+		else
+			break;
+	}
+
+	return count;
+}
+
+
+/*
+ * Reads a list of CPUs from a file of the sysfs. Returns the number of
+ * CPUs or -1 if the file cannot be read.
+ */
+static int read_list(const char *path, int *cpus, int max)
+{
+	char line[4096];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	if (fgets(line, sizeof(line), f) == NULL)
+	{
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	return parse_list(line, cpus, max);
+}
+
+
+/*
+ * Returns the NUMA node the first network card is attached to, or -1 if
+ * the system does not tell. Virtual interfaces have no device and are
+ * skipped.
+ */
+static int nic_node(void)
+{
+	char path[512];
+	struct dirent *entry;
+	DIR *dir;
+	FILE *f;
+	int node = -1;
+
+	dir = opendir("/sys/class/net");
+	if (dir == NULL)
+		return -1;
+	while ((node < 0) && ((entry = readdir(dir)) != NULL))
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", entry->d_name);
+		f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+		if (fscanf(f, "%d", &node) != 1)
+			node = -1;
+		fclose(f);
+	}
+	closedir(dir);
+
+	return node;
+}
+
+
+/*
+ * Orders the CPUs the process may run on for the automatic layout: the
+ * NUMA node of the network card (or of the first CPU) comes first, and
+ * within a node one hardware thread of every core before the second
+ * threads of the cores. Returns the number of CPUs.
+ */
+static int auto_layout(cpu_set_t *allowed, int *cpus, int max)
+{
+	static int node_cpus[CPU_SETSIZE];
+	char path[256];
+	int rank[CPU_SETSIZE];
+	int siblings[8];
+	int node, count, cpu, i, r, n = 0;
+
+	/* Rank 0 and 1 are the CPUs of the preferred node */
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		rank[cpu] = CPU_ISSET(cpu, allowed) ? 2 : -1;
+	node = nic_node();
+	if (node < 0)
+	{
+		for (i = 0; (i < MAX_NODES) && (node < 0); i++)
+		{
+			snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", i);
+			count = read_list(path, node_cpus, CPU_SETSIZE);
+			for (cpu = 0; (cpu < count) && (node < 0); cpu++)
+				if (CPU_ISSET(node_cpus[cpu], allowed))
+					node = i;
+		}
+	}
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	count = read_list(path, node_cpus, CPU_SETSIZE);
+	if (count <= 0)
+	{
+		/* No NUMA information, all CPUs are alike */
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (rank[cpu] >= 0)
+				rank[cpu] = 0;
+	}
+	for (i = 0; i < count; i++)
+		if (rank[node_cpus[i]] >= 0)
+			rank[node_cpus[i]] = 0;
+
+	/* Second hardware threads of a core go after the first ones */
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (rank[cpu] < 0)
+			continue;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+		if ((read_list(path, siblings, 8) > 0) && (siblings[0] != cpu))
+			rank[cpu]++;
+	}
+
+	for (r = 0; r < 4; r++)
+		for (cpu = 0; (cpu < CPU_SETSIZE) && (n < max); cpu++)
+			if (rank[cpu] == r)
+				cpus[n++] = cpu;
+
+	return n;
+}
+
+
+/*
+ * Fills cpus with the CPUs the threads of a run are placed on, as given
+ * with --cpus: either a list such as "0-3,8" or "auto" for a layout
+ * following the topology of the machine. Returns the number of CPUs or
+ * -1 if the list is malformed or names a CPU the process may not use.
+ */
+int affinity_layout(const char *spec, int *cpus, int max)
+{
+	cpu_set_t allowed;
+	int count, i;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+		return -1;
+
+	if (strcmp(spec, "auto") == 0)
+		return auto_layout(&allowed, cpus, max);
+
+	count = parse_list(spec, cpus, max);
+	if (count <= 0)
+		return -1;
+	for (i = 0; i < count; i++)
+		if (!CPU_ISSET(cpus[i], &allowed))
+			return -1;
+
+	return count;
+}
+
+
+/*
+ * Lets a thread run on the given CPUs only. Threads it creates later
+ * inherit the CPUs. Memory the thread touches first is taken from the
+ * NUMA node of the CPUs. Returns -1 if the thread cannot be moved.
+ */
+int affinity_pin(pthread_t thread, const int *cpus, int count)
+{
+	cpu_set_t set;
+	int i;
+
+	CPU_ZERO(&set);
+	for (i = 0; i < count; i++)
+		CPU_SET(cpus[i], &set);
+
+	return (pthread_setaffinity_np(thread, sizeof(set), &set) == 0) ? 0 : -1;
+}
@@ -0,0 +1,31 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+
+/* Most CPUs a layout can name */
+#define AFFINITY_MAX_CPUS  1024
+
+int affinity_layout(const char *spec, int *cpus, int max);
+int affinity_pin(pthread_t thread, const int *cpus, int count);
+
+#endif /* AFFINITY_H */
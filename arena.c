@@ -0,0 +1,168 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* Allocations are aligned for any type */
+#define ARENA_ALIGN  16
+
+struct arena_block
+{
+	arena_block *next;
+	size_t used;
+	size_t size;
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+
+/*
+ * Creates an empty arena. Returns NULL if out of memory.
+ */
+arena *arena_create(void)
+{
+	arena *a;
+
+	a = (arena *)malloc(sizeof(arena));
+	if (a == NULL)
+		return NULL;
+	if (pthread_key_create(&a->current, NULL) != 0)
+	{
+		free(a);
+		return NULL;
+	}
+	pthread_mutex_init(&a->lock, NULL);
+	a->blocks = NULL;
+	a->size = 0;
+	a->reserved = 0;
+
+	return a;
+}
+
+
+/*
+ * Takes a new block of at least size bytes from the heap. Returns NULL
+ * if out of memory.
+ */
+static arena_block *add_block(arena *a, size_t size)
+{
+	arena_block *block;
+
+	block = (arena_block *)malloc(sizeof(arena_block) + size);
+	if (block == NULL)
+		return NULL;
+	block->used = 0;
+	block->size = size;
+
+	pthread_mutex_lock(&a->lock);
+	block->next = a->blocks;
+	a->blocks = block;
+	a->reserved += sizeof(arena_block) + size;
+	pthread_mutex_unlock(&a->lock);
+
+	return block;
+}
+
+
+/*
+ * Carves size bytes aligned to align (a power of two) from the block of
+ * the calling thread. Returns NULL if out of memory.
+ */
+static void *carve(arena *a, size_t size, size_t align)
+{
+	arena_block *block = (arena_block *)pthread_getspecific(a->current);
+	size_t start;
+
+	start = block ? (block->used + align - 1) & ~(align - 1) : 0;
+	if ((block == NULL) || (start + size > block->size))
+	{
+		/* Allocations too big for a block get a block of their own,
+		 * the current block is kept for the small ones */
+		if (size > ARENA_BLOCK_SIZE / 4)
+		{
+			block = add_block(a, size);
+			if (block == NULL)
+				return NULL;
+			block->used = size;
+			__atomic_fetch_add(&a->size, size, __ATOMIC_RELAXED);
+			return block->data;
+		}
+
+		block = add_block(a, ARENA_BLOCK_SIZE - sizeof(arena_block));
+		if (block == NULL)
+			return NULL;
+		pthread_setspecific(a->current, block);
+		start = 0;
+	}
+
+	block->used = start + size;
+	__atomic_fetch_add(&a->size, size, __ATOMIC_RELAXED);
+
+	return block->data + start;
+}
+
+
+/*
+ * Returns size bytes of memory, aligned for any type, which stay valid
+ * until the arena is destroyed. Safe for concurrent use. Returns NULL if
+ * out of memory.
+ */
+void *arena_alloc(arena *a, size_t size)
+{
+	return carve(a, size, ARENA_ALIGN);
+}
+
+
+/*
+ * Copies a string into the arena. Returns NULL if out of memory.
+ */
+char *arena_strdup(arena *a, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *copy;
+
+	copy = (char *)carve(a, len, 1);
+	if (copy)
+		memcpy(copy, s, len);
+
+	return copy;
+}
+
+
+/*
+ * Releases all memory of the arena at once. No thread may allocate
+ * from it meanwhile.
+ */
+void arena_destroy(arena *a)
+{
+	arena_block *block, *next;
+
+	if (a == NULL)
+		return;
+
+	for (block = a->blocks; block; block = next)
+	{
+		next = block->next;
+		free(block);
+	}
+	pthread_key_delete(a->current);
+	pthread_mutex_destroy(&a->lock);
+	free(a);
+}
@@ -0,0 +1,48 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* Size of the blocks allocations are carved from */
+#define ARENA_BLOCK_SIZE  (256 * 1024)
+
+typedef struct arena_block arena_block;
+
+/* Memory handed out by bumping a pointer and released all at once.
+ * Every thread carves from a block of its own, so allocating takes a
+ * lock only when a thread needs a new block */
+typedef struct
+{
+	arena_block *blocks;     // all blocks of all threads
+	pthread_key_t current;   // block the calling thread allocates from
+	pthread_mutex_t lock;    // guards blocks
+	size_t size;             // bytes handed out
+	size_t reserved;         // bytes taken from the heap
+} arena;
+
+arena *arena_create(void);
+void *arena_alloc(arena *a, size_t size);
+char *arena_strdup(arena *a, const char *s);
+void arena_destroy(arena *a);
+
+#endif /* ARENA_H */
@@ -0,0 +1,79 @@
+#! /bin/sh
+
+# Runs dnsninja against mockdns on loopback and reports the queries per
+# second, the CPU time per query and the share of the zone found, then
+# checks that a zone transfer yields every host of the zone. The
+# sizes and the behaviour of the server can be changed through the
+# environment, e.g.
+#
+#   BENCH_WORDS=100000 MOCKDNS_ARGS="-l 2 -j 1 -x 1" make bench
+
+BENCH_WORDS=${BENCH_WORDS:-20000}
+BENCH_EVERY=${BENCH_EVERY:-50}
+BENCH_PORT=${BENCH_PORT:-5399}
+BENCH_DOMAIN=bench.test
+
+dir=$(mktemp -d /tmp/dnsninja-bench.XXXXXX) || exit 1
+trap 'kill $mock 2>/dev/null; rm -rf "$dir"' EXIT
+
+# Every BENCH_EVERY-th word of the list exists in the zone
+awk -v n="$BENCH_WORDS" 'BEGIN { for (i = 0; i < n; i++) print "host" i }' > "$dir/words.txt"
+awk -v n="$BENCH_WORDS" -v every="$BENCH_EVERY" -v domain="$BENCH_DOMAIN" 'BEGIN {
+	for (i = 0; i < n; i += every)
+		printf "host%d.%s A 10.%d.%d.%d\n", i, domain, int(i / 65536) % 256, int(i / 256) % 256, i % 256
+}' > "$dir/zone.txt"
+cut -d ' ' -f 1 "$dir/zone.txt" | sort > "$dir/expected.txt"
+
+# The zone transfer is taken from the name server of the domain
+echo "$BENCH_DOMAIN NS ns.$BENCH_DOMAIN" >> "$dir/zone.txt"
+echo "ns.$BENCH_DOMAIN A 127.0.0.1" >> "$dir/zone.txt"
+grep ' A ' "$dir/zone.txt" | cut -d ' ' -f 1 | sort > "$dir/transfer-expected.txt"
+echo nohost > "$dir/none.txt"
+
+./mockdns -p "$BENCH_PORT" -d "$BENCH_DOMAIN" -z "$dir/zone.txt" $MOCKDNS_ARGS 2> "$dir/mockdns.log" &
+mock=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	grep -q serving "$dir/mockdns.log" && break
+	sleep 0.2
+done
+if ! grep -q serving "$dir/mockdns.log"; then
+	cat "$dir/mockdns.log"
+	exit 1
+fi
+
+./dnsninja -s 127.0.0.1 -p "$BENCH_PORT" -d "$BENCH_DOMAIN" -x -l 2 -P 0 \
+	-i "$dir/words.txt" -o "$dir/found.csv" $DNSNINJA_ARGS > "$dir/dnsninja.log" 2>&1
+status=$?
+if [ $status -eq 0 ]; then
+	./dnsninja -s 127.0.0.1 -p "$BENCH_PORT" -d "$BENCH_DOMAIN" -l 2 -P 0 \
+		-i "$dir/none.txt" -o "$dir/transfer.csv" > "$dir/transfer.log" 2>&1
+	transfer_status=$?
+fi
+kill $mock
+wait $mock 2>/dev/null
+if [ $status -ne 0 ]; then
+	cat "$dir/dnsninja.log"
+	exit 1
+fi
+
+tail -n +2 "$dir/found.csv" | cut -d , -f 1 | sort -u > "$dir/found.txt"
+expected=$(wc -l < "$dir/expected.txt")
+found=$(comm -12 "$dir/expected.txt" "$dir/found.txt" | wc -l)
+wrong=$(comm -13 "$dir/expected.txt" "$dir/found.txt" | wc -l)
+
+echo "Benchmark: $BENCH_WORDS words, $expected names in the zone, mockdns $MOCKDNS_ARGS"
+sed -n 's/.*Queries sent *: [0-9]* in \([0-9.]*\) seconds (\([0-9]*\) per second).*/    Queries per second: \2 (\1 seconds)/p' "$dir/dnsninja.log"
+sed -n 's/.*CPU time *: [0-9.]* seconds (\([0-9.]*\) us per query).*/    CPU per query     : \1 us/p' "$dir/dnsninja.log"
+awk -v found="$found" -v expected="$expected" 'BEGIN {
+	printf "    Recall            : %d of %d (%.1f%%)\n", found, expected, expected ? 100 * found / expected : 0 }'
+echo "    Wrong names       : $wrong"
+sed -n 's/^mockdns: \([0-9]* UDP.*\)/    Server            : \1/p' "$dir/mockdns.log"
+
+tail -n +2 "$dir/transfer.csv" 2>/dev/null | cut -d , -f 1 | sort -u > "$dir/transfer.txt"
+expected=$(wc -l < "$dir/transfer-expected.txt")
+found=$(comm -12 "$dir/transfer-expected.txt" "$dir/transfer.txt" | wc -l)
+echo "    Zone transfer     : $found of $expected hosts"
+if [ "$transfer_status" -ne 0 ] || [ "$found" -ne "$expected" ]; then
+	cat "$dir/transfer.log"
+	exit 1
+fi
@@ -0,0 +1,480 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dns.h"
+#include "hashset.h"
+#include "cache.h"
+
+/* Records are appended to the fresh buffer in steps of this size */
+#define FRESH_STEP 65536
+
+/* Largest record: name and DNS_MAX_RR answers with their data */
+#define RECORD_MAX (sizeof(cache_record) + 256 + DNS_MAX_RR * (6 + 256) + 8)
+
+static const char *cache_file = NULL;
+static unsigned char *mapped = NULL;     // file of the last run, read only
+static size_t mapped_size = 0;
+static unsigned char *fresh = NULL;      // records stored during this run
+static size_t fresh_size = 0;
+static size_t fresh_used = 0;
+static unsigned int hits = 0;
+static pthread_mutex_t fresh_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Hash of the key of a record.
+ */
+static unsigned long long key_hash(const char *name, int qtype, int server_class)
+{
+	unsigned long long h = hashset_hash_name(name);
+
+	h ^= (unsigned long long)((qtype << 8) | server_class);
+	h *= 1099511628211ULL;
+
+	return h ? h : 1;
+}
+
+
+/*
+ * Checks whether a record belongs to the given key.
+ */
+static int record_matches(const cache_record *rec, unsigned long long hash, const char *name, int qtype, int server_class)
+{
+	return (rec->hash == hash) && (rec->qtype == qtype) && (rec->server_class == server_class) &&
+		(strcasecmp((const char *)(rec + 1), name) == 0);
+}
+
+
+/*
+ * Checks whether two records share the same key.
+ */
+static int same_key(const cache_record *a, const cache_record *b)
+{
+	return record_matches(a, b->hash, (const char *)(b + 1), b->qtype, b->server_class);
+}
+
+
+/*
+ * Maps the cache file of earlier runs. A missing file is fine, it is
+ * created when the cache is closed. Returns the number of records
+ * found or -1 if the file is no valid cache.
+ */
+int cache_open(const char *file)
+{
+	cache_header *header;
+	struct stat st;
+	int fd;
+
+	cache_file = file;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return (errno == ENOENT) ? 0 : -1;
+
+	if (fstat(fd, &st) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+	if ((size_t)st.st_size < sizeof(cache_header))
+	{
+		close(fd);
+		return -1;
+	}
+
+	mapped = (unsigned char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		mapped = NULL;
+		return -1;
+	}
+	mapped_size = st.st_size;
+
+	header = (cache_header *)mapped;
+	if ((memcmp(header->magic, CACHE_MAGIC, 8) != 0) || (header->size != mapped_size) ||
+		(header->slots == 0) || (header->slots & (header->slots - 1)) ||
+		(sizeof(cache_header) + (size_t)header->slots * sizeof(cache_slot) > mapped_size))
+	{
+		munmap(mapped, mapped_size);
+		mapped = NULL;
+		mapped_size = 0;
+		return -1;
+	}
+
+	return header->count;
+}
+
+
+/*
+ * Returns the record a slot of the mapped file points to, or NULL if
+ * the offset is out of bounds.
+ */
+static const cache_record *mapped_record(const cache_slot *slot)
+{
+	const cache_record *rec;
+
+	if ((slot->offset < sizeof(cache_header)) || (slot->offset + sizeof(cache_record) > mapped_size))
+		return NULL;
+
+	rec = (const cache_record *)(mapped + slot->offset);
+	if ((rec->size < sizeof(cache_record) + 1) || (slot->offset + rec->size > mapped_size) ||
+		(((const char *)rec)[rec->size - 1] != '\0'))
+		return NULL;
+
+	return rec;
+}
+
+
+/*
+ * Fills reply with the answers of a record. Returns -1 if the record
+ * is damaged.
+ */
+static int decode_record(const cache_record *rec, struct DNS_REPLY *reply)
+{
+	const char *p = (const char *)(rec + 1);
+	const char *end = (const char *)rec + rec->size;
+	const char *name = p;
+	struct DNS_RR *rr;
+	int i;
+	size_t len;
+
+	reply->rcode = rec->rcode;
+	reply->aa = 0;
+	reply->tc = 0;
+	reply->ra = 0;
+	reply->ans_count = 0;
+	reply->auth_count = 0;
+	reply->add_count = 0;
+
+	p += strlen(p) + 1;
+	for (i = 0; (i < rec->ans_count) && (i < DNS_MAX_RR); i++)
+	{
+		if (p + 6 >= end)
+			return -1;
+
+		rr = &reply->answers[i];
+		memcpy(&rr->type, p, 2);
+		memcpy(&rr->ttl, p + 2, 4);
+		p += 6;
+
+		len = strlen(p);
+		if (len >= sizeof(rr->data))
+			return -1;
+		strcpy(rr->data, p);
+		p += len + 1;
+
+		snprintf(rr->name, sizeof(rr->name), "%s", name);
+		rr->_class = 1;
+		rr->data_len = 0;
+		reply->ans_count++;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Looks up a name in the cache of earlier runs. Returns 1 and fills
+ * reply if an unexpired answer is known, 0 otherwise.
+ */
+int cache_lookup(const char *name, int qtype, int server_class, struct DNS_REPLY *reply)
+{
+	const cache_header *header = (const cache_header *)mapped;
+	const cache_slot *slots;
+	const cache_record *rec;
+	unsigned long long hash;
+	unsigned int i;
+
+	if (mapped == NULL)
+		return 0;
+
+	slots = (const cache_slot *)(mapped + sizeof(cache_header));
+	hash = key_hash(name, qtype, server_class);
+	for (i = hash & (header->slots - 1); slots[i].offset != 0; i = (i + 1) & (header->slots - 1))
+	{
+		if (slots[i].hash != hash)
+			continue;
+
+		rec = mapped_record(&slots[i]);
+		if ((rec == NULL) || !record_matches(rec, hash, name, qtype, server_class))
+			continue;
+		if ((rec->expires <= time(NULL)) || (decode_record(rec, reply) < 0))
+			return 0;
+
+		__sync_add_and_fetch(&hits, 1);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Remembers the answer to a query. Positive answers expire with their
+ * lowest TTL, negative ones with the TTL of the SOA record sent along.
+ * Failures and negative answers without SOA record are not cached.
+ */
+void cache_store(const char *name, int qtype, int server_class, struct DNS_REPLY *reply)
+{
+	unsigned char buffer[RECORD_MAX];
+	cache_record *rec = (cache_record *)buffer;
+	unsigned char *p, *grown;
+	unsigned int ttl = 0;
+	unsigned short type;
+	size_t len;
+	int i;
+
+	if (cache_file == NULL)
+		return;
+
+	if ((reply->rcode == DNS_RCODE_NOERROR) && (reply->ans_count > 0))
+	{
+		ttl = reply->answers[0].ttl;
+		for (i = 1; i < reply->ans_count; i++)
+		{
+			if (reply->answers[i].ttl < ttl)
+				ttl = reply->answers[i].ttl;
+		}
+	}
+	else if ((reply->rcode == DNS_RCODE_NOERROR) || (reply->rcode == DNS_RCODE_NXDOMAIN))
+	{
+		for (i = 0; i < reply->auth_count; i++)
+		{
+			if (reply->authority[i].type == DNS_RES_REC_SOA)
+				ttl = reply->authority[i].ttl;
+		}
+	}
+	if ((ttl == 0) || (strlen(name) > 255))
+		return;
+	if (ttl > CACHE_MAX_TTL)
+		ttl = CACHE_MAX_TTL;
+
+	memset(rec, 0, sizeof(cache_record));
+	rec->hash = key_hash(name, qtype, server_class);
+	rec->expires = (unsigned int)(time(NULL) + ttl);
+	rec->qtype = qtype;
+	rec->server_class = server_class;
+	rec->rcode = reply->rcode;
+	rec->ans_count = reply->ans_count;
+
+	p = buffer + sizeof(cache_record);
+	strcpy((char *)p, name);
+	p += strlen(name) + 1;
+	for (i = 0; i < reply->ans_count; i++)
+	{
+		type = reply->answers[i].type;
+		memcpy(p, &type, 2);
+		memcpy(p + 2, &reply->answers[i].ttl, 4);
+		len = strlen(reply->answers[i].data);
+		memcpy(p + 6, reply->answers[i].data, len + 1);
+		p += 6 + len + 1;
+	}
+	len = p - buffer;
+	while (len % 8)
+		buffer[len++] = '\0';
+	rec->size = len;
+
+	pthread_mutex_lock(&fresh_lock);
+	if (fresh_used + len > fresh_size)
+	{
+		grown = (unsigned char *)realloc(fresh, fresh_size + FRESH_STEP);
+		if (grown == NULL)
+		{
+			pthread_mutex_unlock(&fresh_lock);
+			return;
+		}
+		fresh = grown;
+		fresh_size += FRESH_STEP;
+	}
+	memcpy(fresh + fresh_used, buffer, len);
+	fresh_used += len;
+	pthread_mutex_unlock(&fresh_lock);
+}
+
+
+/*
+ * Puts a record into the table. A record with the same key is kept,
+ * unless replace is set. Returns 1 if a new key was added.
+ */
+static int table_add(const cache_record **table, unsigned int slots, const cache_record *rec, int replace)
+{
+	unsigned int i;
+
+	for (i = rec->hash & (slots - 1); table[i] != NULL; i = (i + 1) & (slots - 1))
+	{
+		if (same_key(table[i], rec))
+		{
+			if (replace)
+				table[i] = rec;
+			return 0;
+		}
+	}
+	table[i] = rec;
+
+	return 1;
+}
+
+
+/*
+ * Writes the records of table to file: the header, the index and the
+ * records in slot order. Returns -1 on failure.
+ */
+static int write_table(const char *file, const cache_record **table, unsigned int slots, unsigned int count)
+{
+	cache_header header;
+	cache_slot slot;
+	unsigned long long offset;
+	unsigned int i;
+	FILE *f;
+
+	f = fopen(file, "wb");
+	if (f == NULL)
+		return -1;
+
+	offset = sizeof(cache_header) + (unsigned long long)slots * sizeof(cache_slot);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, 8);
+	header.slots = slots;
+	header.count = count;
+	header.size = offset;
+	for (i = 0; i < slots; i++)
+	{
+		if (table[i])
+			header.size += table[i]->size;
+	}
+	fwrite(&header, sizeof(header), 1, f);
+
+	for (i = 0; i < slots; i++)
+	{
+		slot.hash = table[i] ? table[i]->hash : 0;
+		slot.offset = table[i] ? offset : 0;
+		if (table[i])
+			offset += table[i]->size;
+		fwrite(&slot, sizeof(slot), 1, f);
+	}
+	for (i = 0; i < slots; i++)
+	{
+		if (table[i])
+			fwrite(table[i], table[i]->size, 1, f);
+	}
+
+	if (ferror(f))
+	{
+		fclose(f);
+		return -1;
+	}
+
+	return (fclose(f) == 0) ? 0 : -1;
+}
+
+
+/*
+ * Writes the answers of this run and the unexpired ones of earlier
+ * runs to the cache file, replacing it atomically. Returns the number
+ * of records written or -1 on failure.
+ */
+int cache_close(void)
+{
+	const cache_header *old = (const cache_header *)mapped;
+	const cache_slot *old_slots;
+	const cache_record **table;
+	const cache_record *rec;
+	char filename[4096];
+	unsigned int slots = 64;
+	unsigned int fresh_count = 0, count = 0, i;
+	size_t pos;
+	time_t now = time(NULL);
+	int ret = -1;
+
+	if (cache_file == NULL)
+		return 0;
+
+	for (pos = 0; pos < fresh_used; pos += ((const cache_record *)(fresh + pos))->size)
+		fresh_count++;
+	while (slots < (fresh_count + (old ? old->count : 0)) * 2)
+		slots *= 2;
+
+	table = (const cache_record **)calloc(slots, sizeof(cache_record *));
+	if (table != NULL)
+	{
+		/* Answers of this run come first, the last one of a name wins */
+		for (pos = 0; pos < fresh_used; pos += rec->size)
+		{
+			rec = (const cache_record *)(fresh + pos);
+			count += table_add(table, slots, rec, 1);
+		}
+		if (old)
+		{
+			old_slots = (const cache_slot *)(mapped + sizeof(cache_header));
+			for (i = 0; i < old->slots; i++)
+			{
+				if (old_slots[i].offset == 0)
+					continue;
+				rec = mapped_record(&old_slots[i]);
+				if ((rec != NULL) && (rec->expires > now))
+					count += table_add(table, slots, rec, 0);
+			}
+		}
+
+		snprintf(filename, sizeof(filename), "%s.tmp", cache_file);
+		if ((write_table(filename, table, slots, count) == 0) && (rename(filename, cache_file) == 0))
+			ret = count;
+		else
+			remove(filename);
+		free(table);
+	}
+
+	free(fresh);
+	fresh = NULL;
+	fresh_size = 0;
+	fresh_used = 0;
+	if (mapped)
+		munmap(mapped, mapped_size);
+	mapped = NULL;
+	mapped_size = 0;
+	cache_file = NULL;
+
+	return ret;
+}
+
+
+/*
+ * Returns the number of lookups answered from the cache.
+ */
+unsigned int cache_hits(void)
+{
+	return hits;
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "dns.h"
+
+/* Servers an answer came from. Resolvers and authoritative servers
+ * may answer differently, so their answers are kept apart */
+#define CACHE_RESOLVER      0
+#define CACHE_AUTHORITATIVE 1
+
+/* Answers are kept at most this many seconds, whatever their TTL */
+#define CACHE_MAX_TTL       604800
+
+/* Identifies the file format, bumped on incompatible changes */
+#define CACHE_MAGIC         "DNSNC001"
+
+/* Start of a cache file. The header is followed by the index and the
+ * records, so the file can be used right after mapping it */
+typedef struct
+{
+	char magic[8];
+	unsigned int slots;            // number of index slots (power of two)
+	unsigned int count;            // number of records
+	unsigned long long size;       // size of the file in bytes
+} cache_header;
+
+/* Index slot, offset 0 marks an empty slot */
+typedef struct
+{
+	unsigned long long hash;
+	unsigned long long offset;     // position of the record in the file
+} cache_slot;
+
+/* Fixed part of a record, followed by the name and the answers. Each
+ * answer is stored as type (2 bytes), TTL (4 bytes) and its data as a
+ * zero terminated string */
+typedef struct
+{
+	unsigned long long hash;
+	unsigned int expires;          // seconds since the epoch
+	unsigned short qtype;
+	unsigned char server_class;
+	unsigned char rcode;
+	unsigned short ans_count;
+	unsigned short size;           // bytes including padding to 8 bytes
+} cache_record;
+
+int cache_open(const char *file);
+int cache_lookup(const char *name, int qtype, int server_class, struct DNS_REPLY *reply);
+void cache_store(const char *name, int qtype, int server_class, struct DNS_REPLY *reply);
+int cache_close(void);
+unsigned int cache_hits(void);
+
+#endif /* CACHE_H */
@@ -0,0 +1,440 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+/*
+ * codecbench - measures the time and the heap allocations per call of
+ * the DNS name encoder, the name decoders, the reply parser and the
+ * in-addr.arpa construction over a corpus of replies.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <arpa/inet.h>
+#include "dns.h"
+#include "name.h"
+
+#define MAX_REPLIES     1024
+#define MAX_NAMES       16384
+#define MAX_ADDRS       4096
+#define BENCH_MS        200     // default time spent in every benchmark
+
+/* Heap use, counted by the allocator functions below */
+static unsigned long allocs = 0;
+static unsigned long long allocated = 0;
+static unsigned long long freed = 0;
+
+/* Corpus */
+static unsigned char *replies[MAX_REPLIES];
+static int reply_lens[MAX_REPLIES];
+static int reply_count = 0;
+static unsigned char *name_replies[MAX_NAMES];    // reply a name is in
+static int name_offsets[MAX_NAMES];               // offset of the name in it
+static int name_lens[MAX_NAMES];                  // length of that reply
+static char *names[MAX_NAMES];                    // name in dotted format
+static int name_count = 0;
+static char *addrs[MAX_ADDRS];
+static char *addrs6[MAX_ADDRS];                   // the same in 2001:db8::/96
+static int addr_count = 0;
+
+/* Keeps the compiler from dropping the results */
+static volatile unsigned long sink;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+
+/*
+ * The allocator functions of the C library are replaced by counting
+ * wrappers, which also catch the calls made by strdup and the like.
+ */
+void *malloc(size_t size)
+{
+	void *ptr = __libc_malloc(size);
+
+	allocs++;
+	if (ptr)
+		allocated += malloc_usable_size(ptr);
+	return ptr;
+}
+
+
+void *calloc(size_t count, size_t size)
+{
+	void *ptr = __libc_calloc(count, size);
+
+	allocs++;
+	if (ptr)
+		allocated += malloc_usable_size(ptr);
+	return ptr;
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+	if (ptr)
+		freed += malloc_usable_size(ptr);
+	ptr = __libc_realloc(ptr, size);
+	allocs++;
+	if (ptr)
+		allocated += malloc_usable_size(ptr);
+	return ptr;
+}
+
+
+void free(void *ptr)
+{
+	if (ptr)
+		freed += malloc_usable_size(ptr);
+	__libc_free(ptr);
+}
+
+
+/*
+ * Returns the current time in nanoseconds.
+ */
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * Remembers the name at offset pos of a reply, unless it is the root.
+ * Returns the number of bytes the name occupies at pos or -1 if it is
+ * malformed.
+ */
+static int add_name(unsigned char *reply, int len, int pos)
+{
+	char name[NAME_TEXT_MAX];
+	int count;
+
+	count = name_decode(reply, len, pos, name, sizeof(name));
+	if ((count > 0) && (name[0] != '\0') && (name_count < MAX_NAMES))
+	{
+		name_replies[name_count] = reply;
+		name_offsets[name_count] = pos;
+		name_lens[name_count] = len;
+		names[name_count++] = strdup(name);
+	}
+
+	return count;
+}
+
+
+/*
+ * Collects the names and IPv4 addresses of a reply. Returns -1 if the
+ * reply is malformed.
+ */
+static int scan_reply(unsigned char *reply, int len)
+{
+	char addr[INET6_ADDRSTRLEN];
+	int records, type, rdlen;
+	int pos = 12;
+	int i, stop;
+
+	if (len < 12)
+		return -1;
+
+	for (i = 0; i < ((reply[4] << 8) | reply[5]); i++)
+	{
+		stop = add_name(reply, len, pos);
+		if (stop < 0)
+			return -1;
+		pos += stop + 4;
+	}
+
+	records = ((reply[6] << 8) | reply[7]) + ((reply[8] << 8) | reply[9]) + ((reply[10] << 8) | reply[11]);
+	for (i = 0; i < records; i++)
+	{
+		stop = add_name(reply, len, pos);
+		if ((stop < 0) || (pos + stop + 10 > len))
+			return -1;
+		pos += stop;
+		type = (reply[pos] << 8) | reply[pos + 1];
+		rdlen = (reply[pos + 8] << 8) | reply[pos + 9];
+		pos += 10;
+		if (pos + rdlen > len)
+			return -1;
+
+		switch (type)
+		{
+			case DNS_RES_REC_A:
+				if ((rdlen == 4) && (addr_count < MAX_ADDRS))
+				{
+					inet_ntop(AF_INET, reply + pos, addr, sizeof(addr));
+					addrs[addr_count] = strdup(addr);
+					snprintf(addr, sizeof(addr), "2001:db8::%s", addrs[addr_count]);
+					addrs6[addr_count++] = strdup(addr);
+				}
+				break;
+			case DNS_RES_REC_NS:
+			case DNS_RES_REC_CNAME:
+			case DNS_RES_REC_PTR:
+				add_name(reply, len, pos);
+				break;
+			case DNS_RES_REC_MX:
+				add_name(reply, len, pos + 2);
+				break;
+			case DNS_RES_REC_SOA:
+				stop = add_name(reply, len, pos);
+				if (stop > 0)
+					add_name(reply, len, pos + stop);
+				break;
+		}
+		pos += rdlen;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Reads the corpus, one reply per line in hex. Returns the number of
+ * replies or -1 on error.
+ */
+static int load_corpus(const char *file)
+{
+	FILE *f;
+	char line[65536 * 2 + 2];
+	static struct DNS_REPLY parsed;
+	unsigned char *reply;
+	int len, i;
+	unsigned int byte;
+
+	f = fopen(file, "r");
+	if (f == NULL)
+	{
+		fprintf(stderr, "Error: %s could not be opened.\n", file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) && (reply_count < MAX_REPLIES))
+	{
+		if ((line[0] == '#') || (line[0] == '\n'))
+			continue;
+		len = strcspn(line, "\r\n") / 2;
+		reply = malloc(len);
+		if (reply == NULL)
+			break;
+		for (i = 0; i < len; i++)
+		{
+			if (sscanf(line + 2 * i, "%2x", &byte) != 1)
+				break;
+			reply[i] = byte;
+		}
+		if ((i < len) || (dns_parse_reply(reply, len, &parsed) < 0) || (scan_reply(reply, len) < 0))
+		{
+			fprintf(stderr, "Warning: Skipping malformed reply %d.\n", reply_count + 1);
+			free(reply);
+			continue;
+		}
+		replies[reply_count] = reply;
+		reply_lens[reply_count++] = len;
+	}
+
+	fclose(f);
+
+	return reply_count;
+}
+
+
+/*
+ * Encodes every name of the corpus as build_query does.
+ */
+static int bench_encode(int i)
+{
+	unsigned char wire[NAME_WIRE_MAX];
+
+	sink += name_encode(names[i % name_count], wire, 0);
+
+	return 1;
+}
+
+
+/*
+ * Encodes every name of the corpus in lower case, as for NSEC3 hashes.
+ */
+static int bench_encode_lower(int i)
+{
+	unsigned char wire[NAME_WIRE_MAX];
+
+	sink += name_encode(names[i % name_count], wire, 1);
+
+	return 1;
+}
+
+
+/*
+ * Decodes every name of the corpus.
+ */
+static int bench_decode(int i)
+{
+	char name[NAME_TEXT_MAX];
+
+	i %= name_count;
+	sink += name_decode(name_replies[i], name_lens[i], name_offsets[i], name, sizeof(name));
+
+	return 1;
+}
+
+
+/*
+ * Decodes every reply of the corpus with dns_parse_reply.
+ */
+static int bench_parse(int i)
+{
+	static struct DNS_REPLY reply;
+
+	i %= reply_count;
+	dns_parse_reply(replies[i], reply_lens[i], &reply);
+	sink += reply.ans_count;
+
+	return 1;
+}
+
+
+/*
+ * Turns every address of the corpus into its in-addr.arpa name.
+ */
+static int bench_arpa(int i)
+{
+	char arpa[256];
+
+	prep_inaddr_arpa(arpa, addrs[i % addr_count]);
+	sink += arpa[0];
+
+	return 1;
+}
+
+
+/*
+ * Turns every address of the corpus, moved into an IPv6 prefix, into
+ * its ip6.arpa name.
+ */
+static int bench_arpa6(int i)
+{
+	char arpa[256];
+
+	prep_inaddr_arpa(arpa, addrs6[i % addr_count]);
+	sink += arpa[0];
+
+	return 1;
+}
+
+
+/*
+ * Calls fn for at least ms milliseconds and prints the time and the
+ * heap use per call.
+ */
+static void run(const char *label, int (*fn)(int), int ms)
+{
+	unsigned long long start, elapsed;
+	unsigned long long bytes, leaked;
+	unsigned long calls, i;
+	unsigned long count;
+
+	/* Warm up the caches */
+	for (i = 0; i < 1000; i++)
+		fn(i);
+
+	allocs = 0;
+	allocated = 0;
+	freed = 0;
+	calls = 0;
+	start = now_ns();
+	do
+	{
+		for (i = 0; i < 10000; i++)
+			fn(calls + i);
+		calls += 10000;
+		elapsed = now_ns() - start;
+	}
+	while (elapsed < (unsigned long long)ms * 1000000);
+
+	count = allocs;
+	bytes = allocated;
+	leaked = allocated - freed;
+	printf("%-28s %10.1f %12.2f %12.1f %12.1f\n", label, (double)elapsed / calls,
+		(double)count / calls, (double)bytes / calls, (double)leaked / calls);
+}
+
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-t ms] corpus\n", name);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int ms = BENCH_MS;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:h")) != -1)
+	{
+		switch (c)
+		{
+			case 't':
+				ms = atoi(optarg);
+				if (ms < 1)
+				{
+					fprintf(stderr, "Error: Invalid time %s.\n", optarg);
+					return -1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return (c == 'h') ? 0 : -1;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (load_corpus(argv[optind]) < 0)
+		return -1;
+	if ((reply_count == 0) || (name_count == 0) || (addr_count == 0))
+	{
+		fprintf(stderr, "Error: The corpus needs replies with names and A records.\n");
+		return -1;
+	}
+
+	printf("Corpus: %d replies, %d names, %d addresses\n\n", reply_count, name_count, addr_count);
+	printf("%-28s %10s %12s %12s %12s\n", "Benchmark", "ns/op", "allocs/op", "bytes/op", "leaked/op");
+	run("name_encode", bench_encode, ms);
+	run("name_encode (lower case)", bench_encode_lower, ms);
+	run("name_decode", bench_decode, ms);
+	run("dns_parse_reply", bench_parse, ms);
+	run("prep_inaddr_arpa", bench_arpa, ms);
+	run("prep_inaddr_arpa (IPv6)", bench_arpa6, ms);
+
+	return 0;
+}
@@ -0,0 +1,197 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "hashset.h"
+#include "dedup.h"
+
+
+/*
+ * Creates a set using at most memory bytes for its hashes. Returns
+ * NULL if there is not enough memory.
+ */
+dedup *dedup_create(unsigned long memory)
+{
+	dedup *set;
+	unsigned int slots = 64;
+
+	/* The exact set is created at its final size and never grows */
+	while ((slots < 0x40000000) && ((unsigned long)slots * 2 * sizeof(unsigned long long) <= memory))
+		slots *= 2;
+
+	set = (dedup *)malloc(sizeof(dedup));
+	if (set == NULL)
+		return NULL;
+
+	set->exact = hashset_create(slots / 2);
+	if (set->exact == NULL)
+	{
+		free(set);
+		return NULL;
+	}
+	set->blocks = NULL;
+	set->block_count = slots / 8;
+	set->limit = slots / 2;
+	set->count = 0;
+	pthread_rwlock_init(&set->lock, NULL);
+
+	return set;
+}
+
+
+/*
+ * Picks the block of a hash and sets its bits. Returns 1 if one of the
+ * bits was clear, i.e. the hash was certainly not added before.
+ */
+static int bloom_add(dedup *set, unsigned long long hash)
+{
+	unsigned long long *block;
+	unsigned long long mask, old;
+	unsigned int a, b, bit, i;
+	int ret = 0;
+
+	/* Spread the bits of the hash, names often differ in a few bytes */
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	/* A single block of 64 bytes is touched, i.e. one cache line */
+	block = set->blocks + (hash & (set->block_count - 1)) * 8;
+	a = (unsigned int)(hash >> 32);
+	b = (unsigned int)(hash >> 20) | 1;
+
+	for (i = 0; i < DEDUP_BLOOM_BITS; i++)
+	{
+		bit = (a + i * b) & 511;
+		mask = 1ULL << (bit & 63);
+		if (block[bit >> 6] & mask)
+			continue;
+		old = __sync_fetch_and_or(&block[bit >> 6], mask);
+		if (!(old & mask))
+			ret = 1;
+	}
+
+	return ret;
+}
+
+
+/*
+ * Moves the hashes of the exact set to the filter. Must be called with
+ * the write lock held. Returns -1 if there is not enough memory, the
+ * exact set is kept in that case.
+ */
+static int switch_to_filter(dedup *set)
+{
+	hashset *exact = set->exact;
+	unsigned int i;
+
+	set->blocks = (unsigned long long *)calloc((size_t)set->block_count * 8, sizeof(unsigned long long));
+	if (set->blocks == NULL)
+		return -1;
+
+	for (i = 0; i < exact->size; i++)
+	{
+		if (exact->slots[i] != 0)
+			bloom_add(set, exact->slots[i]);
+	}
+	set->exact = NULL;
+	hashset_free(exact);
+
+	return 0;
+}
+
+
+/*
+ * Adds a hash to the set. Returns 1 if it was added, 0 if it was
+ * present already (or the filter believes so) and -1 if there is not
+ * enough memory.
+ */
+int dedup_add(dedup *set, unsigned long long hash)
+{
+	int ret;
+
+	if (hash == 0)
+		hash = 1;
+
+	pthread_rwlock_rdlock(&set->lock);
+	if ((set->exact != NULL) && (hashset_count(set->exact) >= set->limit))
+	{
+		pthread_rwlock_unlock(&set->lock);
+		pthread_rwlock_wrlock(&set->lock);
+		if ((set->exact != NULL) && (hashset_count(set->exact) >= set->limit))
+		{
+			/* Without memory for the filter the exact set keeps growing */
+			if (switch_to_filter(set) < 0)
+				set->limit = (unsigned int)-1;
+		}
+		pthread_rwlock_unlock(&set->lock);
+		pthread_rwlock_rdlock(&set->lock);
+	}
+
+	if (set->exact != NULL)
+		ret = hashset_add(set->exact, hash);
+	else
+		ret = bloom_add(set, hash);
+	if (ret == 1)
+		__sync_add_and_fetch(&set->count, 1);
+
+	pthread_rwlock_unlock(&set->lock);
+
+	return ret;
+}
+
+
+/*
+ * Checks whether the set still keeps its hashes exactly.
+ */
+int dedup_is_exact(dedup *set)
+{
+	int ret;
+
+	pthread_rwlock_rdlock(&set->lock);
+	ret = (set->exact != NULL);
+	pthread_rwlock_unlock(&set->lock);
+
+	return ret;
+}
+
+
+/*
+ * Returns the number of hashes added to the set.
+ */
+unsigned int dedup_count(dedup *set)
+{
+	return set->count;
+}
+
+
+/*
+ * Frees a set along with its hashes.
+ */
+void dedup_free(dedup *set)
+{
+	if (set == NULL)
+		return;
+
+	pthread_rwlock_destroy(&set->lock);
+	hashset_free(set->exact);
+	free(set->blocks);
+	free(set);
+}
@@ -0,0 +1,49 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <pthread.h>
+#include "hashset.h"
+
+/* Bits set per hash in the Bloom filter */
+#define DEDUP_BLOOM_BITS 8
+
+/* Set of names used to drop duplicates. Hashes are kept exactly until
+ * the set would exceed its memory limit, afterwards they go to a
+ * blocked Bloom filter of the same size. The filter never forgets a
+ * name, but may take a new name for a duplicate. */
+typedef struct
+{
+	hashset *exact;               // NULL once the filter is used
+	unsigned long long *blocks;   // filter, 512 bits per block
+	unsigned int block_count;
+	unsigned int limit;           // most hashes kept exactly
+	unsigned int count;           // hashes added
+	pthread_rwlock_t lock;        // held for writing while switching
+} dedup;
+
+dedup *dedup_create(unsigned long memory);
+int dedup_add(dedup *set, unsigned long long hash);
+int dedup_is_exact(dedup *set);
+unsigned int dedup_count(dedup *set);
+void dedup_free(dedup *set);
+
+#endif /* DEDUP_H */
@@ -20,429 +20,1051 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include "dns.h"
+#include "name.h"
+#include "trace.h"
+#include "stats.h"
+
+/* Port DNS servers are contacted on */
+static int dns_port = 53;
+
+/* Seconds to wait for the reply to a query */
+#define DNS_TIMEOUT        5
+
+/* Receive and send buffer size of the query sockets */
+#define DNS_SOCKET_BUFFER  (256 * 1024)
+
+/* UDP socket every thread keeps for its queries */
+typedef struct
+{
+	int fd;              // -1 until the first query of the thread
+	unsigned int seed;   // state of the query id generator
+} dns_socket;
+
+static pthread_key_t socket_key;
+static pthread_once_t socket_once = PTHREAD_ONCE_INIT;
+static int socket_key_created = 0;
 
 
 /*
- * This will convert www.google.com to 3www6google3com
- * got it :)
- * */
-void change_to_dns_name_format(unsigned char* dns, unsigned char* host)
+ * Decodes the type bitmaps of NSEC and NSEC3 records. Only window 0
+ * (types 0 to 255) is kept, which covers all commonly used types.
+ */
+static void parse_type_bitmaps(unsigned char *bitmaps, int len, unsigned char *typemap)
 {
-	int lock = 0 , i;
-	strcat((char*)host, ".");
+	int window, bitmaplen, pos = 0;
 
-	for(i = 0; i < strlen((char*)host); i++)
+	memset(typemap, 0, 32);
+
+	while (pos + 2 <= len)
 	{
-		if(host[i] == '.')
-		{
-			*dns++ = i - lock;
-			for(; lock<i; lock++)
-			{
-				*dns++ = host[lock];
-			}
-			lock++; //or lock=i+1;
-		}
+		window = bitmaps[pos];
+		bitmaplen = bitmaps[pos + 1];
+		if ((bitmaplen > 32) || (pos + 2 + bitmaplen > len))
+			return;
+
+		if (window == 0)
+			memcpy(typemap, bitmaps + pos + 2, bitmaplen);
+
+		pos += 2 + bitmaplen;
 	}
-	*dns++ = '\0';
 }
 
 
 /*
- * Queries a DNS server by sending a host name. Tries to retrieve 
- * one or more ip addresses for the specified host name.
+ * Decodes the rdata of an NSEC3 record into the presentation format
+ * "<iterations> <salt> <next hashed owner>" (salt in hex or "-", hash
+ * in base32hex) and its type bitmaps.
  */
-int dns_query_a_record(char *server, char *host, char *ip_addr[])
+static int parse_nsec3(unsigned char *rdata, struct DNS_RR *rr)
 {
-	char buffer[65536];
-	int i, j, s, stop;
-	int ret = 0;
-	char *qname, *reader;
-	struct sockaddr_in a, dest;
-	struct DNS_HEADER *dns = NULL;
-	struct QUESTION *qinfo = NULL;
-	struct RES_RECORD answers[20];
-    struct timeval timeout;      
+	static const char hex[] = "0123456789abcdef";
+	int iterations, saltlen, hashlen, pos, p, i;
 
-	/* Initialize buffer */
-	memset(buffer, 0, 65536);
+	if (rr->data_len < 6)
+		return -1;
 
-	/* Open UDP network socket for DNS packets */
-	s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);	
+	iterations = (rdata[2] << 8) | rdata[3];
+	saltlen = rdata[4];
+	if (5 + saltlen + 1 > rr->data_len)
+		return -1;
+	hashlen = rdata[5 + saltlen];
+	pos = 6 + saltlen;
+	if ((pos + hashlen > rr->data_len) || (saltlen * 2 + hashlen * 2 + 16 > (int)sizeof(rr->data)))
+		return -1;
 
-	/* Set socket options for receive operations */
-    timeout.tv_sec = 5;
-    timeout.tv_usec = 0;
-    ret = setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-    if (ret < 0)
-    {
-    	return -3;
-    }
+	p = sprintf(rr->data, "%d ", iterations);
+	if (saltlen == 0)
+		rr->data[p++] = '-';
+	for (i = 0; i < saltlen; i++)
+	{
+		rr->data[p++] = hex[rdata[5 + i] >> 4];
+		rr->data[p++] = hex[rdata[5 + i] & 0x0F];
+	}
+	rr->data[p++] = ' ';
+	p += dns_base32hex_encode(rdata + pos, hashlen, rr->data + p);
+	rr->data[p] = '\0';
 
-	/* Set target */
-	dest.sin_family = AF_INET;
-	dest.sin_port = htons(53);
-	dest.sin_addr.s_addr = inet_addr(server);
+	parse_type_bitmaps(rdata + pos + hashlen, rr->data_len - pos - hashlen, rr->typemap);
 
-	/* Fill the DNS header structure */
-	dns = (struct DNS_HEADER *)&buffer;
-	dns->id = (unsigned short) htons(getpid());
-	dns->qr = 0;              // This is a query
-	dns->opcode = 0;          // This is a standard query
-	dns->aa = 0;              // Not Authoritative
-	dns->tc = 0;              // This message is not truncated
-	dns->rd = 1;              // Recursion Desired
-	dns->ra = 0;              // Recursion not available! hey we dont have it (lol)
-	dns->z = 0;
-	dns->ad = 0;
-	dns->cd = 0;
-	dns->rcode = 0;
-	dns->q_count = htons(1);  // we have only 1 question
-	dns->ans_count = 0;
-	dns->auth_count = 0;
-	dns->add_count = 0;
+	return 0;
+}
 
-	/* Point to the query portion */
-	qname = (char *)&buffer[sizeof(struct DNS_HEADER)];
-	change_to_dns_name_format(qname, host);
-	qinfo = (struct QUESTION *)&buffer[sizeof(struct DNS_HEADER) + (strlen((const char *)qname) + 1)];	
-	qinfo->qtype = htons(DNS_RES_REC_A);  // qtype = A
-	qinfo->qclass = htons(1); // qclass = IN
 
-	ret = sendto(s, (char *)buffer, sizeof(struct DNS_HEADER) + (strlen((const char *)qname) + 1) + 
-		sizeof(struct QUESTION), 0, (struct sockaddr *)&dest, sizeof(dest));
-	if (ret < 0)
-	{
-		return -1;  /* sendto failed */
-	}
-	
-	/* Receive the answer */
-	i = sizeof(dest);
-	ret = recvfrom(s, (char *)buffer, 65536, 0, (struct sockaddr *)&dest, (socklen_t *)&i);
-	if (ret < 0)
+/*
+ * Encodes binary data in base32hex without padding (RFC 4648), the
+ * encoding used for NSEC3 hashed owner names. Returns the number of
+ * characters written, dest is not terminated.
+ */
+int dns_base32hex_encode(const unsigned char *src, int len, char *dest)
+{
+	static const char alphabet[] = "0123456789abcdefghijklmnopqrstuv";
+	unsigned int buffer = 0;
+	int bits = 0, i, p = 0;
+
+	for (i = 0; i < len; i++)
 	{
-		/* Implement special handling if resource is temporarily unavailable
-		 * errorcode = 11
-		 */
-		if (errno == 11)
+		buffer = (buffer << 8) | src[i];
+		bits += 8;
+		while (bits >= 5)
 		{
-			return -4;
+			dest[p++] = alphabet[(buffer >> (bits - 5)) & 0x1F];
+			bits -= 5;
 		}
-		else
-		{
-			return -2;
-		}		
 	}
+	if (bits > 0)
+		dest[p++] = alphabet[(buffer << (5 - bits)) & 0x1F];
+
+	return p;
+}
 
-	reader = &buffer[sizeof(struct DNS_HEADER) + (strlen((const char *)qname) + 1) + 
-		sizeof(struct QUESTION)];
 
-	/* Process answers */
-	for (i = 0; i < ntohs(dns->ans_count); i++)
+/*
+ * Decodes base32hex data (case insensitive, no padding). Returns the
+ * number of bytes written or -1 if src contains invalid characters.
+ */
+int dns_base32hex_decode(const char *src, int len, unsigned char *dest)
+{
+	unsigned int buffer = 0;
+	int bits = 0, i, p = 0, v;
+
+	for (i = 0; i < len; i++)
 	{
-		answers[i].name = read_name(reader, buffer, &stop);	
-		reader = reader + stop;  // ??? remove that line - useless
-		
-		answers[i].resource = (struct R_DATA *)(reader);
-		reader = reader + sizeof(struct R_DATA);
-			
-		/* If it is an IPv4 address */
-		if (ntohs(answers[i].resource->type) == 1)
-		{
-			answers[i].rdata = (unsigned char *)malloc(ntohs(answers[i].resource->data_len));
-			for (j = 0; j < ntohs(answers[i].resource->data_len); j++)
-			{
-				answers[i].rdata[j] = reader[j];
-			}
-			
-			answers[i].rdata[ntohs(answers[i].resource->data_len)] = '\0';
-			reader = reader + ntohs(answers[i].resource->data_len);
-		}
+		if ((src[i] >= '0') && (src[i] <= '9'))
+			v = src[i] - '0';
+		else if ((tolower((unsigned char)src[i]) >= 'a') && (tolower((unsigned char)src[i]) <= 'v'))
+			v = tolower((unsigned char)src[i]) - 'a' + 10;
 		else
+			return -1;
+
+		buffer = (buffer << 5) | v;
+		bits += 5;
+		if (bits >= 8)
 		{
-			answers[i].rdata = read_name(reader, buffer, &stop);
-			reader = reader + stop;
+			dest[p++] = (buffer >> (bits - 8)) & 0xFF;
+			bits -= 8;
 		}
 	}
-	
-	for (i = 0; i < htons(dns->ans_count); i++)
+
+	return p;
+}
+
+
+/*
+ * Checks whether the type bitmap of an NSEC or NSEC3 record lists a
+ * record type.
+ */
+int dns_rr_has_type(struct DNS_RR *rr, int type)
+{
+	if ((type < 0) || (type > 255))
+		return 0;
+
+	return (rr->typemap[type / 8] >> (7 - (type % 8))) & 1;
+}
+
+
+/*
+ * Splits a dotted name into its labels. Returns the number of labels.
+ */
+static int split_labels(const char *name, const char *labels[], int lens[])
+{
+	int n = 0;
+
+	while ((*name != '\0') && (n < 128))
 	{
-		/* Process resource type A (IPv4 address) */
-		if (ntohs(answers[i].resource->type) == 1) 
+		labels[n] = name;
+		while ((*name != '\0') && (*name != '.'))
+			name++;
+		lens[n] = name - labels[n];
+		n++;
+		if (*name == '.')
+			name++;
+	}
+
+	return n;
+}
+
+
+/*
+ * Compares two domain names in canonical DNS order (RFC 4034), which
+ * compares labels from right to left and ignores case. Returns a value
+ * less than, equal to or greater than zero like strcmp.
+ */
+int dns_name_compare(const char *a, const char *b)
+{
+	const char *labels_a[128], *labels_b[128];
+	int lens_a[128], lens_b[128];
+	int na, nb, i, j, ca, cb;
+
+	na = split_labels(a, labels_a, lens_a);
+	nb = split_labels(b, labels_b, lens_b);
+
+	for (i = 1; (i <= na) && (i <= nb); i++)
+	{
+		for (j = 0; (j < lens_a[na - i]) && (j < lens_b[nb - i]); j++)
 		{
-			long *p;
-			p = (long *)answers[i].rdata;
-			a.sin_addr.s_addr = (*p);  // working without ntohl
-			ip_addr[i] = malloc(answers[i].resource->data_len);
-			strcpy(ip_addr[i], inet_ntoa(a.sin_addr));
+			ca = tolower((unsigned char)labels_a[na - i][j]);
+			cb = tolower((unsigned char)labels_b[nb - i][j]);
+			if (ca != cb)
+				return ca - cb;
 		}
+		if (lens_a[na - i] != lens_b[nb - i])
+			return lens_a[na - i] - lens_b[nb - i];
 	}
-	
-	return 0;
+
+	return na - nb;
 }
 
 
 /*
- * Queries a DNS server by sending an ip address. Tries to retrieve 
- * one or more domain names for the specified ip address.
+ * Decodes the resource record starting at offset pos of the received
+ * packet. Returns the offset of the next record or -1 if the record is
+ * malformed.
  */
-int dns_query_ptr_record(char *server, char *ip, char *domains[])
+static int parse_rr(unsigned char *buffer, int len, int pos, struct DNS_RR *rr)
 {
-	char buffer[65536];
-	char ip_inaddr_arpa[256];
-	int i, j, s, stop;
-	int ret = 0;
-	char *qname, *reader;
-	struct sockaddr_in a, dest;
+	struct R_DATA *resource = NULL;
+	int stop;
+
+	stop = name_decode(buffer, len, pos, rr->name, sizeof(rr->name));
+	if ((stop < 0) || (pos + stop + (int)sizeof(struct R_DATA) > len))
+		return -1;
+	pos += stop;
+
+	resource = (struct R_DATA *)&buffer[pos];
+	pos += sizeof(struct R_DATA);
+
+	rr->type = ntohs(resource->type);
+	rr->_class = ntohs(resource->_class);
+	rr->ttl = ntohl(resource->ttl);
+	rr->data_len = ntohs(resource->data_len);
+	rr->data[0] = '\0';
+	if (pos + rr->data_len > len)
+		return -1;
+
+	switch (rr->type)
+	{
+		case DNS_RES_REC_A:
+			if (rr->data_len == 4)
+				inet_ntop(AF_INET, &buffer[pos], rr->data, sizeof(rr->data));
+			break;
+		case DNS_RES_REC_NS:
+		case DNS_RES_REC_CNAME:
+		case DNS_RES_REC_PTR:
+			if (name_decode(buffer, len, pos, rr->data, sizeof(rr->data)) < 0)
+				return -1;
+			break;
+		case DNS_RES_REC_NSEC:
+			/* Next owner name followed by the type bitmaps */
+			stop = name_decode(buffer, pos + rr->data_len, pos, rr->data, sizeof(rr->data));
+			if (stop < 0)
+				return -1;
+			parse_type_bitmaps(buffer + pos + stop, rr->data_len - stop, rr->typemap);
+			break;
+		case DNS_RES_REC_NSEC3:
+			if (parse_nsec3(buffer + pos, rr) < 0)
+				return -1;
+			break;
+	}
+
+	return pos + rr->data_len;
+}
+
+
+/*
+ * Writes header and question of a query into buffer. The header bits
+ * are taken from flags (DNS_QF_* values). Returns the length of the
+ * query in bytes or -5 if host is too long.
+ */
+static int build_query(unsigned char *buffer, char *host, int qtype, int flags)
+{
+	unsigned char *qname;
+	int len;
 	struct DNS_HEADER *dns = NULL;
 	struct QUESTION *qinfo = NULL;
-	struct RES_RECORD answers[20];
-    struct timeval timeout;      
 
 	/* Initialize buffer */
-	memset(buffer, 0, 65536);
-
-	/* Open UDP network socket for DNS packets */
-	s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);	
-	
-	/* Set socket timeout for receive operations */
-    timeout.tv_sec = 5;
-    timeout.tv_usec = 0;
-    ret = setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-    if (ret < 0)
-    {
-    	return -3;
-    }
-	
-	/* Set target */
-	dest.sin_family = AF_INET;
-	dest.sin_port = htons(53);
-	dest.sin_addr.s_addr = inet_addr(server);
+	memset(buffer, 0, sizeof(struct DNS_HEADER));
 
 	/* Fill the DNS header structure */
-	dns = (struct DNS_HEADER *)&buffer;
+	dns = (struct DNS_HEADER *)buffer;
 	dns->id = (unsigned short) htons(getpid());
 	dns->qr = 0;              // This is a query
 	dns->opcode = 0;          // This is a standard query
 	dns->aa = 0;              // Not Authoritative
 	dns->tc = 0;              // This message is not truncated
-	dns->rd = 1;              // Recursion Desired
-	dns->ra = 0;              // Recursion not available! hey we dont have it (lol)
-	dns->z = 0;
-	dns->ad = 0;
-	dns->cd = 0;
-	dns->rcode = 0;
+	dns->rd = (flags & DNS_QF_NORECURSE) ? 0 : 1;   // Recursion Desired
+	dns->cd = (flags & DNS_QF_NOVALIDATE) ? 1 : 0;  // Checking Disabled
 	dns->q_count = htons(1);  // we have only 1 question
-	dns->ans_count = 0;
-	dns->auth_count = 0;
-	dns->add_count = 0;
 
 	/* Point to the query portion */
-	qname = (char *)&buffer[sizeof(struct DNS_HEADER)];
-	
-	/* Prepare ip address in in-addr.arpa format */
-	prep_inaddr_arpa(ip_inaddr_arpa, ip);
-	
-	change_to_dns_name_format(qname, ip_inaddr_arpa);
-	
-	qinfo = (struct QUESTION *)&buffer[sizeof(struct DNS_HEADER) + (strlen((const char *)qname) + 1)];	
-	qinfo->qtype = htons(DNS_RES_REC_PTR);  // qtype = PTR
+	qname = &buffer[sizeof(struct DNS_HEADER)];
+	len = name_encode(host, qname, 0);
+	if (len < 0)
+		return -5;
+	qinfo = (struct QUESTION *)&buffer[sizeof(struct DNS_HEADER) + len];
+	qinfo->qtype = htons(qtype);
 	qinfo->qclass = htons(1); // qclass = IN
 
-	
-	ret = sendto(s, (char *)buffer, sizeof(struct DNS_HEADER) + (strlen((const char *)qname) + 1) + 
-		sizeof(struct QUESTION), 0, (struct sockaddr *)&dest, sizeof(dest));
-	if (ret < 0)
+	return sizeof(struct DNS_HEADER) + len + sizeof(struct QUESTION);
+}
+
+
+/*
+ * Skips the question section of a received packet. Returns the offset
+ * of the first resource record or -1 if the packet is malformed.
+ */
+static int skip_questions(unsigned char *buffer, int len)
+{
+	struct DNS_HEADER *dns = (struct DNS_HEADER *)buffer;
+	char name[256];
+	int i, pos, stop;
+
+	pos = sizeof(struct DNS_HEADER);
+	for (i = 0; i < ntohs(dns->q_count); i++)
 	{
-		return -1;  /* sendto failed */
+		stop = name_decode(buffer, len, pos, name, sizeof(name));
+		if (stop < 0)
+			return -1;
+		pos += stop + sizeof(struct QUESTION);
 	}
-	
-	/* Receive the answer */
-	i = sizeof(dest);
-	ret = recvfrom(s, (char *)buffer, 65536, 0, (struct sockaddr *)&dest, (socklen_t *)&i);
-	if (ret < 0)
+
+	return pos;
+}
+
+
+/*
+ * Sets the port DNS servers are contacted on.
+ */
+void dns_set_port(int port)
+{
+	dns_port = port;
+}
+
+
+/*
+ * Appends an EDNS0 OPT record with the DNSSEC OK bit set to a query
+ * of length len. Returns the new length of the query.
+ */
+static int add_edns_dnssec(unsigned char *buffer, int len)
+{
+	struct DNS_HEADER *dns = (struct DNS_HEADER *)buffer;
+	struct R_DATA *resource;
+
+	buffer[len++] = 0;  // root owner name
+	resource = (struct R_DATA *)&buffer[len];
+	resource->type = htons(DNS_RES_REC_OPT);
+	resource->_class = htons(4096);       // UDP payload size
+	resource->ttl = htonl(0x00008000);    // DO bit
+	resource->data_len = 0;
+	dns->add_count = htons(1);
+
+	return len + sizeof(struct R_DATA);
+}
+
+
+/*
+ * Decodes a received DNS message of len bytes into reply. Returns 0 on
+ * success or -2 if the message is malformed.
+ */
+int dns_parse_reply(unsigned char *buffer, int len, struct DNS_REPLY *reply)
+{
+	struct DNS_HEADER *dns = NULL;
+	struct DNS_RR *rr, overflow;
+	int i, pos;
+
+	reply->ans_count = 0;
+	reply->auth_count = 0;
+	reply->add_count = 0;
+	if (len < (int)sizeof(struct DNS_HEADER))
+		return -2;
+
+	dns = (struct DNS_HEADER *)buffer;
+	reply->rcode = dns->rcode;
+	reply->aa = dns->aa;
+	reply->tc = dns->tc;
+	reply->ra = dns->ra;
+
+	pos = skip_questions(buffer, len);
+	if (pos < 0)
+		return -2;
+
+	/* Process answers, records beyond DNS_MAX_RR are parsed but dropped */
+	for (i = 0; i < ntohs(dns->ans_count); i++)
 	{
-		/* Implement special handling if resource is temporarily unavailable
-		 * errorcode = 11
-		 */
-		if (errno == 11)
+		rr = (reply->ans_count < DNS_MAX_RR) ? &reply->answers[reply->ans_count] : &overflow;
+		pos = parse_rr(buffer, len, pos, rr);
+		if (pos < 0)
+			return -2;
+		if (rr != &overflow)
+			reply->ans_count++;
+	}
+
+	/* Process authority records */
+	for (i = 0; i < ntohs(dns->auth_count); i++)
+	{
+		rr = (reply->auth_count < DNS_MAX_AUTH) ? &reply->authority[reply->auth_count] : &overflow;
+		pos = parse_rr(buffer, len, pos, rr);
+		if (pos < 0)
+			return -2;
+		if (rr != &overflow)
+			reply->auth_count++;
+	}
+
+	/* Process additional records, the OPT record of EDNS0 is skipped */
+	for (i = 0; i < ntohs(dns->add_count); i++)
+	{
+		rr = (reply->add_count < DNS_MAX_ADD) ? &reply->additional[reply->add_count] : &overflow;
+		pos = parse_rr(buffer, len, pos, rr);
+		if (pos < 0)
+			return -2;
+		if ((rr != &overflow) && (rr->type != DNS_RES_REC_OPT))
+			reply->add_count++;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Closes the socket of a thread that has ended.
+ */
+static void close_socket(void *arg)
+{
+	dns_socket *sock = (dns_socket *)arg;
+
+	if (sock->fd >= 0)
+		close(sock->fd);
+	free(sock);
+}
+
+
+/*
+ * Creates the key the sockets of the threads are kept under.
+ */
+static void create_socket_key(void)
+{
+	if (pthread_key_create(&socket_key, close_socket) == 0)
+		socket_key_created = 1;
+}
+
+
+/*
+ * Returns the UDP socket of the calling thread, opening it on the first
+ * query. The socket stays open for the lifetime of the thread, so every
+ * thread sends from a source port of its own and queries cost no socket
+ * setup. Returns NULL if the socket cannot be opened.
+ */
+static dns_socket *own_socket(void)
+{
+	dns_socket *sock;
+	int fd, size = DNS_SOCKET_BUFFER;
+
+	pthread_once(&socket_once, create_socket_key);
+	if (!socket_key_created)
+		return NULL;
+
+	sock = (dns_socket *)pthread_getspecific(socket_key);
+	if (sock == NULL)
+	{
+		sock = (dns_socket *)malloc(sizeof(dns_socket));
+		if (sock == NULL)
+			return NULL;
+		sock->fd = -1;
+		sock->seed = 0;
+		fd = open("/dev/urandom", O_RDONLY);
+		if (fd >= 0)
 		{
-			return -4;
+			if (read(fd, &sock->seed, sizeof(sock->seed)) != sizeof(sock->seed))
+				sock->seed = 0;
+			close(fd);
 		}
-		else
+		sock->seed ^= (unsigned int)trace_now() ^ (unsigned int)(unsigned long)sock;
+		if (sock->seed == 0)
+			sock->seed = 1;
+		pthread_setspecific(socket_key, sock);
+	}
+
+	if (sock->fd < 0)
+	{
+		sock->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (sock->fd < 0)
+			return NULL;
+
+		/* The kernel may cap the sizes, which is fine */
+		setsockopt(sock->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		setsockopt(sock->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	}
+
+	return sock;
+}
+
+
+/*
+ * Returns a random query id (xorshift32) in network byte order.
+ */
+static unsigned short next_query_id(dns_socket *sock)
+{
+	sock->seed ^= sock->seed << 13;
+	sock->seed ^= sock->seed >> 17;
+	sock->seed ^= sock->seed << 5;
+
+	return (unsigned short)(sock->seed >> 16);
+}
+
+
+/*
+ * Waits for the reply to the query with the given id from dest. Replies
+ * from other addresses, with another id, and late replies to earlier
+ * queries of the socket that timed out are dropped. Returns the length
+ * of the reply, -1 after the timeout or -2 if receiving failed.
+ */
+static int recv_reply(dns_socket *sock, struct sockaddr_in *dest, unsigned short id,
+	unsigned long long sent, unsigned char *buffer, int size)
+{
+	struct pollfd pfd;
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	unsigned long long now;
+	int len, wait;
+
+	pfd.fd = sock->fd;
+	pfd.events = POLLIN;
+	for (;;)
+	{
+		now = trace_now();
+		if (now >= sent + DNS_TIMEOUT * 1000000ULL)
+			return -1;
+		wait = (int)((sent + DNS_TIMEOUT * 1000000ULL - now + 999) / 1000);
+
+		len = poll(&pfd, 1, wait);
+		if ((len < 0) && (errno != EINTR))
+			return -2;
+		if (len <= 0)
+			continue;
+
+		fromlen = sizeof(from);
+		len = recvfrom(sock->fd, (char *)buffer, size, MSG_DONTWAIT, (struct sockaddr *)&from, &fromlen);
+		if (len < 0)
 		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+				continue;
 			return -2;
 		}
+
+		if ((len >= (int)sizeof(struct DNS_HEADER)) &&
+			(from.sin_addr.s_addr == dest->sin_addr.s_addr) &&
+			(from.sin_port == dest->sin_port) &&
+			(((struct DNS_HEADER *)buffer)->id == id) &&
+			((struct DNS_HEADER *)buffer)->qr)
+			return len;
 	}
-	
-	reader = &buffer[sizeof(struct DNS_HEADER) + (strlen((const char *)qname) + 1) + 
-		sizeof(struct QUESTION)];
+}
 
-	/* Process answers */
-	for (i = 0; i < ntohs(dns->ans_count); i++)
+
+/*
+ * Sends a single query of the given type to a DNS server and decodes
+ * all sections of the reply. flags is a combination of the DNS_QF_*
+ * values and controls the header bits of the query.
+ */
+int dns_query(char *server, char *host, int qtype, int flags, struct DNS_REPLY *reply)
+{
+	unsigned char buffer[65536];
+	int len;
+	int ret = 0;
+	struct sockaddr_in dest;
+	dns_socket *sock;
+	unsigned short id;
+	unsigned long long sent, received;
+	int kind, rcode;
+
+	reply->rcode = 0;
+	reply->ans_count = 0;
+	reply->aa = 0;
+	reply->tc = 0;
+	reply->ra = 0;
+	reply->auth_count = 0;
+	reply->add_count = 0;
+
+	len = build_query(buffer, host, qtype, flags);
+	if (len < 0)
+		return len;
+	if (flags & DNS_QF_DNSSEC)
+		len = add_edns_dnssec(buffer, len);
+
+	sock = own_socket();
+	if (sock == NULL)
+		return -3;
+	id = next_query_id(sock);
+	((struct DNS_HEADER *)buffer)->id = id;
+
+	/* Set target */
+	dest.sin_family = AF_INET;
+	dest.sin_port = htons(dns_port);
+	dest.sin_addr.s_addr = inet_addr(server);
+
+	stats_sent();
+	sent = trace_now();
+	ret = sendto(sock->fd, (char *)buffer, len, 0, (struct sockaddr *)&dest, sizeof(dest));
+	if (ret < 0)
+	{
+		stats_done(server, sent, sent, 0, TRACE_FAILED);
+		trace_query(server, qtype, sent, sent, 0, 0, TRACE_FAILED);
+		return -1;  /* sendto failed */
+	}
+
+	/* Receive the answer */
+	len = recv_reply(sock, &dest, id, sent, buffer, sizeof(buffer));
+	received = trace_now();
+	if (len >= 0)
+		kind = TRACE_ANSWERED;
+	else if (len == -1)
+		kind = TRACE_TIMEOUT;
+	else
+		kind = TRACE_FAILED;
+	rcode = (kind == TRACE_ANSWERED) ? ((struct DNS_HEADER *)buffer)->rcode : 0;
+	stats_done(server, sent, received, rcode, kind);
+	trace_query(server, qtype, sent, received, rcode, len, kind);
+	if (len == -1)
+		return -4;  /* timeout */
+	if (len < 0)
+	{
+		/* The socket is opened anew for the next query */
+		close(sock->fd);
+		sock->fd = -1;
+		return -2;
+	}
+	return dns_parse_reply(buffer, len, reply);
+}
+
+
+/*
+ * Checks whether name lies below zone, i.e. ends in ".zone". Case is
+ * ignored.
+ */
+static int is_below(const char *name, const char *zone)
+{
+	size_t len = strlen(name);
+	size_t zone_len = strlen(zone);
+
+	return (len > zone_len) && (name[len - zone_len - 1] == '.') &&
+		(strcasecmp(name + len - zone_len, zone) == 0);
+}
+
+
+/*
+ * Checks whether a reply refers the query for host to the name servers
+ * of a zone closer to host instead of answering it.
+ */
+static int is_referral(char *host, char *zone, struct DNS_REPLY *reply)
+{
+	struct DNS_RR *rr;
+	int i;
+
+	if (reply->aa || (reply->rcode != DNS_RCODE_NOERROR) || (reply->ans_count > 0))
+		return 0;
+
+	for (i = 0; i < reply->auth_count; i++)
 	{
-		answers[i].name = read_name(reader, buffer, &stop);	
-		reader = reader + stop;  // ??? remove that line - useless
-		
-		answers[i].resource = (struct R_DATA *)(reader);
-		reader = reader + sizeof(struct R_DATA);
-			
-		/* If it is an IPv4 address */
-		if (ntohs(answers[i].resource->type) == 1)
+		rr = &reply->authority[i];
+		if (rr->type != DNS_RES_REC_NS)
+			continue;
+
+		/* The delegated zone must be below the current one and
+		 * contain host */
+		if (!is_below(rr->name, zone))
+			continue;
+		if ((dns_name_compare(rr->name, host) == 0) || is_below(host, rr->name))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Picks the address of a name server a referral points to. Glue records
+ * from the additional section are preferred; otherwise the name server
+ * is resolved using resolver. Returns 0 and fills server on success.
+ */
+static int referral_server(struct DNS_REPLY *reply, char *resolver, char *server, char *zone)
+{
+	struct DNS_REPLY ns_reply;
+	int i, j;
+
+	for (i = 0; i < reply->auth_count; i++)
+	{
+		if (reply->authority[i].type != DNS_RES_REC_NS)
+			continue;
+
+		for (j = 0; j < reply->add_count; j++)
 		{
-			answers[i].rdata = (unsigned char *)malloc(ntohs(answers[i].resource->data_len));
-			for (j = 0; j < ntohs(answers[i].resource->data_len); j++)
+			if ((reply->additional[j].type == DNS_RES_REC_A) &&
+				(strcasecmp(reply->additional[j].name, reply->authority[i].data) == 0))
 			{
-				answers[i].rdata[j] = reader[j];
+				strcpy(server, reply->additional[j].data);
+				strcpy(zone, reply->authority[i].name);
+				return 0;
 			}
-			
-			answers[i].rdata[ntohs(answers[i].resource->data_len)] = '\0';
-			reader = reader + ntohs(answers[i].resource->data_len);
-		}
-		else
-		{
-			answers[i].rdata = read_name(reader, buffer, &stop);
-			reader = reader + stop;
 		}
 	}
-	
-	for (i = 0; i < htons(dns->ans_count); i++)
+
+	/* No glue, ask the resolver */
+	for (i = 0; (i < reply->auth_count) && (resolver != NULL); i++)
 	{
-		// Process resource type A (IPv4 address)
-		if (ntohs(answers[i].resource->type) == DNS_RES_REC_PTR) 
+		if (reply->authority[i].type != DNS_RES_REC_NS)
+			continue;
+
+		if (dns_query(resolver, reply->authority[i].data, DNS_RES_REC_A, 0, &ns_reply) < 0)
+			continue;
+
+		for (j = 0; j < ns_reply.ans_count; j++)
 		{
-			domains[i] = malloc(answers[i].resource->data_len);
-			strcpy(domains[i], answers[i].rdata);
+			if (ns_reply.answers[j].type == DNS_RES_REC_A)
+			{
+				strcpy(server, ns_reply.answers[j].data);
+				strcpy(zone, reply->authority[i].name);
+				return 0;
+			}
 		}
 	}
-	
+
+	return -1;
+}
+
+
+/*
+ * Queries a name server authoritative for zone directly with recursion
+ * disabled. Referrals to name servers of zones delegated below zone are
+ * followed, using glue records or resolver to find their addresses. The
+ * reply of the last server contacted is returned in reply.
+ */
+int dns_query_authoritative(char *server, char *zone, char *host, int qtype, char *resolver, struct DNS_REPLY *reply)
+{
+	char current[64];
+	char cut[256];
+	int i, ret;
+
+	snprintf(current, sizeof(current), "%s", server);
+	snprintf(cut, sizeof(cut), "%s", zone);
+
+	for (i = 0; i <= DNS_MAX_REFERRALS; i++)
+	{
+		ret = dns_query(current, host, qtype, DNS_QF_NORECURSE, reply);
+		if (ret < 0)
+			return ret;
+
+		if (!is_referral(host, cut, reply))
+			return 0;
+
+		if (referral_server(reply, resolver, current, cut) < 0)
+			return 0;  /* referral can't be followed, keep it */
+	}
+
 	return 0;
 }
 
 
-/* 
- * Prepares the IN-ADDR.ARPA address which is required for
- * doing the reverse DNS lookup.
+/*
+ * Reads exactly len bytes from a stream socket. Returns 0 on success,
+ * -1 if the connection was closed or timed out.
  */
-void prep_inaddr_arpa(char *dest, char *src)
+static int recv_all(int s, unsigned char *buffer, int len)
 {
-	char *copystr;
-	char *tmp;
-	char arpa_addr[256];
-	char *token[4];
-	int i = 0;
-	char *ptr;
-	
-	memset(arpa_addr, 0, 256);
-	
-	if (src != NULL) 
+	int ret, got = 0;
+
+	while (got < len)
 	{
-		/* strtok manipulats the source string. We therefore
-		 * have to make a copy first
-		 */
-		copystr = (char *)malloc(strlen(src));
-		strcpy(copystr, src);
-		ptr = strtok(copystr, ".");
-		while (ptr != NULL)
-		{
-			/* Save token */
-			token[i] = malloc(strlen(ptr));
-			strcpy(token[i], ptr);
-			i++;
-			
-			/* Get next token */
-			ptr = strtok(NULL, ".");
-		}
-		
-		/* Swap tokens */
-		tmp = token[0];
-		token[0] = token[3];
-		token[3] = tmp;
-		tmp = token[1];
-		token[1] = token[2];
-		token[2] = tmp;
-
-		/* Prepare whole "in-addr.arpa" string */
-		strcat(arpa_addr, token[0]);
-		strcat(arpa_addr, ".");
-		strcat(arpa_addr, token[1]);
-		strcat(arpa_addr, ".");
-		strcat(arpa_addr, token[2]);
-		strcat(arpa_addr, ".");
-		strcat(arpa_addr, token[3]);
-		strcat(arpa_addr, ".");
-		strcat(arpa_addr, "in-addr.arpa");
-
-		strcpy(dest, arpa_addr);
-
-		/* Free allocated heap memory */
-		free(copystr);
+		ret = recv(s, buffer + got, len - got, 0);
+		if (ret <= 0)
+			return -1;
+		got += ret;
 	}
+
+	return 0;
 }
 
 
-/* 
- * Decode the name from response.
+/*
+ * Requests a full zone transfer (AXFR) of zone from a DNS server over
+ * TCP. The transfer is parsed while it streams in and callback is
+ * invoked for every resource record. Returns the number of records
+ * transferred or a negative value if the transfer failed or was refused
+ * (-7 if callback aborted it). Records passed to callback before a
+ * failure stay with the caller.
  */
-unsigned char* read_name(unsigned char *reader, unsigned char *buffer, int *count)
+int dns_axfr(char *server, char *zone, dns_rr_callback callback, void *arg)
 {
-	unsigned char *name;
-	unsigned int p = 0, jumped = 0, offset;
-	int i, j;
-	
-	*count = 1;
-	name = (unsigned char *)malloc(256);
-	
-	name[0] = '\0';
-	
-	/* Read the name in 3www6google3com format */
-	while (*reader != 0)
+	unsigned char buffer[65536 + 2];
+	int i, s, len, pos;
+	int ret = 0, soa_count = 0, records = 0;
+	struct sockaddr_in dest;
+	struct DNS_HEADER *dns = NULL;
+	struct DNS_RR rr;
+	struct timeval timeout;
+
+	/* Queries over TCP are prefixed with their length */
+	len = build_query(buffer + 2, zone, DNS_RES_REC_AXFR, DNS_QF_NORECURSE);
+	if (len < 0)
+		return len;
+	buffer[0] = (len >> 8) & 0xFF;
+	buffer[1] = len & 0xFF;
+
+	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s < 0)
+		return -3;
+
+	timeout.tv_sec = 10;
+	timeout.tv_usec = 0;
+	if ((setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0) ||
+		(setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout)) < 0))
 	{
-		if (*reader >= 192)
+		close(s);
+		return -3;
+	}
+
+	dest.sin_family = AF_INET;
+	dest.sin_port = htons(dns_port);
+	dest.sin_addr.s_addr = inet_addr(server);
+
+	if (connect(s, (struct sockaddr *)&dest, sizeof(dest)) < 0)
+	{
+		close(s);
+		return -1;
+	}
+
+	if (send(s, buffer, len + 2, 0) != len + 2)
+	{
+		close(s);
+		return -1;
+	}
+
+	/* The transfer is complete when the closing SOA record arrives */
+	while (soa_count < 2)
+	{
+		if (recv_all(s, buffer, 2) < 0)
+		{
+			ret = -2;
+			break;
+		}
+		len = (buffer[0] << 8) | buffer[1];
+		if ((len < (int)sizeof(struct DNS_HEADER)) || (recv_all(s, buffer, len) < 0))
 		{
-			/* 49152 = 11000000 00000000 ;) */
-			offset = (*reader) * 256 + *(reader + 1) - 49152;
-			reader = buffer + offset - 1;
-			jumped = 1; // we have jumped to another location, so counting wont' go up!
+			ret = -2;
+			break;
 		}
-		else 
+
+		dns = (struct DNS_HEADER *)buffer;
+		if (dns->rcode != DNS_RCODE_NOERROR)
 		{
-			name[p++] = *reader;
+			/* Transfer refused or not authoritative */
+			ret = -6;
+			break;
 		}
-		
-		reader = reader + 1;
-		
-		if (jumped == 0)
+
+		pos = skip_questions(buffer, len);
+		if (pos < 0)
 		{
-			*count = *count + 1; // if we haven't jumped to another location then we can count up
+			ret = -2;
+			break;
+		}
+
+		for (i = 0; (i < ntohs(dns->ans_count)) && (soa_count < 2); i++)
+		{
+			pos = parse_rr(buffer, len, pos, &rr);
+			if (pos < 0)
+			{
+				ret = -2;
+				break;
+			}
+
+			if (rr.type == DNS_RES_REC_SOA)
+			{
+				soa_count++;
+			}
+			else if (soa_count == 0)
+			{
+				/* A transfer must start with the SOA record */
+				ret = -2;
+				break;
+			}
+
+			records++;
+			if (callback(&rr, arg) < 0)
+			{
+				ret = -7;
+				break;
+			}
+		}
+
+		if ((ret < 0) || (ntohs(dns->ans_count) == 0))
+		{
+			if (ret == 0)
+				ret = -6;
+			break;
 		}
 	}
-		
-	name[p] = '\0';  // string complete
-		
-	if (jumped == 1)
+
+	close(s);
+
+	return (ret < 0) ? ret : records;
+}
+
+
+/*
+ * Looks up the name servers of zone using a recursive DNS server and
+ * resolves their addresses. Up to max addresses are stored in ns_ips.
+ * Returns the number of addresses found or a negative value on error.
+ */
+int dns_lookup_ns(char *server, char *zone, char *ns_ips[], int max)
+{
+	struct DNS_REPLY reply, a_reply;
+	int i, j, k, ret, count = 0, known;
+
+	ret = dns_query(server, zone, DNS_RES_REC_NS, 0, &reply);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; (i < reply.ans_count) && (count < max); i++)
 	{
-		*count = *count + 1; // number of steps we actually moved forward in the packet
+		if (reply.answers[i].type != DNS_RES_REC_NS)
+			continue;
+
+		if (dns_query(server, reply.answers[i].data, DNS_RES_REC_A, 0, &a_reply) < 0)
+			continue;
+
+		for (j = 0; (j < a_reply.ans_count) && (count < max); j++)
+		{
+			if (a_reply.answers[j].type != DNS_RES_REC_A)
+				continue;
+
+			/* Name servers often share addresses */
+			known = 0;
+			for (k = 0; k < count; k++)
+			{
+				if (strcmp(ns_ips[k], a_reply.answers[j].data) == 0)
+					known = 1;
+			}
+			if (known)
+				continue;
+
+			ns_ips[count] = malloc(strlen(a_reply.answers[j].data) + 1);
+			strcpy(ns_ips[count], a_reply.answers[j].data);
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
+/*
+ * Queries a DNS server by sending a host name. Tries to retrieve 
+ * one or more ip addresses for the specified host name.
+ */
+int dns_query_a_record(char *server, char *host, char *ip_addr[])
+{
+	struct DNS_REPLY reply;
+	int i, j = 0;
+	int ret;
+
+	ret = dns_query(server, host, DNS_RES_REC_A, 0, &reply);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; (i < reply.ans_count) && (j < 20); i++)
+	{
+		/* Process resource type A (IPv4 address) */
+		if (reply.answers[i].type == DNS_RES_REC_A)
+		{
+			ip_addr[j] = malloc(strlen(reply.answers[i].data) + 1);
+			strcpy(ip_addr[j], reply.answers[i].data);
+			j++;
+		}
 	}
-	
-	/* Now convert 3www6google3com0 to www.google.com */
-	for (i = 0; i < (int)strlen((const char *)name); i++)
+
+	return 0;
+}
+
+
+/*
+ * Queries a DNS server by sending an ip address. Tries to retrieve 
+ * one or more domain names for the specified ip address.
+ */
+int dns_query_ptr_record(char *server, char *ip, char *domains[])
+{
+	struct DNS_REPLY reply;
+	char ip_inaddr_arpa[256];
+	int i, j = 0;
+	int ret;
+
+	/* Prepare ip address in in-addr.arpa format */
+	if (prep_inaddr_arpa(ip_inaddr_arpa, ip) < 0)
+		return -5;
+
+	ret = dns_query(server, ip_inaddr_arpa, DNS_RES_REC_PTR, 0, &reply);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; (i < reply.ans_count) && (j < 20); i++)
 	{
-		p = name[i];
-		for (j = 0; j < (int)p; j++)
+		/* Process resource type PTR */
+		if (reply.answers[i].type == DNS_RES_REC_PTR)
 		{
-			name[i] = name[i + 1];
-			i = i + 1;
+			domains[j] = malloc(strlen(reply.answers[i].data) + 1);
+			strcpy(domains[j], reply.answers[i].data);
+			j++;
 		}
-		name[i] = '.';
 	}
 
-	name[i - 1] = '\0'; // Remove the last dot
-		
-	return name;
+	return 0;
 }
 
 
+/*
+ * Prepares the IN-ADDR.ARPA (or IP6.ARPA) name which is required for
+ * doing the reverse DNS lookup of an address. Returns -1 if src is not
+ * an IP address.
+ */
+int prep_inaddr_arpa(char *dest, char *src)
+{
+	unsigned char addr[16];
+
+	if (inet_pton(AF_INET, src, addr) == 1)
+		name_arpa4(addr, dest);
+	else if (inet_pton(AF_INET6, src, addr) == 1)
+		name_arpa6(addr, dest);
+	else
+		return -1;
+
+	return 0;
+}
@@ -27,6 +27,29 @@
 #define DNS_RES_REC_SOA   6   // SOA record
 #define DNS_RES_REC_PTR   12  // PTR record
 #define DNS_RES_REC_MX    15  // MX record
+#define DNS_RES_REC_OPT   41  // EDNS0 pseudo record
+#define DNS_RES_REC_RRSIG 46  // RRSIG record
+#define DNS_RES_REC_NSEC  47  // NSEC record
+#define DNS_RES_REC_NSEC3 50  // NSEC3 record
+#define DNS_RES_REC_AXFR  252 // Zone transfer
+
+/* Define DNS response codes */
+#define DNS_RCODE_NOERROR  0
+#define DNS_RCODE_SERVFAIL 2
+#define DNS_RCODE_NXDOMAIN 3
+
+/* Maximum number of resource records kept from a reply */
+#define DNS_MAX_RR        64
+#define DNS_MAX_AUTH      16
+#define DNS_MAX_ADD       16
+
+/* Maximum number of referrals followed for a single name */
+#define DNS_MAX_REFERRALS 4
+
+/* Query flags */
+#define DNS_QF_DNSSEC     0x01  // request DNSSEC records (EDNS0 DO bit)
+#define DNS_QF_NORECURSE  0x02  // clear the recursion desired bit
+#define DNS_QF_NOVALIDATE 0x04  // set the checking disabled bit
 
 
 /* DNS header structure */
@@ -78,6 +101,37 @@ struct RES_RECORD
 	unsigned char *rdata;
 };
 
+/* Decoded resource record */
+struct DNS_RR
+{
+	char name[256];           // owner name in dotted format
+	unsigned short type;
+	unsigned short _class;
+	unsigned int ttl;
+	unsigned short data_len;
+	char data[256];           // rdata in presentation format (ip or name)
+	unsigned char typemap[32];  // types listed by NSEC/NSEC3 records (0-255)
+};
+
+/* Decoded DNS reply */
+struct DNS_REPLY
+{
+	int rcode;
+	int aa;                   // answer is authoritative
+	int tc;                   // answer was truncated
+	int ra;                   // server offers recursion
+	int ans_count;
+	int auth_count;
+	int add_count;
+	struct DNS_RR answers[DNS_MAX_RR];
+	struct DNS_RR authority[DNS_MAX_AUTH];
+	struct DNS_RR additional[DNS_MAX_ADD];
+};
+
+/* Invoked for every record of a zone transfer, a negative return value
+ * aborts the transfer */
+typedef int (*dns_rr_callback)(struct DNS_RR *rr, void *arg);
+
 /* Structure of a query */
 typedef struct
 {
@@ -85,10 +139,18 @@ typedef struct
 	struct QUESTION *ques;
 } QUERY;
 
-void change_to_dns_name_format(unsigned char* dns, unsigned char* host);
+void dns_set_port(int port);
+int dns_parse_reply(unsigned char *buffer, int len, struct DNS_REPLY *reply);
+int dns_query(char *server, char *host, int qtype, int flags, struct DNS_REPLY *reply);
+int dns_query_authoritative(char *server, char *zone, char *host, int qtype, char *resolver, struct DNS_REPLY *reply);
+int dns_axfr(char *server, char *zone, dns_rr_callback callback, void *arg);
+int dns_lookup_ns(char *server, char *zone, char *ns_ips[], int max);
+int dns_rr_has_type(struct DNS_RR *rr, int type);
+int dns_name_compare(const char *a, const char *b);
+int dns_base32hex_encode(const unsigned char *src, int len, char *dest);
+int dns_base32hex_decode(const char *src, int len, unsigned char *dest);
 int dns_query_a_record(char *server, char *host, char *ip_addr[]);
 int dns_query_ptr_record(char *server, char *ip, char *domains[]);
-void prep_inaddr_arpa(char *dest, char *src);
-unsigned char* read_name(unsigned char *reader, unsigned char *buffer, int *count);
+int prep_inaddr_arpa(char *dest, char *src);
 
 #endif /* DNS_H */
@@ -20,42 +20,174 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <pthread.h>
 #include <regex.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 #include "dns.h"
 #include "log.h"
+#include "wildcard.h"
+#include "nsec.h"
+#include "nsec3.h"
+#include "snoop.h"
+#include "hashset.h"
+#include "mutate.h"
+#include "history.h"
+#include "dedup.h"
+#include "cache.h"
+#include "net.h"
+#include "trace.h"
+#include "stats.h"
+#include "metrics.h"
+#include "arena.h"
+#include "affinity.h"
 
 /* Define some constants */
 #define APP_NAME        "DNSNINJA" /* Name of applicaton */
 #define APP_VERSION     "0.1.1"    /* Version of application */
+#define WORKER_THREADS  5          /* Threads doing dictionary lookups */
+#define MAX_DEPTH       10         /* Deepest level of recursive lookups */
+#define THREAD_FAILED   ((void *)-1)
+#define HISTORY_WEIGHT  1000000.0  /* Weight of a hit in past scans */
+#define DEDUP_MEMORY    64         /* MiB kept exactly for dropping duplicates */
+#define CHECKPOINT_INTERVAL 30     /* Seconds between two checkpoints */
+#define CHECKPOINT_MAGIC "DNSNINJA-STATE-2"
+#define MAX_ATTEMPTS    3          /* Queries sent for a name before it is skipped */
+#define LEASE_SIZE      16         /* Names handed to a remote worker at once */
+#define LEASE_TIMEOUT   60         /* Seconds a remote worker may stay silent */
+#define PROGRESS_INTERVAL 10       /* Seconds between two progress lines */
 
 /* Used to store command-line args */
 typedef struct 
 {
 	char *servers[5];
 	char *domain;
+	char **domains;   // domains to scan, just domain unless -d names a file
+	int domain_count;
+	char *domainfile;
 	char *inputfile;
 	char *outputfile;
 	int reverse;
+	int nsec;
+	int nsec3;
+	int authoritative;
+	int snoop;
+	int depth;
+	int mutate;
+	int time_budget;
+	char *history;
+	int dedup_memory;  // MiB per duplicate filter
+	char *cache;
+	char *state;       // checkpoint file, NULL if none is written
+	int resume;
+	int shard_index;   // 1 to shard_count
+	int shard_count;
+	int merge;
+	char **merge_files;
+	int merge_count;
+	char *listen;      // address the coordinator takes workers on
+	char *worker;      // address of the coordinator to work for
+	char *trace;       // file every query is recorded in
+	int progress;      // seconds between progress lines, 0 for none
+	char *metrics;     // address the metrics are served on
+	char *cpu_spec;    // --cpus as given
+	int cpus[AFFINITY_MAX_CPUS];  // CPUs the threads are placed on
+	int cpu_count;     // 0 if the threads are not placed
+	int noaxfr;
+	int port;
 	int help;
 	int loglevel;
 	int version;
 } cmd_params;
 
-/* Used for storing workitems inside single linked list */
-typedef struct workitem
+/* Names below which the words of the input file are tried. The
+ * cross product of words and bases is generated word by word, so
+ * consecutive names belong to different bases */
+typedef struct expansion
 {
-	char *wi;
-	struct workitem *next;
+	char **bases;   // NULL for reverse lookups, the words are used as they are
+	int base_count;
+	int depth;      // level of the names generated below the bases
+	long cursor;    // index of the next name in the cross product
+	unsigned int range_start;  // first address of a range, in host order
+	long range_size;    // if set, the addresses of the range are tried instead of the words
+	mutator *mut;   // if set, mutations of a hit are tried instead of the words
+	unsigned long seq;  // order of creation, older expansions win ties
+	struct expansion *next;
+	mutator mutation;   // state mut points to
+	char *base;         // bases points here if there is a single base
+	char base_name[512];
+} expansion;
+
+/* Name handed to a worker thread */
+typedef struct
+{
+	char host[512];
+	int depth;      // level of the name below the domain
+	int label_len;  // length of the generated first label
+	int mutation;   // name is a mutation of a hit
+	int attempts;   // queries sent for the name so far
 } workitem;
 
+/* Work shared by the worker threads. Names found while working are
+ * fed back as new expansions */
+typedef struct
+{
+	char **words;
+	double *weights;      // priority of each word
+	int word_count;
+	expansion *mutations; // mutations of hits, tried first
+	expansion **heap;     // word expansions, by the weight of their next word
+	int heap_count;
+	int heap_size;
+	unsigned long seq;
+	time_t deadline;      // end of the time budget, 0 if there is none
+	int expired;          // time budget ran out before the work was done
+	int workers;          // number of threads taking work
+	int idle;             // number of threads waiting for work
+	int done;
+	dedup *seen;          // names generated below hosts found
+	hashset *listed;      // domains given with -d
+	hashset *wordset;     // words of the input file
+	workitem *retries;    // names which timed out, tried again last
+	int retry_count;
+	int retry_size;
+	workitem active[WORKER_THREADS];  // names being queried, empty host if none
+	struct result *results;       // hosts found so far
+	struct result *results_last;
+	struct result *results_logged;  // last host in the results log of the checkpoint
+	expansion *spare;     // expansions done with, reused for new ones
+	time_t next_checkpoint;   // 0 if no checkpoints are written
+	int interrupted;      // user pressed Ctrl-C
+	unsigned long served; // names handed out
+	unsigned long found;  // hosts found
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} work_queue;
+
+/* Word and weight, sorted together */
+typedef struct
+{
+	char *word;
+	double weight;
+	int pos;      // position in the input file
+} weighted_word;
+
 /* Used for storing DNS lookup results inside single linked list */
 typedef struct result
 {
 	char *ip;
 	char *host;
+	char *types;  // record types, only known when walking NSEC chains
 	struct result *next;
 } result;
 
@@ -63,16 +195,43 @@ typedef struct result
 typedef struct
 {
 	int thread_id;
-	struct workitem *wi_list;
+	work_queue *queue;
 	int reverse;
-	struct result *result_list;
 	char *server;
+	int cpu;        // CPU the thread runs on, -1 for any
 } thread_params;
 
+/* Connection of a remote worker to the coordinator */
+typedef struct
+{
+	int session_id;
+	int fd;
+	work_queue *queue;
+} session_params;
+
 /* Function prototypes */
 int parse_cmd_args(int *argc, char *argv[]);
 int parse_server_cmd_arg(char *optarg, char *servers[]);
 int do_dns_lookups(void);
+int do_dictionary_lookups(result **result_all);
+int do_nsec_walk(result **result_all);
+int do_nsec3_crack(result **result_all);
+char **load_labels(char *inputfile, int *count, double **weights);
+int unique_labels(char **labels, double *weights, int count);
+int compare_weighted_words(const void *a, const void *b);
+void sort_words(char **words, double *weights, int count);
+void apply_history(char **words, double *weights, int count);
+void update_history(result *results);
+int load_domains(void);
+int finish_lookups(result *result_all);
+int do_zone_transfers(result **result_all);
+int do_zone_transfer(char *domain, result **result_all);
+int lookup_ns_servers(char *domain);
+char *get_ns_server(void);
+int collect_axfr_record(struct DNS_RR *rr, void *arg);
+void append_results(result **list, result *more);
+int drop_duplicate_results(result **list);
+result *new_result(const char *host, const char *ip, const char *types);
 int check_input_file_host(void);
 int check_input_file_ip(void);
 int do_forward_dns_lookup(char *server, char *host, result **result_list);
@@ -80,19 +239,56 @@ int do_reverse_dns_lookup(char *server, char *ip, result **result_list);
 void chomp(char *s);
 void display_help_page(void);
 void display_version_info(void);
-void load_workitems(char *inputfile, workitem **wi_start, int reverse);
-void dist_workitems(workitem **wi_list, workitem **wi_t1, workitem **wi_t2,
-		workitem **wi_t3, workitem **wi_t4, workitem **wi_t5);
-int count_workitems(workitem *wi_list);
+int queue_expansion(work_queue *queue, char **bases, int base_count, int depth);
+int queue_mutations(work_queue *queue, char *host, int label_len, int depth);
+int next_workitem(work_queue *queue, int slot, workitem *item, int wait);
+int skip_workitem(work_queue *queue, workitem *item, int thread_id);
+int finish_workitem(work_queue *queue, workitem *item, int ret, int thread_id);
+int lease_workitems(work_queue *queue, workitem *lease, int max);
+int serve_workers(work_queue *queue);
+void *serve_session(void *arg);
+int run_worker(void);
+void *work_remote(void *arg);
+void heap_push(work_queue *queue, expansion *exp);
+int requeue_workitem(work_queue *queue, workitem *item);
+void add_results(work_queue *queue, result *results);
+int write_words(work_queue *queue);
+int write_checkpoint(work_queue *queue);
+int commit_file(FILE *f, const char *tmpname, const char *filename);
+int log_results(result *first, result *last);
+int load_checkpoint(work_queue *queue);
+void handle_sigint(int sig);
+void free_queue(work_queue *queue);
+void write_queue_metrics(FILE *out, void *arg);
+int shard_owns(const char *name);
+int take_ranges(char **labels, double *weights, int count, char **ranges, int *range_count);
+int queue_range(work_queue *queue, const char *range);
+long parse_range(const char *range, unsigned int *start);
+long expansion_size(work_queue *queue, expansion *exp);
+int merge_results(char **files, int count);
+void free_expansion(expansion *exp);
+expansion *take_expansion(work_queue *queue);
+void release_expansion(work_queue *queue, expansion *exp);
+void set_single_base(expansion *exp, const char *base);
+int expansion_before(work_queue *queue, expansion *a, expansion *b);
+void heap_sift_down(work_queue *queue, int i);
+void report_unprocessed(work_queue *queue);
+void leave_queue(work_queue *queue);
+void rank_words(char **words, double *weights, int count);
 void *proc_workitems(void *arg);
 void write_results(result *results);
 int get_servers_count(void);
 char *get_random_server(void);
 void show_gnu_banner(void);
+void log_cpus(void);
 
 /* Global vars */
 cmd_params *params;
-pthread_t t1, t2, t3, t4, t5;
+char *ns_servers[16];
+int ns_server_count = 0;
+volatile sig_atomic_t interrupted = 0;
+arena *word_memory;     // words of the input files, kept for the whole run
+arena *result_memory;   // hosts found, released at the end of the run
 
 
 /*
@@ -107,6 +303,13 @@ int main(int argc, char *argv[])
 
 	/* Allocate structures on heap */
 	params = malloc(sizeof(cmd_params));
+	word_memory = arena_create();
+	result_memory = arena_create();
+	if ((params == NULL) || (word_memory == NULL) || (result_memory == NULL))
+	{
+		logline(LOG_ERROR, "Error: Not enough memory to start.");
+		return -1;
+	}
 
 	/* Parse commandline args */
 	ret = parse_cmd_args(&argc, argv);
@@ -139,6 +342,42 @@ int main(int argc, char *argv[])
 			case -5:
 				logline(LOG_ERROR, "Error: No domain specified (use -d option).");
 				break;
+			case -6:
+				logline(LOG_ERROR, "Error: Invalid port specified (use option -p).");
+				break;
+			case -7:
+				logline(LOG_ERROR, "Error: Invalid recursion depth specified (use option -R).");
+				break;
+			case -8:
+				logline(LOG_ERROR, "Error: Domain list could not be loaded (use option -d).");
+				break;
+			case -9:
+				logline(LOG_ERROR, "Error: Options -n, -N, -a and -c only support a single domain.");
+				break;
+			case -10:
+				logline(LOG_ERROR, "Error: Invalid time budget specified (use option -T).");
+				break;
+			case -11:
+				logline(LOG_ERROR, "Error: Invalid duplicate filter size specified (use option -D).");
+				break;
+			case -12:
+				logline(LOG_ERROR, "Error: Invalid shard specified, expected i/N with 1 <= i <= N (use option -S).");
+				break;
+			case -13:
+				logline(LOG_ERROR, "Error: Merging needs an output file (-o) and the files to merge.");
+				break;
+			case -14:
+				logline(LOG_ERROR, "Error: Option -L does not support -w, -a, -k and -K.");
+				break;
+			case -15:
+				logline(LOG_ERROR, "Error: Invalid progress interval specified (use option -P).");
+				break;
+			case -16:
+				logline(LOG_ERROR, "Error: Invalid or unavailable CPUs specified (use option -A).");
+				break;
+			case -17:
+				logline(LOG_ERROR, "Error: Option -w does not support -a, the coordinator picks the domain.");
+				break;
 			default:
 				logline(LOG_ERROR, "Error: An unknown error occurred during parsing of command line args.");
 		}
@@ -156,18 +395,71 @@ int main(int argc, char *argv[])
 		default: set_loglevel(LOG_ERROR);
 	}
 
+	/* Set port of DNS servers */
+	dns_set_port(params->port);
+
 	show_gnu_banner();
 	printf("Executing %s Version %s\n", APP_NAME, APP_VERSION);
 	printf("\n");
+
+	/* All threads stay on the CPUs given with --cpus */
+	if (params->cpu_count && (affinity_pin(pthread_self(), params->cpus, params->cpu_count) < 0))
+	{
+		logline(LOG_ERROR, "Warning: Could not move to the CPUs given with --cpus.");
+	}
+
+	/* Lines are printed by a thread of their own from now on, so the
+	 * workers do not wait for the terminal */
+	if (log_start() < 0)
+	{
+		logline(LOG_ERROR, "Warning: Could not start logger thread, logging synchronously.");
+	}
 	
-	/* Display help page if desired. Otherwise, do DNS lookups */
-	ret = do_dns_lookups();
-	if (ret < 0)
+	/* Merge the output of shards. Otherwise, do DNS lookups */
+	if (params->trace && (trace_open(params->trace) < 0))
+	{
+		logline(LOG_ERROR, "Error: Trace file %s could not be created.", params->trace);
+		ret = -1;
+	}
+	else if (params->metrics && !params->merge && (metrics_start(params->metrics) < 0))
+	{
+		logline(LOG_ERROR, "Error: Could not serve metrics on %s.", params->metrics);
+		ret = -1;
+	}
+	else if (params->merge)
+	{
+		/* The host count is logged, the exit status only tells success */
+		ret = merge_results(params->merge_files, params->merge_count);
+		if (ret > 0)
+			ret = 0;
+	}
+	else if (params->worker)
+	{
+		ret = run_worker();
+		if (ret < 0)
+		{
+			logline(LOG_ERROR, "Error: Could not work for coordinator %s.", params->worker);
+		}
+	}
+	else
+	{
+		ret = do_dns_lookups();
+		if (ret < 0)
+		{
+			logline(LOG_ERROR, "Error: Could not perform DNS lookups. Errorcode: %d", ret);
+		}
+	}
+
+	metrics_stop();
+	if (trace_close() < 0)
 	{
-		logline(LOG_ERROR, "Error: Could not perform DNS lookups. Errorcode: %d", ret);
+		logline(LOG_ERROR, "Error: Trace file %s could not be written completely.", params->trace);
 	}
 
 	/* Free memory on heap */
+	log_stop();
+	arena_destroy(result_memory);
+	arena_destroy(word_memory);
 	free(params);
 
 	return ret;
@@ -183,15 +475,51 @@ int parse_cmd_args(int *argc, char *argv[])
 	int ret = 0;
 	int param_server_err = 0;
 	int param_loglevel_err = 0;
+	int param_port_err = 0;
+	int param_depth_err = 0;
+	int param_budget_err = 0;
+	int param_dedup_err = 0;
+	int param_shard_err = 0;
+	int param_progress_err = 0;
+	int param_cpus_err = 0;
 
 	/* Init struct */
 	params->reverse = 0;
+	params->nsec = 0;
+	params->nsec3 = 0;
+	params->authoritative = 0;
+	params->snoop = 0;
+	params->depth = 1;
+	params->mutate = 0;
+	params->time_budget = 0;
+	params->history = NULL;
+	params->dedup_memory = DEDUP_MEMORY;
+	params->cache = NULL;
+	params->state = NULL;
+	params->resume = 0;
+	params->shard_index = 1;
+	params->shard_count = 1;
+	params->merge = 0;
+	params->merge_files = NULL;
+	params->merge_count = 0;
+	params->listen = NULL;
+	params->worker = NULL;
+	params->trace = NULL;
+	params->progress = PROGRESS_INTERVAL;
+	params->metrics = NULL;
+	params->cpu_spec = NULL;
+	params->cpu_count = 0;
+	params->noaxfr = 0;
+	params->port = 53;
 	params->help = 0;
 
 	for (i = 0; i < 5; i++)
 		params->servers[i] = NULL;
 
 	params->domain = NULL;
+	params->domains = NULL;
+	params->domain_count = 0;
+	params->domainfile = NULL;
 	params->inputfile = NULL;
 	params->outputfile = NULL;
 	params->loglevel = LOG_INFO;
@@ -209,6 +537,28 @@ int parse_cmd_args(int *argc, char *argv[])
 			{ "help",		no_argument,       0, 'h' },
 			{ "version",	no_argument,       0, 'v' },
 			{ "loglevel",	required_argument, 0, 'l' },
+			{ "port",		required_argument, 0, 'p' },
+			{ "noaxfr",		no_argument,       0, 'x' },
+			{ "nsec",		no_argument,       0, 'n' },
+			{ "nsec3",		no_argument,       0, 'N' },
+			{ "authoritative", no_argument,    0, 'a' },
+			{ "snoop",		no_argument,       0, 'c' },
+			{ "recursive",	required_argument, 0, 'R' },
+			{ "mutate",		no_argument,       0, 'm' },
+			{ "time-budget", required_argument, 0, 'T' },
+			{ "history",	required_argument, 0, 'H' },
+			{ "dedup-memory", required_argument, 0, 'D' },
+			{ "cache",		required_argument, 0, 'C' },
+			{ "checkpoint",	required_argument, 0, 'k' },
+			{ "resume",		required_argument, 0, 'K' },
+			{ "shard",		required_argument, 0, 'S' },
+			{ "merge",		no_argument,       0, 'M' },
+			{ "listen",		required_argument, 0, 'L' },
+			{ "worker",		required_argument, 0, 'w' },
+			{ "trace",		required_argument, 0, 't' },
+			{ "progress",	required_argument, 0, 'P' },
+			{ "metrics",	required_argument, 0, 'e' },
+			{ "cpus",		required_argument, 0, 'A' },
 			{ 0, 0, 0, 0 }
 		};
 
@@ -216,7 +566,7 @@ int parse_cmd_args(int *argc, char *argv[])
 		int option_index = 0;
 		int c;
 
-		c = getopt_long(*argc, argv, "rs:d:i:o:hvl:", long_options, &option_index);
+		c = getopt_long(*argc, argv, "rs:d:i:o:hvl:p:xnNacR:mT:H:D:C:k:K:S:ML:w:t:P:e:A:", long_options, &option_index);
 
 		/* Detect the end of the options */
 		if (c == -1)
@@ -252,18 +602,131 @@ int parse_cmd_args(int *argc, char *argv[])
 	            if ((params->loglevel < 1) || (params->loglevel > 3))
 	            	param_loglevel_err = 1;
 				break;
+			case 'p':
+				params->port = atoi(optarg);
+				if ((params->port < 1) || (params->port > 65535))
+					param_port_err = 1;
+				break;
+			case 'x':
+				params->noaxfr = 1;
+				break;
+			case 'n':
+				params->nsec = 1;
+				break;
+			case 'N':
+				params->nsec3 = 1;
+				break;
+			case 'a':
+				params->authoritative = 1;
+				break;
+			case 'c':
+				params->snoop = 1;
+				break;
+			case 'm':
+				params->mutate = 1;
+				break;
+			case 'T':
+				params->time_budget = atoi(optarg);
+				if (params->time_budget < 1)
+					param_budget_err = 1;
+				break;
+			case 'H':
+				params->history = optarg;
+				break;
+			case 'C':
+				params->cache = optarg;
+				break;
+			case 'k':
+				params->state = optarg;
+				break;
+			case 'K':
+				params->state = optarg;
+				params->resume = 1;
+				break;
+			case 'S':
+				if ((sscanf(optarg, "%d/%d", &params->shard_index, &params->shard_count) != 2) ||
+					(params->shard_count < 1) || (params->shard_index < 1) ||
+					(params->shard_index > params->shard_count))
+					param_shard_err = 1;
+				break;
+			case 'M':
+				params->merge = 1;
+				break;
+			case 'L':
+				params->listen = optarg;
+				break;
+			case 'w':
+				params->worker = optarg;
+				break;
+			case 't':
+				params->trace = optarg;
+				break;
+			case 'e':
+				params->metrics = optarg;
+				break;
+			case 'A':
+				params->cpu_spec = optarg;
+				params->cpu_count = affinity_layout(optarg, params->cpus, AFFINITY_MAX_CPUS);
+				if (params->cpu_count <= 0)
+					param_cpus_err = 1;
+				break;
+			case 'P':
+				params->progress = atoi(optarg);
+				if ((params->progress < 0) || ((params->progress == 0) && strcmp(optarg, "0")))
+					param_progress_err = 1;
+				break;
+			case 'D':
+				params->dedup_memory = atoi(optarg);
+				if (params->dedup_memory < 1)
+					param_dedup_err = 1;
+				break;
+			case 'R':
+				params->depth = atoi(optarg);
+				if ((params->depth < 1) || (params->depth > MAX_DEPTH))
+					param_depth_err = 1;
+				break;
 		}
 	}
 
+	/* Merging takes the files to merge as arguments and sends no queries */
+	if (params->merge)
+	{
+		params->merge_files = argv + optind;
+		params->merge_count = *argc - optind;
+		if ((params->outputfile == NULL) || (params->merge_count == 0)) { return -13; }
+		return 0;
+	}
+
 	/* Check param dependencies */
 	if (get_servers_count() == 0) { return -1; }
-	if (params->inputfile == NULL) { return -2; }
+	if ((params->inputfile == NULL) && !params->nsec && !params->worker) { return -2; }
 	if (param_server_err == 1) { return -3; }
 	if (param_loglevel_err == 1) { return -4; }
-	if (params->reverse == 0)
+	if (param_port_err == 1) { return -6; }
+	if (param_depth_err == 1) { return -7; }
+	if (param_budget_err == 1) { return -10; }
+	if (param_dedup_err == 1) { return -11; }
+	if (param_shard_err == 1) { return -12; }
+	if (param_progress_err == 1) { return -15; }
+	if (param_cpus_err == 1) { return -16; }
+	if (params->listen && (params->worker || params->authoritative || params->state)) { return -14; }
+	if (params->worker && params->authoritative) { return -17; }
+
+	/* Workers get their names from the coordinator */
+	if (params->worker) { return 0; }
+
+	if ((params->reverse == 0) || params->nsec || params->nsec3)
 	{
 		/* Additional parameter checks when doing forward lookup requests */
 		if (params->domain == NULL) { return -5; }
+
+		/* -d also accepts a file listing one domain per line */
+		if (load_domains() < 0) { return -8; }
+		if ((params->domain_count > 1) &&
+			(params->nsec || params->nsec3 || params->authoritative || params->snoop))
+		{
+			return -9;
+		}
 	}	
 	
 	return 0;
@@ -284,7 +747,7 @@ int parse_server_cmd_arg(char *optarg, char *servers[])
 		while (ptr != NULL)
 		{
 			/* Store server ip */
-			servers[i] = malloc(strlen(ptr));
+			servers[i] = malloc(strlen(ptr) + 1);
 			strcpy(servers[i], ptr);
 			i++;
 
@@ -308,21 +771,9 @@ int do_dns_lookups(void)
 {
 	int i = 0;
 	int ret = 0;
-	int hostcount = 0;
-	thread_params t1_params, t2_params, t3_params, t4_params, t5_params;
-	void *t1_status, *t2_status, *t3_status, *t4_status, *t5_status;
-	result *list_iterator;
 	result *result_all;
-	workitem *wi_start, *wi_t1, *wi_t2, *wi_t3, *wi_t4, *wi_t5;
 
 	result_all = NULL;
-	list_iterator = NULL;
-	wi_start = NULL;
-	wi_t1 = NULL;
-	wi_t2 = NULL;
-	wi_t3 = NULL;
-	wi_t4 = NULL;
-	wi_t5 = NULL;
 
 	/* Display some info */
 	logline(LOG_INFO, "Run configuration:");
@@ -332,16 +783,58 @@ int do_dns_lookups(void)
 		logline(LOG_INFO, "        %s", params->servers[i]);
 		i++;
 	}
-	if (params->domain)
+	if (params->domainfile)
+		logline(LOG_INFO, "    Using domains     : %d from %s", params->domain_count, params->domainfile);
+	else if (params->domain)
 		logline(LOG_INFO, "    Using domain      : %s", params->domain);
 	if (params->inputfile)
 		logline(LOG_INFO, "    Using input file  : %s", params->inputfile);
 	if (params->outputfile)
 		logline(LOG_INFO, "    Using output file : %s", params->outputfile);
-	if (params->reverse)
+	if (params->nsec)
+		logline(LOG_INFO, "    DNS lookup mode   : NSEC walk");
+	else if (params->nsec3)
+		logline(LOG_INFO, "    DNS lookup mode   : NSEC3 hash matching");
+	else if (params->reverse)
 		logline(LOG_INFO, "    DNS lookup mode   : Reverse");
 	else
 		logline(LOG_INFO, "    DNS lookup mode   : Forward");
+	if (params->port != 53)
+		logline(LOG_INFO, "    Using port        : %d", params->port);
+	if (!params->reverse && params->noaxfr)
+		logline(LOG_INFO, "    Zone transfer     : Disabled");
+	if (!params->reverse && params->authoritative)
+		logline(LOG_INFO, "    Query target      : Authoritative name servers");
+	if (!params->reverse && params->snoop)
+		logline(LOG_INFO, "    Cache snooping    : Enabled");
+	if (!params->reverse && (params->depth > 1))
+		logline(LOG_INFO, "    Recursion depth   : %d", params->depth);
+	if (!params->reverse && params->mutate)
+		logline(LOG_INFO, "    Mutations         : Enabled");
+	if (params->shard_count > 1)
+		logline(LOG_INFO, "    Shard             : %d of %d", params->shard_index, params->shard_count);
+	if (params->time_budget)
+		logline(LOG_INFO, "    Time budget       : %d seconds", params->time_budget);
+	if (!params->reverse && params->history)
+		logline(LOG_INFO, "    Using history     : %s", params->history);
+	if (params->cache)
+		logline(LOG_INFO, "    Answer cache      : %s", params->cache);
+	if (params->state)
+		logline(LOG_INFO, "    %s: %s", params->resume ? "Resuming from     " : "Checkpoint file   ", params->state);
+	if (params->dedup_memory != DEDUP_MEMORY)
+		logline(LOG_INFO, "    Duplicate filter  : %d MiB", params->dedup_memory);
+	if (params->listen)
+		logline(LOG_INFO, "    Workers listen on : %s", params->listen);
+	if (params->trace)
+		logline(LOG_INFO, "    Query trace       : %s", params->trace);
+	if (params->metrics)
+		logline(LOG_INFO, "    Metrics served on : %s", params->metrics);
+	if (params->cpu_count)
+		log_cpus();
+	if (params->progress == 0)
+		logline(LOG_INFO, "    Progress          : Disabled");
+	else if (params->progress != PROGRESS_INTERVAL)
+		logline(LOG_INFO, "    Progress          : Every %d seconds", params->progress);
 
 	switch (params->loglevel)
 	{
@@ -351,9 +844,19 @@ int do_dns_lookups(void)
 		default: logline(LOG_INFO, "    Log Level         : Error");
 	}
 
+	/* Walking the NSEC chain needs no input file */
+	if (params->nsec)
+	{
+		ret = do_nsec_walk(&result_all);
+		if (ret < 0)
+			return ret;
+
+		return finish_lookups(result_all);
+	}
+
 	/* Check work items prior to processing */
 	logline(LOG_INFO, "Checking input file...");
-	if (params->reverse)
+	if (params->reverse && !params->nsec3)
 	{
 		/* File must contain a bunch of ip addresses */
 		ret = check_input_file_ip();
@@ -383,639 +886,2947 @@ int do_dns_lookups(void)
 	if (ret < 0)
 		return -1;
 	
-	/* Load work items into linked list */
-	logline(LOG_INFO, "Processing starts now, stay tuned...");
-	logline(LOG_DEBUG, "    Loading work items...");
-	load_workitems(params->inputfile, &wi_start, params->reverse);	
-	logline(LOG_DEBUG, "    %d work items loaded from file", count_workitems(wi_start));
-
-	/* Distribute workitems among threads */
-	logline(LOG_DEBUG, "    Distributing work items among threads...");
-	dist_workitems(&wi_start, &wi_t1, &wi_t2, &wi_t3, &wi_t4, &wi_t5);
-	logline(LOG_DEBUG, "    Work items distributed");
-	logline(LOG_DEBUG, "    Thread 1: Work item count = %d", count_workitems(wi_t1));
-	logline(LOG_DEBUG, "    Thread 2: Work item count = %d", count_workitems(wi_t2));
-	logline(LOG_DEBUG, "    Thread 3: Work item count = %d", count_workitems(wi_t3));
-	logline(LOG_DEBUG, "    Thread 4: Work item count = %d", count_workitems(wi_t4));
-	logline(LOG_DEBUG, "    Thread 5: Work item count = %d", count_workitems(wi_t5));
-
-	/* Prepare data structures for threads */
-	t1_params.thread_id = 1;
-	t1_params.wi_list = wi_t1;
-	t1_params.reverse = params->reverse;
-	t1_params.result_list = NULL;
-	t1_params.server = get_random_server();
-
-	t2_params.thread_id = 2;
-	t2_params.wi_list = wi_t2;
-	t2_params.reverse = params->reverse;
-	t2_params.result_list = NULL;
-	t2_params.server = get_random_server();
-	
-	t3_params.thread_id = 3;
-	t3_params.wi_list = wi_t3;
-	t3_params.reverse = params->reverse;
-	t3_params.result_list = NULL;
-	t3_params.server = get_random_server();
-	
-	t4_params.thread_id = 4;
-	t4_params.wi_list = wi_t4;
-	t4_params.reverse = params->reverse;
-	t4_params.result_list = NULL;
-	t4_params.server = get_random_server();
-
-	t5_params.thread_id = 5;
-	t5_params.wi_list = wi_t5;
-	t5_params.reverse = params->reverse;
-	t5_params.result_list = NULL;
-	t5_params.server = get_random_server();
-
-	if (pthread_create(&t1,	NULL, proc_workitems, &t1_params))
+	/* NSEC3 hashes are matched offline, there is nothing to query */
+	if (params->nsec3)
 	{
-		logline(LOG_ERROR, "    Thread 1: Could not be created");
-		return -1;
+		ret = do_nsec3_crack(&result_all);
+		if (ret < 0)
+			return ret;
+
+		return finish_lookups(result_all);
 	}
-	else
+
+	/* Wildcard fingerprints are only needed for forward lookups. They
+	 * are freed by finish_lookups or on the way out of an error */
+	if (!params->reverse)
 	{
-		logline(LOG_DEBUG, "    Thread 1: Created");
+		if (wildcard_init() < 0)
+		{
+			logline(LOG_ERROR, "Error: Could not allocate wildcard zone table.");
+			return -1;
+		}
 	}
 
-	if (pthread_create(&t2,	NULL, proc_workitems, &t2_params))
+	/* A successful zone transfer makes the dictionary phase obsolete */
+	if (!params->reverse && !params->noaxfr)
 	{
-		logline(LOG_ERROR, "    Thread 2: Could not be created");
-		return -1;
+		do_zone_transfers(&result_all);
 	}
-	else
+
+	/* Name servers of the domain are looked up once */
+	if (!params->reverse && params->authoritative && (params->domain_count > 0))
 	{
-		logline(LOG_DEBUG, "    Thread 2: Created");
+		if (params->noaxfr)
+			lookup_ns_servers(params->domain);
+		if (ns_server_count == 0)
+		{
+			logline(LOG_ERROR, "Error: Name servers of %s could not be found.", params->domain);
+			wildcard_free();
+			return -1;
+		}
 	}
 
-	if (pthread_create(&t3,	NULL, proc_workitems, &t3_params))
+	if (params->reverse || (params->domain_count > 0))
 	{
-		logline(LOG_ERROR, "    Thread 3: Could not be created");
-		return -1;
+		/* Unexpired answers of earlier runs are not queried again */
+		if (params->cache)
+		{
+			ret = cache_open(params->cache);
+			if (ret < 0)
+			{
+				logline(LOG_ERROR, "Error: %s is not a valid cache file.", params->cache);
+				wildcard_free();
+				return -1;
+			}
+			logline(LOG_INFO, "%d answers loaded from cache %s.", ret, params->cache);
+		}
+
+		ret = do_dictionary_lookups(&result_all);
+
+		if (params->cache)
+		{
+			logline(LOG_INFO, "%u lookups answered from cache.", cache_hits());
+			if (cache_close() < 0)
+				logline(LOG_ERROR, "Error: Cache file %s could not be written.", params->cache);
+		}
+		if (ret < 0)
+		{
+			wildcard_free();
+			return ret;
+		}
 	}
-	else
+
+	return finish_lookups(result_all);
+}
+
+
+/*
+ * Displays and exports the results of a run.
+ */
+int finish_lookups(result *result_all)
+{
+	int hostcount = 0;
+	int duplicates;
+	result *list_iterator;
+
+	logline(LOG_INFO, "Finished processing data.");
+
+	/* Hosts of a partial zone transfer may be found again by the
+	 * dictionary lookups */
+	duplicates = drop_duplicate_results(&result_all);
+	if (duplicates > 0)
+		logline(LOG_DEBUG, "    %d hosts found twice are listed once.", duplicates);
+	if (!params->reverse && !params->nsec && !params->nsec3)
 	{
-		logline(LOG_DEBUG, "    Thread 3: Created");
+		logline(LOG_INFO, "%d zones with wildcard records detected.", wildcard_zone_count());
 	}
+	wildcard_free();
+	logline(LOG_INFO, "The following hosts have been identified:");
 
-	if (pthread_create(&t4,	NULL, proc_workitems, &t4_params))
+	/* Print results on screen */
+	list_iterator = result_all;
+	while (list_iterator)
 	{
-		logline(LOG_ERROR, "    Thread 4: Could not be created");
-		return -1;
+		hostcount++;
+		if (list_iterator->types)
+			logline(LOG_INFO, "    Host: %s, Types: %s", list_iterator->host, list_iterator->types);
+		else
+			logline(LOG_INFO, "    Host: %s, IP: %s", list_iterator->host, list_iterator->ip);
+		list_iterator = list_iterator->next;
 	}
-	else
+	if (hostcount == 0)
 	{
-		logline(LOG_DEBUG, "    Thread 4: Created");
+		logline(LOG_INFO, "    Unfortunately, no hosts have been found. Try again using different settings.");
+	} 
+	else
+	{	
+		logline(LOG_INFO, "    %d hosts found.", hostcount);
 	}
-
-	if (pthread_create(&t5,	NULL, proc_workitems, &t5_params))
+	
+	
+	/* Export results to text file */
+	if ((params->outputfile != NULL) && (hostcount > 0))
 	{
-		logline(LOG_ERROR, "    Thread 5: Could not be created");
-		return -1;
+		logline(LOG_INFO, "Exporting data to %s...", params->outputfile);
+		list_iterator = result_all;
+		write_results(list_iterator);
+		logline(LOG_INFO, "Export finished.");
 	}
-	else
+
+	/* Remember the hosts found for future scans */
+	if (params->history && !params->reverse && !params->nsec && !params->nsec3)
 	{
-		logline(LOG_DEBUG, "    Thread 5: Created");
+		update_history(result_all);
 	}
 
-	/* Wait for threads to finish */
-	pthread_join(t1, &t1_status);
-	pthread_join(t2, &t2_status);
-	pthread_join(t3, &t3_status);
-	pthread_join(t4, &t4_status);
-	pthread_join(t5, &t5_status);
+	logline(LOG_INFO, "Thank you for flying with us!");
+
+	return 0;
+}
+
+
+/*
+ * Feeds the words of the input file and every name found below the
+ * domain to the worker threads through a shared queue and collects
+ * their results.
+ */
+int do_dictionary_lookups(result **result_all)
+{
+	thread_params t_params[WORKER_THREADS];
+	pthread_t threads[WORKER_THREADS];
+	void *status;
+	work_queue queue;
+	result *list_iterator;
+	struct sigaction action, old_action;
+	sigset_t mask, old_mask;
+	char filename[4096];
+	char **ranges = NULL;
+	int i, started, found, pending, range_count = 0;
 
-	/* Extract results out of threads */
-	if ((int *)t1_status < 0)
+	/* Load work items */
+	logline(LOG_INFO, "Processing starts now, stay tuned...");
+	logline(LOG_DEBUG, "    Loading work items...");
+	if (params->resume)
 	{
-		logline(LOG_ERROR, "    Thread 1: An error occurred");
+		/* The words are taken in the order of the interrupted run */
+		snprintf(filename, sizeof(filename), "%s.words", params->state);
+		queue.words = load_labels(filename, &queue.word_count, &queue.weights);
 	}
 	else
 	{
-		/* Extract results from thread 1 */
-		logline(LOG_DEBUG, "    Thread 1: Finished successfully");
+		queue.words = load_labels(params->inputfile, &queue.word_count, &queue.weights);
+		if (params->reverse && (queue.word_count > 0))
+		{
+			/* Address ranges are not written out, each becomes an
+			 * expansion generating its addresses */
+			ranges = (char **)malloc(queue.word_count * sizeof(char *));
+			if (ranges == NULL)
+			{
+				logline(LOG_ERROR, "    Not enough memory for the address ranges");
+				free(queue.words);
+				free(queue.weights);
+				return -1;
+			}
+			queue.word_count = take_ranges(queue.words, queue.weights, queue.word_count, ranges, &range_count);
+		}
+		queue.word_count = unique_labels(queue.words, queue.weights, queue.word_count);
+	}
+	if ((queue.word_count == 0) && (range_count == 0) && !params->resume)
+	{
+		logline(LOG_INFO, "    The input file contains no work items.");
+		free(queue.words);
+		free(queue.weights);
+		free(ranges);
+		return 0;
 	}
+	logline(LOG_DEBUG, "    %d work items and %d address ranges loaded from file", queue.word_count, range_count);
 
-	if ((int *)t2_status < 0)
+	/* Frequent words and words found in past scans are tried first */
+	if (params->history && !params->reverse && !params->resume)
 	{
-		logline(LOG_ERROR, "    Thread 2: An error occurred");
+		apply_history(queue.words, queue.weights, queue.word_count);
 	}
-	else
+	if (!params->resume)
 	{
-		/* Extract results from thread 2 */
-		logline(LOG_DEBUG, "    Thread 2: Finished successfully");
+		sort_words(queue.words, queue.weights, queue.word_count);
 	}
 
-	if ((int *)t3_status < 0)
+	/* Names the resolvers have cached are looked up first */
+	if (params->snoop && !params->reverse && !params->resume)
 	{
-		logline(LOG_ERROR, "    Thread 3: An error occurred");
+		rank_words(queue.words, queue.weights, queue.word_count);
 	}
-	else
+
+	/* Prepare the queue, it starts with the words below the domains */
+	queue.mutations = NULL;
+	queue.heap = NULL;
+	queue.heap_count = 0;
+	queue.heap_size = 0;
+	queue.seq = 0;
+	queue.deadline = params->time_budget ? time(NULL) + params->time_budget : 0;
+	queue.expired = 0;
+	queue.workers = 0;
+	queue.idle = 0;
+	queue.done = 0;
+	queue.retries = NULL;
+	queue.retry_count = 0;
+	queue.retry_size = 0;
+	for (i = 0; i < WORKER_THREADS; i++)
+		queue.active[i].host[0] = '\0';
+	queue.results = NULL;
+	queue.results_last = NULL;
+	queue.results_logged = NULL;
+	queue.spare = NULL;
+	queue.next_checkpoint = 0;
+	queue.interrupted = 0;
+	queue.served = 0;
+	queue.found = 0;
+	queue.seen = dedup_create((unsigned long)params->dedup_memory << 20);
+	queue.listed = hashset_create(params->domain_count);
+	queue.wordset = hashset_create(queue.word_count);
+	if ((queue.seen == NULL) || (queue.listed == NULL) || (queue.wordset == NULL))
 	{
-		/* Extract results from thread 3 */
-		logline(LOG_DEBUG, "    Thread 3: Finished successfully");
+		logline(LOG_ERROR, "    Not enough memory for the set of queried names");
+		dedup_free(queue.seen);
+		hashset_free(queue.listed);
+		hashset_free(queue.wordset);
+		free(ranges);
+		return -1;
 	}
-
-	if ((int *)t4_status < 0)
+	for (i = 0; i < params->domain_count; i++)
+		hashset_add(queue.listed, hashset_hash_name(params->domains[i]));
+	for (i = 0; i < queue.word_count; i++)
+		hashset_add(queue.wordset, hashset_hash_name(queue.words[i]));
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+	if (params->resume)
 	{
-		logline(LOG_ERROR, "    Thread 4: An error occurred");
+		found = load_checkpoint(&queue);
+		if (found < 0)
+		{
+			logline(LOG_ERROR, "Error: Checkpoint %s does not match the words in %s.words", params->state, params->state);
+			free_queue(&queue);
+			return -1;
+		}
+		logline(LOG_INFO, "    Resuming with %d expansions and %d names to retry, %d hosts found before.",
+			queue.heap_count, queue.retry_count, found);
 	}
 	else
 	{
-		/* Extract results from thread 4 */
-		logline(LOG_DEBUG, "    Thread 4: Finished successfully");
+		if (params->reverse)
+		{
+			if (queue.word_count > 0)
+				queue_expansion(&queue, NULL, 1, 1);
+			for (i = 0; i < range_count; i++)
+				queue_range(&queue, ranges[i]);
+			free(ranges);
+		}
+		else
+		{
+			queue_expansion(&queue, params->domains, params->domain_count, 1);
+		}
+		if (params->state && (write_words(&queue) < 0))
+		{
+			free_queue(&queue);
+			return -1;
+		}
 	}
-
-	if ((int *)t5_status < 0)
+	if (params->state)
+		queue.next_checkpoint = time(NULL) + CHECKPOINT_INTERVAL;
+
+	/* Ctrl-C ends the run gracefully. The workers leave the signal to
+	 * this thread, so their queries are not cut short. A second Ctrl-C
+	 * terminates at once. */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_sigint;
+	action.sa_flags = SA_RESETHAND;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, &old_action);
+
+	/* Scrapes see the queue from here on */
+	metrics_set_source(write_queue_metrics, &queue);
+
+	/* This thread feeds the workers and writes the results. It takes
+	 * the first CPU of --cpus, together with the progress thread */
+	if (params->cpu_count && !params->listen && (affinity_pin(pthread_self(), params->cpus, 1) < 0))
 	{
-		logline(LOG_ERROR, "    Thread 5: An error occurred");
+		logline(LOG_ERROR, "    Could not move to CPU %d", params->cpus[0]);
 	}
-	else
+
+	/* Queries are counted from here on, the remote workers of a
+	 * coordinator count their own */
+	if (!params->listen && (stats_start(params->progress) < 0))
 	{
-		/* Extract results from thread 5 */
-		logline(LOG_DEBUG, "    Thread 5: Finished successfully");
+		logline(LOG_ERROR, "    Progress thread could not be created");
 	}
 
-	/* Consolidate results */
-	if (result_all == NULL)
+	if (params->listen)
 	{
-		result_all = t1_params.result_list;
+		/* Remote workers query the names, the coordinator only
+		 * hands them out and collects the hosts found */
+		if (serve_workers(&queue) < 0)
+		{
+			metrics_set_source(NULL, NULL);
+			sigaction(SIGINT, &old_action, NULL);
+			free_queue(&queue);
+			return -1;
+		}
 	}
 	else
 	{
-		list_iterator = result_all;
-		while (list_iterator->next)
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGINT);
+		pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+		/* Start worker threads */
+		for (started = 0; started < WORKER_THREADS; started++)
 		{
-			list_iterator = list_iterator->next;
+			t_params[started].thread_id = started + 1;
+			t_params[started].queue = &queue;
+			t_params[started].reverse = params->reverse;
+			t_params[started].server = get_random_server();
+			t_params[started].cpu = params->cpu_count ? params->cpus[(started + 1) % params->cpu_count] : -1;
+
+			pthread_mutex_lock(&queue.lock);
+			queue.workers++;
+			pthread_mutex_unlock(&queue.lock);
+
+			if (pthread_create(&threads[started], NULL, proc_workitems, &t_params[started]))
+			{
+				logline(LOG_ERROR, "    Thread %d: Could not be created", started + 1);
+				pthread_mutex_lock(&queue.lock);
+				queue.workers--;
+				pthread_mutex_unlock(&queue.lock);
+				break;
+			}
+			logline(LOG_DEBUG, "    Thread %d: Created", started + 1);
+		}
+		pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+		if (started == 0)
+		{
+			stats_stop();
+			metrics_set_source(NULL, NULL);
+			sigaction(SIGINT, &old_action, NULL);
+			free_queue(&queue);
+			return -1;
 		}
-		list_iterator->next = t1_params.result_list;
-	}
 
-	if (result_all == NULL)
-	{
-		result_all = t2_params.result_list;
-	}
-	else
-	{
-		list_iterator = result_all;
-		while (list_iterator->next)
+		/* Wait for threads to finish */
+		for (i = 0; i < started; i++)
 		{
-			list_iterator = list_iterator->next;
+			pthread_join(threads[i], &status);
+			if (status == THREAD_FAILED)
+				logline(LOG_ERROR, "    Thread %d: An error occurred", i + 1);
+			else
+				logline(LOG_DEBUG, "    Thread %d: Finished successfully", i + 1);
 		}
-		list_iterator->next = t2_params.result_list;
+		stats_stop();
+		stats_report();
 	}
+	metrics_set_source(NULL, NULL);
+	sigaction(SIGINT, &old_action, NULL);
 
-	if (result_all == NULL)
+	/* Hand over the hosts found */
+	if ((*result_all) == NULL)
 	{
-		result_all = t3_params.result_list;
+		*result_all = queue.results;
 	}
 	else
 	{
-		list_iterator = result_all;
+		list_iterator = (*result_all);
 		while (list_iterator->next)
 		{
 			list_iterator = list_iterator->next;
 		}
-		list_iterator->next = t3_params.result_list;
+		list_iterator->next = queue.results;
 	}
 
-	if (result_all == NULL)
+	if (queue.interrupted)
 	{
-		result_all = t4_params.result_list;
+		logline(LOG_INFO, "Interrupted, stopped with the hosts found so far.");
+		report_unprocessed(&queue);
 	}
-	else
+	else if (queue.expired)
 	{
-		list_iterator = result_all;
-		while (list_iterator->next)
-		{
-			list_iterator = list_iterator->next;
-		}
-		list_iterator->next = t4_params.result_list;
+		logline(LOG_INFO, "Time budget of %d seconds used up.", params->time_budget);
+		report_unprocessed(&queue);
 	}
+	if (!dedup_is_exact(queue.seen))
+		logline(LOG_INFO, "More than %d MiB of names generated, duplicates of %u names were dropped approximately.",
+			params->dedup_memory, dedup_count(queue.seen));
 
-	if (result_all == NULL)
-	{
-		result_all = t5_params.result_list;
-	}
-	else
+	/* Work left behind by failed threads, the time budget or Ctrl-C is
+	 * kept for --resume, a finished run needs no state */
+	if (params->state)
 	{
-		list_iterator = result_all;
-		while (list_iterator->next)
+		pending = queue.retry_count + queue.heap_count + (queue.mutations != NULL);
+		for (i = 0; i < WORKER_THREADS; i++)
+			pending += (queue.active[i].host[0] != '\0');
+		if (pending > 0)
 		{
-			list_iterator = list_iterator->next;
+			pthread_mutex_lock(&queue.lock);
+			if (write_checkpoint(&queue) == 0)
+				logline(LOG_INFO, "Work left saved to %s, continue with --resume=%s", params->state, params->state);
+			pthread_mutex_unlock(&queue.lock);
+		}
+		else
+		{
+			snprintf(filename, sizeof(filename), "%s.words", params->state);
+			remove(filename);
+			snprintf(filename, sizeof(filename), "%s.results", params->state);
+			remove(filename);
+			remove(params->state);
 		}
-		list_iterator->next = t5_params.result_list;
 	}
 
-	logline(LOG_INFO, "Finished processing data.");
-	logline(LOG_INFO, "The following hosts have been identified:");
+	free_queue(&queue);
+	mutate_free();
 
-	/* Print results on screen */
-	list_iterator = result_all;
-	while (list_iterator)
+	return 0;
+}
+
+
+/*
+ * Frees the words of a queue and the work left in it.
+ */
+void free_queue(work_queue *queue)
+{
+	expansion *exp;
+	int i;
+
+	while (queue->mutations)
 	{
-		hostcount++;
-		logline(LOG_INFO, "    Host: %s, IP: %s", list_iterator->host, list_iterator->ip);
-		list_iterator = list_iterator->next;
+		exp = queue->mutations->next;
+		free_expansion(queue->mutations);
+		queue->mutations = exp;
 	}
-	if (hostcount == 0)
+	for (i = 0; i < queue->heap_count; i++)
+		free_expansion(queue->heap[i]);
+	while (queue->spare)
 	{
-		logline(LOG_INFO, "    Unfortunately, no hosts have been found. Try again using different settings.");
-	} 
+		exp = queue->spare->next;
+		free(queue->spare);
+		queue->spare = exp;
+	}
+	free(queue->heap);
+	free(queue->retries);
+
+	free(queue->words);
+	free(queue->weights);
+	dedup_free(queue->seen);
+	hashset_free(queue->listed);
+	hashset_free(queue->wordset);
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->cond);
+}
+
+
+/*
+ * Adds the state of the queue to a scrape of the metrics. Progress is
+ * the share of the names handed out so far among those known by now;
+ * mutations and names below hosts still to be found are not known.
+ */
+void write_queue_metrics(FILE *out, void *arg)
+{
+	work_queue *queue = (work_queue *)arg;
+	unsigned long pending = 0;
+	unsigned long served, found;
+	int heap_count, retry_count, workers, idle;
+	int i;
+
+	pthread_mutex_lock(&queue->lock);
+	for (i = 0; i < queue->heap_count; i++)
+		pending += expansion_size(queue, queue->heap[i]) - queue->heap[i]->cursor;
+	pending += queue->retry_count;
+	served = queue->served;
+	found = queue->found;
+	heap_count = queue->heap_count;
+	retry_count = queue->retry_count;
+	workers = queue->workers;
+	idle = queue->idle;
+	pthread_mutex_unlock(&queue->lock);
+
+	fprintf(out, "# HELP dnsninja_names_served_total Names handed out to the workers.\n");
+	fprintf(out, "# TYPE dnsninja_names_served_total counter\n");
+	fprintf(out, "dnsninja_names_served_total %lu\n", served);
+	fprintf(out, "# HELP dnsninja_hosts_found_total Hosts found.\n");
+	fprintf(out, "# TYPE dnsninja_hosts_found_total counter\n");
+	fprintf(out, "dnsninja_hosts_found_total %lu\n", found);
+	fprintf(out, "# HELP dnsninja_queue_names Names waiting in the queue.\n");
+	fprintf(out, "# TYPE dnsninja_queue_names gauge\n");
+	fprintf(out, "dnsninja_queue_names %lu\n", pending);
+	fprintf(out, "# HELP dnsninja_queue_expansions Domains and hosts the words are still tried below.\n");
+	fprintf(out, "# TYPE dnsninja_queue_expansions gauge\n");
+	fprintf(out, "dnsninja_queue_expansions %d\n", heap_count);
+	fprintf(out, "# HELP dnsninja_queue_retries Names waiting to be tried again.\n");
+	fprintf(out, "# TYPE dnsninja_queue_retries gauge\n");
+	fprintf(out, "dnsninja_queue_retries %d\n", retry_count);
+	fprintf(out, "# HELP dnsninja_workers Threads or remote workers taking names.\n");
+	fprintf(out, "# TYPE dnsninja_workers gauge\n");
+	fprintf(out, "dnsninja_workers %d\n", workers);
+	fprintf(out, "# HELP dnsninja_workers_idle Workers waiting for names.\n");
+	fprintf(out, "# TYPE dnsninja_workers_idle gauge\n");
+	fprintf(out, "dnsninja_workers_idle %d\n", idle);
+	fprintf(out, "# HELP dnsninja_progress_ratio Share of the known names handed out.\n");
+	fprintf(out, "# TYPE dnsninja_progress_ratio gauge\n");
+	fprintf(out, "dnsninja_progress_ratio %.4f\n", (served + pending) ? (double)served / (served + pending) : 0);
+}
+
+
+/*
+ * Collects the records of a zone transfer. Address records are
+ * added to the result list passed in arg. Returns -1 if out of
+ * memory, which aborts the transfer.
+ */
+int collect_axfr_record(struct DNS_RR *rr, void *arg)
+{
+	result **result_list = (result **)arg;
+	result *list_entry;
+
+	if (rr->type != DNS_RES_REC_A)
+		return 0;
+
+	list_entry = new_result(rr->name, rr->data, NULL);
+	if (list_entry == NULL)
+		return -1;
+
+	/* Transfers can be large, so prepend instead of walking the list */
+	list_entry->next = *result_list;
+	*result_list = list_entry;
+
+	return 0;
+}
+
+
+/*
+ * Appends the results in more to the end of list.
+ */
+void append_results(result **list, result *more)
+{
+	while (*list)
+		list = &(*list)->next;
+	*list = more;
+}
+
+
+/*
+ * Drops results listing the same host and address (or record types)
+ * as an earlier one. Returns the number of results dropped.
+ */
+int drop_duplicate_results(result **list)
+{
+	hashset *listed;
+	char key[1024];
+	int dropped = 0;
+
+	listed = hashset_create(1024);
+	if (listed == NULL)
+		return 0;
+
+	while (*list)
+	{
+		snprintf(key, sizeof(key), "%s,%s", (*list)->host, (*list)->types ? (*list)->types : (*list)->ip);
+		if (hashset_add(listed, hashset_hash_name(key)) == 0)
+		{
+			/* Results live in result_memory, nothing to free */
+			*list = (*list)->next;
+			dropped++;
+		}
+		else
+		{
+			list = &(*list)->next;
+		}
+	}
+	hashset_free(listed);
+
+	return dropped;
+}
+
+
+/*
+ * Tries a zone transfer for each domain. Domains which could be
+ * transferred are removed from the domain list, no dictionary lookups
+ * are needed for them. Returns the number of transferred domains.
+ */
+int do_zone_transfers(result **result_all)
+{
+	int i, kept = 0, transferred = 0;
+
+	for (i = 0; i < params->domain_count; i++)
+	{
+		lookup_ns_servers(params->domains[i]);
+		if (do_zone_transfer(params->domains[i], result_all))
+		{
+			transferred++;
+			continue;
+		}
+		params->domains[kept++] = params->domains[i];
+	}
+	params->domain_count = kept;
+
+	if (transferred > 0)
+		logline(LOG_INFO, "%d zones transferred, %d left for dictionary lookups.", transferred, kept);
+
+	return transferred;
+}
+
+
+/*
+ * Tries to transfer the zone from each of its name servers. Returns 1
+ * if a transfer succeeded and its results are in result_all, 0 otherwise.
+ * The hosts of transfers that failed partway are added to result_all
+ * too, but the zone is left to the dictionary lookups then, as it may
+ * hold more names. Hosts found twice are listed once at the end.
+ */
+int do_zone_transfer(char *domain, result **result_all)
+{
+	result *transfer;
+	result *list_iterator;
+	int i, ret, hosts;
+
+	for (i = 0; i < ns_server_count; i++)
+	{
+		logline(LOG_INFO, "    Trying zone transfer from %s...", ns_servers[i]);
+		transfer = NULL;
+		ret = dns_axfr(ns_servers[i], domain, collect_axfr_record, &transfer);
+		if (ret > 0)
+		{
+			logline(LOG_INFO, "    Zone transfer from %s succeeded. %d records received.", ns_servers[i], ret);
+			append_results(result_all, transfer);
+			logline(LOG_INFO, "Skipping dictionary lookups for %s.", domain);
+			return 1;
+		}
+
+		logline(LOG_INFO, "    Zone transfer from %s failed. Error code: %d", ns_servers[i], ret);
+		if (transfer)
+		{
+			hosts = 0;
+			for (list_iterator = transfer; list_iterator; list_iterator = list_iterator->next)
+				hosts++;
+			logline(LOG_INFO, "    Keeping the %d hosts received before the transfer failed.", hosts);
+			append_results(result_all, transfer);
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Looks up the name servers of a domain once. They are used for zone
+ * transfers and for sending queries directly to them.
+ */
+int lookup_ns_servers(char *domain)
+{
+	int i;
+
+	for (i = 0; i < ns_server_count; i++)
+		free(ns_servers[i]);
+
+	logline(LOG_INFO, "Looking up name servers of %s...", domain);
+	ns_server_count = dns_lookup_ns(get_random_server(), domain, ns_servers, 16);
+	if (ns_server_count <= 0)
+	{
+		ns_server_count = 0;
+		logline(LOG_INFO, "    No name servers found.");
+		return 0;
+	}
+
+	for (i = 0; i < ns_server_count; i++)
+		logline(LOG_INFO, "    Name server: %s", ns_servers[i]);
+
+	return ns_server_count;
+}
+
+
+/*
+ * Chooses the next authoritative name server. Queries are spread
+ * evenly across the name server set.
+ */
+char *get_ns_server(void)
+{
+	static unsigned int next = 0;
+
+	return ns_servers[__sync_fetch_and_add(&next, 1) % ns_server_count];
+}
+
+
+/*
+ * Enumerates the domain by walking its NSEC chain. Every name found is
+ * added to the result list together with its record types.
+ */
+int do_nsec_walk(result **result_all)
+{
+	nsec_name *names = NULL;
+	nsec_name *name;
+	result *list_entry;
+	char types[256];
+	int ret, count = 0;
+
+	logline(LOG_INFO, "Walking NSEC chain of %s, stay tuned...", params->domain);
+	ret = nsec_walk(get_random_server(), params->domain, &names);
+	if (ret < 0)
+	{
+		logline(LOG_ERROR, "Error: Zone %s could not be walked. Is it signed using NSEC?", params->domain);
+		return -1;
+	}
+
+	for (name = names; name; name = name->next)
+	{
+		nsec_types_to_string(name->typemap, types, sizeof(types));
+
+		list_entry = new_result(name->name, "-", types);
+		if (list_entry == NULL)
+		{
+			logline(LOG_ERROR, "Error: Not enough memory for the names of the NSEC chain.");
+			nsec_free(names);
+			return -1;
+		}
+		list_entry->next = *result_all;
+		*result_all = list_entry;
+		count++;
+	}
+
+	logline(LOG_INFO, "NSEC walk finished. %d names found using %d queries.", count, ret);
+	nsec_free(names);
+
+	return 0;
+}
+
+
+/*
+ * Collects the NSEC3 hashes of the domain and matches the words of the
+ * input file against them offline. Every name found is added to the
+ * result list together with its record types.
+ */
+int do_nsec3_crack(result **result_all)
+{
+	nsec3_match *matches = NULL;
+	nsec3_match *match;
+	result *list_entry;
+	char **labels;
+	char types[256];
+	int ret, count = 0;
+
+	logline(LOG_INFO, "Collecting NSEC3 hashes of %s, stay tuned...", params->domain);
+	ret = nsec3_collect(get_random_server(), params->domain, NSEC3_MAX_QUERIES);
+	if (ret == -3)
+	{
+		logline(LOG_ERROR, "Error: Not enough memory for the NSEC3 records of %s.", params->domain);
+		nsec3_free();
+		return -1;
+	}
+	if (ret < 0)
+	{
+		logline(LOG_ERROR, "Error: No NSEC3 records found. Is %s signed using NSEC3?", params->domain);
+		return -1;
+	}
+	logline(LOG_INFO, "%d NSEC3 records collected using %d queries.", nsec3_hash_count(), ret);
+
+	labels = load_labels(params->inputfile, &count, NULL);
+	if (labels == NULL)
+	{
+		nsec3_free();
+		return -1;
+	}
+
+	ret = nsec3_crack(labels, count, params->domain, &matches);
+	logline(LOG_INFO, "%d of %d candidates matched a collected hash.", ret, count);
+
+	for (match = matches; match; match = match->next)
+	{
+		nsec_types_to_string(match->typemap, types, sizeof(types));
+		if (types[0] == '\0')
+			strcpy(types, "unknown");
+
+		list_entry = new_result(match->name, "-", types);
+		if (list_entry == NULL)
+		{
+			logline(LOG_ERROR, "Error: Not enough memory for the names matched.");
+			break;
+		}
+		list_entry->next = *result_all;
+		*result_all = list_entry;
+	}
+
+	nsec3_free_matches(matches);
+	nsec3_free();
+	free(labels);
+
+	return match ? -1 : 0;
+}
+
+
+/*
+ * Loads the lines of the input file into an array. A line may carry a
+ * frequency weight after the label, separated by blanks or a comma. If
+ * weights is not NULL, it receives the weight of each label, 0 if none
+ * is given.
+ */
+char **load_labels(char *inputfile, int *count, double **weights)
+{
+	FILE *f;
+	char line[256];
+	char **labels = NULL;
+	char *sep;
+	int size = 0;
+
+	*count = 0;
+	if (weights)
+		*weights = NULL;
+
+	f = fopen(inputfile, "r");
+	if (f == NULL)
+	{
+		logline(LOG_ERROR, "Error: File %s could not be opened", inputfile);
+		return NULL;
+	}
+
+	while (fgets(line, 255, f) != NULL)
+	{
+		chomp(line);
+		sep = line + strcspn(line, " \t,");
+		if (*sep != '\0')
+			*sep++ = '\0';
+		if (line[0] == '\0')
+			continue;
+
+		if (*count == size)
+		{
+			size = size ? size * 2 : 1024;
+			labels = (char **)realloc(labels, size * sizeof(char *));
+			if (weights)
+				*weights = (double *)realloc(*weights, size * sizeof(double));
+		}
+		labels[*count] = arena_strdup(word_memory, line);
+		if (weights)
+			(*weights)[*count] = strtod(sep + strspn(sep, " \t,"), NULL);
+		(*count)++;
+	}
+	fclose(f);
+
+	return labels;
+}
+
+
+/*
+ * Moves the address ranges of a reverse input file (a.b.c.d/prefix)
+ * from labels to ranges, which must have room for count entries. The
+ * addresses of a range are generated as they are queried, so even a /8
+ * takes no memory up front. Returns the number of labels left.
+ */
+int take_ranges(char **labels, double *weights, int count, char **ranges, int *range_count)
+{
+	int i, kept = 0;
+
+	*range_count = 0;
+	for (i = 0; i < count; i++)
+	{
+		if (strchr(labels[i], '/'))
+		{
+			ranges[(*range_count)++] = labels[i];
+			continue;
+		}
+		weights[kept] = weights[i];
+		labels[kept++] = labels[i];
+	}
+
+	return kept;
+}
+
+
+/*
+ * Queues the addresses of a range (a.b.c.d/prefix) for reverse lookups.
+ * The shard of this process only takes its share of them. Returns -1 if
+ * the range is invalid or out of memory.
+ */
+int queue_range(work_queue *queue, const char *range)
+{
+	expansion *exp;
+	unsigned int start;
+	long size;
+
+	size = parse_range(range, &start);
+	if (size == 0)
+	{
+		logline(LOG_ERROR, "    Address range %s is invalid, skipping it", range);
+		return -1;
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	exp = take_expansion(queue);
+	if (exp == NULL)
+	{
+		pthread_mutex_unlock(&queue->lock);
+		return -1;
+	}
+	exp->base_count = 1;
+	exp->depth = 1;
+	exp->range_start = start;
+	exp->range_size = size;
+	set_single_base(exp, range);
+	exp->seq = queue->seq++;
+	heap_push(queue, exp);
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	return 0;
+}
+
+
+/*
+ * Parses an address range (a.b.c.d/prefix, prefix 8 to 32) into its
+ * first address in host order. Returns the number of addresses in the
+ * range or 0 if it is invalid.
+ */
+long parse_range(const char *range, unsigned int *start)
+{
+	char address[INET_ADDRSTRLEN];
+	struct in_addr in;
+	const char *slash;
+	int prefix;
+	long size;
+
+	slash = strchr(range, '/');
+	if ((slash == NULL) || (slash - range >= (long)sizeof(address)))
+		return 0;
+	snprintf(address, sizeof(address), "%.*s", (int)(slash - range), range);
+	prefix = atoi(slash + 1);
+	if ((inet_pton(AF_INET, address, &in) != 1) || (prefix < 8) || (prefix > 32))
+		return 0;
+
+	size = 1L << (32 - prefix);
+	*start = ntohl(in.s_addr) & ~(unsigned int)(size - 1);
+
+	return size;
+}
+
+
+/*
+ * Checks whether a name belongs to the shard of this process. Names
+ * are assigned by their hash, so the processes of a sharded scan split
+ * the work without talking to each other.
+ */
+int shard_owns(const char *name)
+{
+	unsigned long long h;
+
+	if (params->shard_count <= 1)
+		return 1;
+
+	/* Spread the bits, FNV-1a leaves the low ones biased */
+	h = hashset_hash_name(name);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+
+	return (int)(h % params->shard_count) == params->shard_index - 1;
+}
+
+
+/*
+ * Removes duplicates from a list of labels, keeping the first
+ * occurrence of each. weights may be NULL. Returns the new number of
+ * labels. Beyond the memory given with -D, a rare unique label may be
+ * dropped as well.
+ */
+int unique_labels(char **labels, double *weights, int count)
+{
+	dedup *set;
+	int i, kept = 0;
+
+	set = dedup_create((unsigned long)params->dedup_memory << 20);
+	if (set == NULL)
+		return count;
+
+	for (i = 0; i < count; i++)
+	{
+		if (dedup_add(set, hashset_hash_name(labels[i])) == 0)
+			continue;
+		if (weights)
+			weights[kept] = weights[i];
+		labels[kept++] = labels[i];
+	}
+	dedup_free(set);
+
+	return kept;
+}
+
+
+/*
+ * Orders weighted words by descending weight, then by file position.
+ */
+int compare_weighted_words(const void *a, const void *b)
+{
+	const weighted_word *x = (const weighted_word *)a;
+	const weighted_word *y = (const weighted_word *)b;
+
+	if (x->weight != y->weight)
+		return (x->weight > y->weight) ? -1 : 1;
+
+	return x->pos - y->pos;
+}
+
+
+/*
+ * Sorts the words by descending weight. Words of equal weight keep the
+ * order of the input file.
+ */
+void sort_words(char **words, double *weights, int count)
+{
+	weighted_word *sorted;
+	int i;
+
+	sorted = (weighted_word *)malloc(sizeof(weighted_word) * count);
+	if (sorted == NULL)
+		return;
+
+	for (i = 0; i < count; i++)
+	{
+		sorted[i].word = words[i];
+		sorted[i].weight = weights[i];
+		sorted[i].pos = i;
+	}
+	qsort(sorted, count, sizeof(weighted_word), compare_weighted_words);
+	for (i = 0; i < count; i++)
+	{
+		words[i] = sorted[i].word;
+		weights[i] = sorted[i].weight;
+	}
+
+	free(sorted);
+}
+
+
+/*
+ * Raises the weight of the words found in past scans. A single past
+ * hit outweighs any weight given in the input file.
+ */
+void apply_history(char **words, double *weights, int count)
+{
+	history_entry *entries;
+	unsigned int hits;
+	int i, entry_count, known = 0;
+
+	entry_count = history_load(params->history, &entries);
+	for (i = 0; i < count; i++)
+	{
+		hits = history_hits(entries, entry_count, words[i]);
+		if (hits > 0)
+		{
+			weights[i] += hits * HISTORY_WEIGHT;
+			known++;
+		}
+	}
+	history_free(entries, entry_count);
+
+	logline(LOG_INFO, "    %d words found in past scans.", known);
+}
+
+
+/*
+ * Adds the first labels of the hosts found to the history file.
+ */
+void update_history(result *results)
+{
+	history_entry *entries;
+	hashset *hosts;
+	char **labels;
+	int count = 0, size = 0, entry_count;
+	int len;
+
+	hosts = hashset_create(1024);
+	if (hosts == NULL)
+		return;
+
+	/* Results hold one entry per address, count every host once */
+	labels = NULL;
+	for (; results; results = results->next)
+	{
+		if (hashset_add(hosts, hashset_hash_name(results->host)) != 1)
+			continue;
+
+		if (count == size)
+		{
+			size = size ? size * 2 : 256;
+			labels = (char **)realloc(labels, size * sizeof(char *));
+		}
+		len = strcspn(results->host, ".");
+		labels[count] = (char *)malloc(len + 1);
+		memcpy(labels[count], results->host, len);
+		labels[count][len] = '\0';
+		count++;
+	}
+	hashset_free(hosts);
+
+	entry_count = history_load(params->history, &entries);
+	if (history_save(params->history, entries, entry_count, labels, count) < 0)
+		logline(LOG_ERROR, "Error: History file %s could not be written", params->history);
+	else
+		logline(LOG_INFO, "History %s updated with %d hosts.", params->history, count);
+	history_free(entries, entry_count);
+
+	while (count > 0)
+		free(labels[--count]);
+	free(labels);
+}
+
+
+/*
+ * Fills the domain list. If the domain option names a file, the
+ * domains are read from it, one per line. Returns -1 if the file
+ * contains no domains.
+ */
+int load_domains(void)
+{
+	struct stat st;
+
+	if ((stat(params->domain, &st) == 0) && S_ISREG(st.st_mode))
+	{
+		params->domainfile = params->domain;
+		params->domains = load_labels(params->domainfile, &params->domain_count, NULL);
+		params->domain_count = unique_labels(params->domains, NULL, params->domain_count);
+		if (params->domain_count == 0)
+			return -1;
+
+		/* Single domain modes work with a list of one */
+		params->domain = params->domains[0];
+	}
+	else
+	{
+		params->domains = &params->domain;
+		params->domain_count = 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Creates a result with copies of host, ip and types (which may be
+ * NULL). Results are taken from an arena in a single piece and all
+ * released at the end of the run.
+ */
+result *new_result(const char *host, const char *ip, const char *types)
+{
+	size_t host_len = strlen(host) + 1;
+	size_t ip_len = strlen(ip) + 1;
+	size_t types_len = types ? strlen(types) + 1 : 0;
+	result *res;
+
+	res = (result *)arena_alloc(result_memory, sizeof(result) + host_len + ip_len + types_len);
+	if (res == NULL)
+		return NULL;
+	res->host = (char *)(res + 1);
+	res->ip = res->host + host_len;
+	res->types = types ? res->ip + ip_len : NULL;
+	res->next = NULL;
+	memcpy(res->host, host, host_len);
+	memcpy(res->ip, ip, ip_len);
+	if (types)
+		memcpy(res->types, types, types_len);
+
+	return res;
+}
+
+/*
+ * Checks the input file if it contains valid hostnames.
+ */
+int check_input_file_host(void)
+{
+	int error = 0;
+	FILE *f;
+	int ret = 0;
+	regex_t regex_host;
+	char line[256];
+
+	/* Compile regex pattern */
+	if ((ret = regcomp(&regex_host, "^[0-9a-zA-Z-]{3,100}([ \t,]+[0-9.]+)?$", REG_EXTENDED)) != 0)
+	{
+		return -1;    
+	}
+
+	/* Check if every line in the input file is a valid host */
+	f = fopen(params->inputfile, "r");
+	if (f != NULL)
+	{
+		while ((fgets(line, 255, f) != NULL) && (error == 0))
+		{
+			chomp(line);
+			ret = regexec(&regex_host, line, 0, NULL, 0);
+			if (ret == 0)
+			{
+				logline(LOG_DEBUG, "    Work item %s is valid", line);
+			}
+			else if (ret == REG_NOMATCH)
+			{
+				logline(LOG_DEBUG, "    Work item %s has an invalid format", line);
+				error = 1;
+			}
+			else
+			{
+				logline(LOG_DEBUG, "    Work item %s has an unknown problem. Return code was: %d", line, ret);
+				error = 1;
+			}	
+		}
+	
+		regfree(&regex_host);
+		fclose(f);
+		
+		if (error == 1)
+		{
+			return -2;
+		}
+	}
+	else
+	{	
+		/* File could not be opened */
+		return -3;
+	}
+	
+	return 0;
+}
+
+/*
+ * Checks the input file if it contains valid ip addresses.
+ */
+int check_input_file_ip(void)
+{
+	int error = 0;
+	FILE *f;
+	int ret = 0;
+	regex_t regex_ip;
+	char line[256];
+
+	/* Compile regex pattern */
+	if ((ret = regcomp(&regex_ip, "^[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}(/[0-9]{1,2})?$", REG_EXTENDED)) != 0)
+	{
+		return -1;    
+	}
+
+	/* Check if every line in the input file is a valid host */
+	f = fopen(params->inputfile, "r");
+	if (f != NULL)
+	{
+		while ((fgets(line, 255, f) != NULL) && (error == 0))
+		{
+			chomp(line);
+			ret = regexec(&regex_ip, line, 0, NULL, 0);
+			if (ret == 0)
+			{
+				logline(LOG_DEBUG, "    Work item %s is valid", line);
+			}
+			else if (ret == REG_NOMATCH)
+			{
+				logline(LOG_DEBUG, "    Work item %s has an invalid format", line);
+				error = 1;
+			}
+			else
+			{
+				logline(LOG_DEBUG, "    Work item %s has an unknown problem. Return code was: %d", line, ret);
+				error = 1;
+			}	
+		}
+	
+		regfree(&regex_ip);
+		fclose(f);
+		
+		if (error == 1)
+		{
+			return -2;
+		}
+	}
+	else
+	{ 
+		/* File could not be opened */
+		return -3;
+	}
+	
+	return 0;
+}
+
+
+/*
+ * Writes results to a file.
+ */
+void write_results(result *results)
+{
+	FILE *f;
+
+	f = fopen(params->outputfile, "w");
+	if (f != NULL)
+	{
+		if (params->nsec || params->nsec3)
+			fprintf(f, "Host,Types\n");
+		else
+			fprintf(f, "Host,IP\n");
+
+		while (results)
+		{
+			if (results->types)
+				fprintf(f, "%s,%s\n", results->host, results->types);
+			else
+				fprintf(f, "%s,%s\n", results->host, results->ip);
+			results = results->next;
+		}
+
+		fclose(f);
+	}
+}
+
+
+/*
+ * Combines the output files of several shards into the output file.
+ * The header is taken from the first file, every other line is written
+ * once, in the order of the files. Returns the number of hosts written
+ * or -1 if any of the files could not be read, as the merge would miss
+ * a shard then.
+ */
+int merge_results(char **files, int count)
+{
+	hashset *written;
+	FILE *in, *out;
+	char line[1024];
+	int i, first, failed = 0, hosts = 0, duplicates = 0;
+
+	/* Check every shard before the output file is replaced */
+	for (i = 0; i < count; i++)
+	{
+		in = fopen(files[i], "r");
+		if (in == NULL)
+		{
+			logline(LOG_ERROR, "Error: File %s could not be opened", files[i]);
+			failed = 1;
+			continue;
+		}
+		fclose(in);
+	}
+	if (failed)
+		return -1;
+
+	written = hashset_create(1024);
+	out = fopen(params->outputfile, "w");
+	if ((written == NULL) || (out == NULL))
+	{
+		logline(LOG_ERROR, "Error: File %s could not be written", params->outputfile);
+		hashset_free(written);
+		if (out)
+			fclose(out);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		in = fopen(files[i], "r");
+		if (in == NULL)
+		{
+			logline(LOG_ERROR, "Error: File %s could not be opened", files[i]);
+			failed = 1;
+			break;
+		}
+
+		first = 1;
+		while (fgets(line, sizeof(line), in) != NULL)
+		{
+			chomp(line);
+			if (line[0] == '\0')
+				continue;
+
+			/* Each file starts with the same header */
+			if (first)
+			{
+				first = 0;
+				if (hashset_add(written, hashset_hash_name(line)) == 1)
+					fprintf(out, "%s\n", line);
+				continue;
+			}
+
+			if (hashset_add(written, hashset_hash_name(line)) == 0)
+			{
+				duplicates++;
+				continue;
+			}
+			fprintf(out, "%s\n", line);
+			hosts++;
+		}
+		if (ferror(in))
+		{
+			logline(LOG_ERROR, "Error: File %s could not be read", files[i]);
+			failed = 1;
+		}
+		fclose(in);
+		if (failed)
+			break;
+	}
+
+	hashset_free(written);
+	if ((fclose(out) != 0) && !failed)
+	{
+		logline(LOG_ERROR, "Error: File %s could not be written", params->outputfile);
+		failed = 1;
+	}
+	if (failed)
+	{
+		remove(params->outputfile);
+		return -1;
+	}
+	logline(LOG_INFO, "Merged %d files into %s: %d hosts, %d duplicates dropped.",
+		count, params->outputfile, hosts, duplicates);
+
+	return hosts;
+}
+
+
+/*
+ * Appends an expansion to the queue: every word of the input file is
+ * tried below each of the bases. bases is NULL for reverse lookups,
+ * where the words are ip addresses and used as they are.
+ */
+int queue_expansion(work_queue *queue, char **bases, int base_count, int depth)
+{
+	expansion *exp;
+	int i;
+
+	pthread_mutex_lock(&queue->lock);
+	exp = take_expansion(queue);
+	if (exp == NULL)
+	{
+		pthread_mutex_unlock(&queue->lock);
+		return -1;
+	}
+	exp->base_count = base_count;
+	exp->depth = depth;
+	if (bases && (base_count == 1))
+	{
+		set_single_base(exp, bases[0]);
+	}
+	else if (bases)
+	{
+		exp->bases = (char **)malloc(sizeof(char *) * base_count);
+		for (i = 0; i < base_count; i++)
+			exp->bases[i] = strdup(bases[i]);
+	}
+	exp->seq = queue->seq++;
+	heap_push(queue, exp);
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	return 0;
+}
+
+
+/*
+ * Adds an expansion to the heap. Must be called with the queue lock
+ * held.
+ */
+void heap_push(work_queue *queue, expansion *exp)
+{
+	int i;
+
+	if (queue->heap_count == queue->heap_size)
+	{
+		queue->heap_size = queue->heap_size ? queue->heap_size * 2 : 64;
+		queue->heap = (expansion **)realloc(queue->heap, queue->heap_size * sizeof(expansion *));
+	}
+
+	/* Sift the new expansion up the heap */
+	i = queue->heap_count++;
+	while ((i > 0) && expansion_before(queue, exp, queue->heap[(i - 1) / 2]))
+	{
+		queue->heap[i] = queue->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	queue->heap[i] = exp;
+}
+
+
+/*
+ * Puts a name which timed out back into the queue. It is tried again
+ * once the other work is done, the server may have recovered by then.
+ */
+int requeue_workitem(work_queue *queue, workitem *item)
+{
+	workitem *grown;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->retry_count == queue->retry_size)
+	{
+		grown = (workitem *)realloc(queue->retries, (queue->retry_size + 64) * sizeof(workitem));
+		if (grown == NULL)
+		{
+			pthread_mutex_unlock(&queue->lock);
+			return -1;
+		}
+		queue->retries = grown;
+		queue->retry_size += 64;
+	}
+	queue->retries[queue->retry_count++] = *item;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	return 0;
+}
+
+
+/*
+ * Appends the hosts found by a worker to the results of the queue,
+ * where checkpoints can pick them up.
+ */
+void add_results(work_queue *queue, result *results)
+{
+	result *last = results;
+	unsigned long count = 1;
+
+	while (last->next)
+	{
+		last = last->next;
+		count++;
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	queue->found += count;
+	if (queue->results_last)
+		queue->results_last->next = results;
+	else
+		queue->results = results;
+	queue->results_last = last;
+	pthread_mutex_unlock(&queue->lock);
+}
+
+
+/*
+ * Returns the number of names an expansion generates: the addresses of
+ * its range or the words below each of its bases.
+ */
+long expansion_size(work_queue *queue, expansion *exp)
+{
+	if (exp->range_size)
+		return exp->range_size;
+
+	return (long)queue->word_count * exp->base_count;
+}
+
+
+/*
+ * Checks whether expansion a has to be served before b: its next word
+ * weighs more, or weighs the same and a is older. The addresses of a
+ * range weigh nothing.
+ */
+int expansion_before(work_queue *queue, expansion *a, expansion *b)
+{
+	double wa = a->range_size ? 0 : queue->weights[a->cursor / a->base_count];
+	double wb = b->range_size ? 0 : queue->weights[b->cursor / b->base_count];
+
+	if (wa != wb)
+		return wa > wb;
+
+	return a->seq < b->seq;
+}
+
+
+/*
+ * Restores the heap order below position i after the expansion there
+ * moved on to a lighter word.
+ */
+void heap_sift_down(work_queue *queue, int i)
+{
+	expansion *exp = queue->heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < queue->heap_count)
+	{
+		if ((child + 1 < queue->heap_count) &&
+			expansion_before(queue, queue->heap[child + 1], queue->heap[child]))
+			child++;
+		if (!expansion_before(queue, queue->heap[child], exp))
+			break;
+		queue->heap[i] = queue->heap[child];
+		i = child;
+	}
+	queue->heap[i] = exp;
+}
+
+
+/*
+ * Puts the mutations of a host found in front of the word expansions,
+ * they are more promising than the words still waiting. The mutations are
+ * tried below the parent of the host.
+ */
+int queue_mutations(work_queue *queue, char *host, int label_len, int depth)
+{
+	expansion *exp;
+
+	pthread_mutex_lock(&queue->lock);
+	exp = take_expansion(queue);
+	if (exp == NULL)
+	{
+		pthread_mutex_unlock(&queue->lock);
+		return -1;
+	}
+	exp->mut = &exp->mutation;
+	mutator_init(exp->mut, host, label_len);
+	set_single_base(exp, host + label_len + 1);
+	exp->base_count = 1;
+	exp->depth = depth;
+	exp->seq = queue->seq++;
+	exp->next = queue->mutations;
+	queue->mutations = exp;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	return 0;
+}
+
+
+/*
+ * Frees an expansion and its bases.
+ */
+void free_expansion(expansion *exp)
+{
+	int i;
+
+	if (exp->bases && (exp->bases != &exp->base))
+	{
+		for (i = 0; i < exp->base_count; i++)
+			free(exp->bases[i]);
+		free(exp->bases);
+	}
+	free(exp);
+}
+
+
+/*
+ * Returns an empty expansion, reusing one done with if there is any.
+ * Hosts found below hosts found create an expansion each, so they are
+ * recycled instead of going back to the heap. Must be called with the
+ * queue lock held. Returns NULL if out of memory.
+ */
+expansion *take_expansion(work_queue *queue)
+{
+	expansion *exp = queue->spare;
+
+	if (exp)
+		queue->spare = exp->next;
+	else
+		exp = (expansion *)malloc(sizeof(expansion));
+	if (exp == NULL)
+		return NULL;
+
+	exp->bases = NULL;
+	exp->base_count = 0;
+	exp->depth = 0;
+	exp->cursor = 0;
+	exp->range_start = 0;
+	exp->range_size = 0;
+	exp->mut = NULL;
+	exp->seq = 0;
+	exp->next = NULL;
+
+	return exp;
+}
+
+
+/*
+ * Keeps an expansion done with for reuse. Must be called with the queue
+ * lock held.
+ */
+void release_expansion(work_queue *queue, expansion *exp)
+{
+	int i;
+
+	if (exp->bases && (exp->bases != &exp->base))
+	{
+		for (i = 0; i < exp->base_count; i++)
+			free(exp->bases[i]);
+		free(exp->bases);
+	}
+	exp->next = queue->spare;
+	queue->spare = exp;
+}
+
+
+/*
+ * Makes base the only base of an expansion, stored in the expansion.
+ */
+void set_single_base(expansion *exp, const char *base)
+{
+	snprintf(exp->base_name, sizeof(exp->base_name), "%s", base);
+	exp->base = exp->base_name;
+	exp->bases = &exp->base;
+}
+
+
+/*
+ * Takes the next work item off the queue. The names of an expansion
+ * are generated on the fly, either as mutations of a hit or word by
+ * word, each word below all bases in turn. The latter spreads the load
+ * across the name servers of many domains. Mutations come first, then
+ * the expansion whose next word weighs most, names to retry last. The
+ * name handed to the thread in slot is kept there until it asks for
+ * the next one, slot -1 keeps no track. If wait is set, waits while the
+ * queue is empty but other threads may still add to it. Returns 0 once
+ * all threads ran out of work, the time budget is used up or the user
+ * pressed Ctrl-C, or without wait if the queue is empty.
+ */
+int next_workitem(work_queue *queue, int slot, workitem *item, int wait)
+{
+	expansion *exp;
+	struct in_addr in;
+	char label[64];
+	char *word;
+	int n;
+
+	pthread_mutex_lock(&queue->lock);
+	if (slot >= 0)
+		queue->active[slot].host[0] = '\0';
+	while (1)
+	{
+		/* Stop handing out work once the time budget is used up */
+		if (queue->deadline && !queue->done && (time(NULL) >= queue->deadline))
+		{
+			queue->expired = 1;
+			queue->done = 1;
+			pthread_cond_broadcast(&queue->cond);
+		}
+		if (interrupted && !queue->done)
+		{
+			queue->interrupted = 1;
+			queue->done = 1;
+			pthread_cond_broadcast(&queue->cond);
+		}
+
+		/* The state is taken under the lock and written without
+		 * it. The next checkpoint is due before, so no other thread
+		 * starts one meanwhile. */
+		if (queue->next_checkpoint && !queue->done && (time(NULL) >= queue->next_checkpoint))
+		{
+			queue->next_checkpoint = time(NULL) + CHECKPOINT_INTERVAL;
+			write_checkpoint(queue);
+			continue;
+		}
+
+		while ((queue->mutations == NULL) && (queue->heap_count == 0) && (queue->retry_count == 0) && !queue->done)
+		{
+			if (!wait)
+			{
+				pthread_mutex_unlock(&queue->lock);
+				return 0;
+			}
+
+			/* The last thread running out of work ends the run */
+			queue->idle++;
+			if (queue->idle == queue->workers)
+			{
+				queue->done = 1;
+				pthread_cond_broadcast(&queue->cond);
+			}
+			else
+			{
+				pthread_cond_wait(&queue->cond, &queue->lock);
+			}
+			queue->idle--;
+		}
+		if (queue->done)
+		{
+			pthread_mutex_unlock(&queue->lock);
+			return 0;
+		}
+
+		if (queue->mutations)
+		{
+			exp = queue->mutations;
+			if (!mutator_next(exp->mut, label, sizeof(label)))
+			{
+				queue->mutations = exp->next;
+				release_expansion(queue, exp);
+				continue;
+			}
+			item->mutation = 1;
+			item->attempts = 0;
+			item->depth = exp->depth;
+			item->label_len = strlen(label);
+			n = snprintf(item->host, sizeof(item->host), "%s.%s", label, exp->bases[0]);
+		}
+		else if (queue->heap_count > 0)
+		{
+			exp = queue->heap[0];
+			item->mutation = 0;
+			item->attempts = 0;
+			item->depth = exp->depth;
+			if (exp->range_size)
+			{
+				in.s_addr = htonl(exp->range_start + (unsigned int)exp->cursor);
+				inet_ntop(AF_INET, &in, item->host, sizeof(item->host));
+				n = strlen(item->host);
+				item->label_len = n;
+			}
+			else
+			{
+				word = queue->words[exp->cursor / exp->base_count];
+				item->label_len = strlen(word);
+				if (exp->bases)
+					n = snprintf(item->host, sizeof(item->host), "%s.%s", word, exp->bases[exp->cursor % exp->base_count]);
+				else
+					n = snprintf(item->host, sizeof(item->host), "%s", word);
+			}
+			exp->cursor++;
+
+			/* Exhausted expansions leave the heap, the others move on
+			 * to their next word */
+			if (exp->cursor == expansion_size(queue, exp))
+			{
+				queue->heap[0] = queue->heap[--queue->heap_count];
+				release_expansion(queue, exp);
+			}
+			if (queue->heap_count > 0)
+				heap_sift_down(queue, 0);
+		}
+		else
+		{
+			*item = queue->retries[--queue->retry_count];
+			break;
+		}
+
+		/* Names grow with every level, skip those too long for DNS.
+		 * Names below hosts found and mutations are generated by the
+		 * shard which found the host, the others are split by hash. */
+		if ((n <= 253) && (item->mutation || (item->depth > 1) || shard_owns(item->host)))
+			break;
+	}
+	if (slot >= 0)
+		queue->active[slot] = *item;
+	queue->served++;
+	pthread_mutex_unlock(&queue->lock);
+
+	return 1;
+}
+
+
+/*
+ * Logs the work left when the time budget ran out. If results are
+ * exported, the report is written next to them as well.
+ */
+void report_unprocessed(work_queue *queue)
+{
+	char filename[4096];
+	char address[INET_ADDRSTRLEN];
+	struct in_addr in;
+	expansion *exp;
+	FILE *f = NULL;
+	long left, total = 0;
+	int i, b, next;
+
+	if (params->outputfile)
+	{
+		snprintf(filename, sizeof(filename), "%s.unprocessed", params->outputfile);
+		f = fopen(filename, "w");
+		if (f == NULL)
+			logline(LOG_ERROR, "Error: File %s could not be written", filename);
+		else
+			fprintf(f, "Base,Words Left,Next Word\n");
+	}
+
+	for (exp = queue->mutations; exp; exp = exp->next)
+	{
+		logline(LOG_INFO, "    Mutations of %s.%s not finished", exp->mut->seed, exp->bases[0]);
+		if (f)
+			fprintf(f, "%s,mutations,%s\n", exp->bases[0], exp->mut->seed);
+	}
+
+	for (i = 0; i < queue->heap_count; i++)
+	{
+		exp = queue->heap[i];
+		if (exp->range_size)
+		{
+			left = exp->range_size - exp->cursor;
+			in.s_addr = htonl(exp->range_start + (unsigned int)exp->cursor);
+			inet_ntop(AF_INET, &in, address, sizeof(address));
+			total += left;
+			if (f)
+				fprintf(f, "%s,%ld,%s\n", exp->bases[0], left, address);
+			logline(LOG_DEBUG, "    %ld addresses left in %s, next is %s", left, exp->bases[0], address);
+			continue;
+		}
+		for (b = 0; b < exp->base_count; b++)
+		{
+			/* Bases before the cursor already got the current word */
+			next = exp->cursor / exp->base_count + ((b < exp->cursor % exp->base_count) ? 1 : 0);
+			left = queue->word_count - next;
+			if (left <= 0)
+				continue;
+			total += left;
+
+			if (f)
+				fprintf(f, "%s,%ld,%s\n", exp->bases ? exp->bases[b] : "-", left, queue->words[next]);
+			logline(LOG_DEBUG, "    %ld words left below %s, next is %s", left,
+				exp->bases ? exp->bases[b] : "-", queue->words[next]);
+		}
+	}
+
+	if (queue->retry_count > 0)
+		logline(LOG_INFO, "    %d names waiting for a retry.", queue->retry_count);
+	logline(LOG_INFO, "    %ld names left unprocessed.", total);
+	if (f)
+	{
+		fclose(f);
+		logline(LOG_INFO, "    Unprocessed work written to %s", filename);
+	}
+}
+
+
+/*
+ * Writes the words of the queue with their weights next to the
+ * checkpoint file. A resumed run takes them from there, in the same
+ * order, even if history or snooping would rank them differently now.
+ * The results log of an earlier scan with the same file is removed.
+ */
+int write_words(work_queue *queue)
+{
+	char filename[4096];
+	char tmpname[4096];
+	FILE *f;
+	int i;
+
+	snprintf(filename, sizeof(filename), "%s.results", params->state);
+	remove(filename);
+
+	snprintf(filename, sizeof(filename), "%s.words", params->state);
+	snprintf(tmpname, sizeof(tmpname), "%s.words.tmp", params->state);
+	f = fopen(tmpname, "w");
+	if (f == NULL)
+	{
+		logline(LOG_ERROR, "Error: File %s could not be written", tmpname);
+		return -1;
+	}
+	for (i = 0; i < queue->word_count; i++)
+		fprintf(f, "%s %.17g\n", queue->words[i], queue->weights[i]);
+
+	return commit_file(f, tmpname, filename);
+}
+
+
+/*
+ * Closes f, written to tmpname, and moves it to filename. The data and
+ * the rename are synced to disk, so after a crash filename holds either
+ * the old or the complete new content. Returns -1 on error.
+ */
+int commit_file(FILE *f, const char *tmpname, const char *filename)
+{
+	char dirname[4096];
+	char *slash;
+	int fd;
+
+	if ((fflush(f) != 0) | ferror(f) | (fsync(fileno(f)) < 0) | (fclose(f) != 0))
+	{
+		logline(LOG_ERROR, "Error: File %s could not be written", tmpname);
+		remove(tmpname);
+		return -1;
+	}
+	if (rename(tmpname, filename) < 0)
+	{
+		logline(LOG_ERROR, "Error: File %s could not be replaced", filename);
+		return -1;
+	}
+
+	/* The rename itself is only durable once the directory is synced */
+	snprintf(dirname, sizeof(dirname), "%s", filename);
+	slash = strrchr(dirname, '/');
+	if (slash == dirname)
+		dirname[1] = '\0';
+	else if (slash)
+		*slash = '\0';
 	else
-	{	
-		logline(LOG_INFO, "    %d hosts found.", hostcount);
+		strcpy(dirname, ".");
+	fd = open(dirname, O_RDONLY | O_DIRECTORY);
+	if (fd >= 0)
+	{
+		fsync(fd);
+		close(fd);
 	}
-	
-	
-	/* Export results to text file */
-	if ((params->outputfile != NULL) && (hostcount > 0))
+
+	return 0;
+}
+
+
+/*
+ * Appends the hosts from first up to last to the results log of the
+ * checkpoint and syncs it. Returns -1 on error.
+ */
+int log_results(result *first, result *last)
+{
+	char filename[4096];
+	result *res;
+	FILE *f;
+
+	snprintf(filename, sizeof(filename), "%s.results", params->state);
+	f = fopen(filename, "a");
+	if (f == NULL)
 	{
-		logline(LOG_INFO, "Exporting data to %s...", params->outputfile);
-		list_iterator = result_all;
-		write_results(list_iterator);
-		logline(LOG_INFO, "Export finished.");
+		logline(LOG_ERROR, "Error: File %s could not be written", filename);
+		return -1;
+	}
+	for (res = first; res; res = res->next)
+	{
+		fprintf(f, "%s %s\n", res->host, res->ip);
+		if (res == last)
+			break;
+	}
+	if ((fflush(f) != 0) | ferror(f) | (fsync(fileno(f)) < 0) | (fclose(f) != 0))
+	{
+		logline(LOG_ERROR, "Error: File %s could not be written", filename);
+		return -1;
 	}
 
-	logline(LOG_INFO, "Thank you for flying with us!");
+	return 0;
 }
 
+
 /*
- * Checks the input file if it contains valid hostnames.
+ * Writes the state of the queue to the checkpoint file: the position
+ * of every expansion and mutator and the names being queried or waiting
+ * for a retry. The hosts found since the last checkpoint are appended
+ * to <file>.results first. Must be called with the queue lock held; the
+ * state is formatted in memory and the lock is released while the
+ * files are written. The checkpoint is replaced atomically, so a crash
+ * leaves the previous one intact.
  */
-int check_input_file_host(void)
+int write_checkpoint(work_queue *queue)
 {
-	int error = 0;
+	char tmpname[4096];
+	char *state = NULL;
+	size_t state_len = 0;
+	expansion *exp;
+	result *first, *last;
+	workitem *item;
 	FILE *f;
-	int ret = 0;
-	regex_t regex_host;
-	char line[256];
+	int i, b, logged, ret = -1;
 
-	/* Compile regex pattern */
-	if ((ret = regcomp(&regex_host, "^[0-9a-zA-Z-]{3,100}$", REG_EXTENDED)) != 0)
+	f = open_memstream(&state, &state_len);
+	if (f == NULL)
 	{
-		return -1;    
+		logline(LOG_ERROR, "Error: Not enough memory for the checkpoint");
+		return -1;
+	}
+	fprintf(f, "%s %d\n", CHECKPOINT_MAGIC, queue->word_count);
+	for (i = 0; i < queue->heap_count; i++)
+	{
+		exp = queue->heap[i];
+		fprintf(f, "E %d %ld %lu %d", exp->depth, exp->cursor, exp->seq, exp->base_count);
+		for (b = 0; b < exp->base_count; b++)
+			fprintf(f, " %s", exp->bases ? exp->bases[b] : "-");
+		fprintf(f, "\n");
+	}
+	for (exp = queue->mutations; exp; exp = exp->next)
+	{
+		fprintf(f, "M %d %lu %d %d %s %s\n", exp->depth, exp->seq, exp->mut->rule,
+			exp->mut->index, exp->mut->seed, exp->bases[0]);
+	}
+	for (i = 0; i < queue->retry_count + WORKER_THREADS; i++)
+	{
+		item = (i < queue->retry_count) ? &queue->retries[i] : &queue->active[i - queue->retry_count];
+		if (item->host[0] != '\0')
+		{
+			fprintf(f, "P %d %d %d %d %s\n", item->depth, item->label_len, item->mutation,
+				item->attempts, item->host);
+		}
+	}
+	if (fclose(f) != 0)
+	{
+		logline(LOG_ERROR, "Error: Not enough memory for the checkpoint");
+		free(state);
+		return -1;
 	}
 
-	/* Check if every line in the input file is a valid host */
-	f = fopen(params->inputfile, "r");
-	if (f != NULL)
+	/* Hosts are only appended to the list, so the ones up to last stay
+	 * as they are while the lock is released */
+	first = queue->results_logged ? queue->results_logged->next : queue->results;
+	last = queue->results_last;
+	pthread_mutex_unlock(&queue->lock);
+
+	/* The hosts go first, a checkpoint never refers to hosts which are
+	 * not in the log */
+	logged = (first == NULL) || (log_results(first, last) == 0);
+	if (logged)
 	{
-		while ((fgets(line, 255, f) != NULL) && (error == 0))
+		snprintf(tmpname, sizeof(tmpname), "%s.tmp", params->state);
+		f = fopen(tmpname, "w");
+		if (f == NULL)
 		{
-			chomp(line);
-			ret = regexec(&regex_host, line, 0, NULL, 0);
-			if (ret == 0)
-			{
-				logline(LOG_DEBUG, "    Work item %s is valid", line);
-			}
-			else if (ret == REG_NOMATCH)
-			{
-				logline(LOG_DEBUG, "    Work item %s has an invalid format", line);
-				error = 1;
-			}
-			else
-			{
-				logline(LOG_DEBUG, "    Work item %s has an unknown problem. Return code was: %d", line, ret);
-				error = 1;
-			}	
+			logline(LOG_ERROR, "Error: Checkpoint %s could not be written", tmpname);
 		}
-	
-		regfree(&regex_host);
-		fclose(f);
-		
-		if (error == 1)
+		else if (fwrite(state, 1, state_len, f) != state_len)
 		{
-			return -2;
+			logline(LOG_ERROR, "Error: Checkpoint %s could not be written", tmpname);
+			fclose(f);
+			remove(tmpname);
+		}
+		else if (commit_file(f, tmpname, params->state) == 0)
+		{
+			ret = 0;
 		}
 	}
-	else
-	{	
-		/* File could not be opened */
-		return -3;
-	}
-	
-	return 0;
+	free(state);
+
+	pthread_mutex_lock(&queue->lock);
+	if (first && logged)
+		queue->results_logged = last;
+	if (ret == 0)
+		logline(LOG_DEBUG, "    Checkpoint written to %s", params->state);
+
+	return ret;
 }
 
+
 /*
- * Checks the input file if it contains valid ip addresses.
+ * Restores the queue from the checkpoint file and the hosts found from
+ * its results log. The words must have been loaded from the words file
+ * written along with it. Returns the number of hosts found before or -1
+ * if the checkpoint is damaged or belongs to other words.
  */
-int check_input_file_ip(void)
+int load_checkpoint(work_queue *queue)
 {
-	int error = 0;
+	char magic[32], type[4], host[512], ip[512];
+	char filename[4096];
+	expansion *exp, **last;
+	workitem item;
+	result *res;
 	FILE *f;
-	int ret = 0;
-	regex_t regex_ip;
-	char line[256];
+	int word_count, b, found = 0, damaged = 0;
 
-	/* Compile regex pattern */
-	if ((ret = regcomp(&regex_ip, "^[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}$", REG_EXTENDED)) != 0)
+	f = fopen(params->state, "r");
+	if (f == NULL)
+		return -1;
+	if ((fscanf(f, "%31s %d", magic, &word_count) != 2) ||
+		(strcmp(magic, CHECKPOINT_MAGIC) != 0) || (word_count != queue->word_count))
 	{
-		return -1;    
+		fclose(f);
+		return -1;
 	}
 
-	/* Check if every line in the input file is a valid host */
-	f = fopen(params->inputfile, "r");
-	if (f != NULL)
+	last = &queue->mutations;
+	while (!damaged && (fscanf(f, "%3s", type) == 1))
 	{
-		while ((fgets(line, 255, f) != NULL) && (error == 0))
+		exp = NULL;
+		damaged = 1;
+		if (strcmp(type, "E") == 0)
 		{
-			chomp(line);
-			ret = regexec(&regex_ip, line, 0, NULL, 0);
-			if (ret == 0)
-			{
-				logline(LOG_DEBUG, "    Work item %s is valid", line);
-			}
-			else if (ret == REG_NOMATCH)
+			exp = take_expansion(queue);
+			if ((exp == NULL) ||
+				(fscanf(f, "%d %ld %lu %d", &exp->depth, &exp->cursor, &exp->seq, &exp->base_count) != 4) ||
+				(exp->base_count < 1) || (exp->cursor < 0))
+				break;
+			exp->bases = (char **)calloc(exp->base_count, sizeof(char *));
+			for (b = 0; (b < exp->base_count) && (fscanf(f, "%511s", host) == 1); b++)
+				exp->bases[b] = strdup(host);
+			if (b < exp->base_count)
+				break;
+			if (params->reverse)
 			{
-				logline(LOG_DEBUG, "    Work item %s has an invalid format", line);
-				error = 1;
+				/* Reverse lookups use the words as they are, or the
+				 * addresses of the range given as the base */
+				free(exp->bases[0]);
+				free(exp->bases);
+				exp->bases = NULL;
+				if (strchr(host, '/'))
+				{
+					exp->range_size = parse_range(host, &exp->range_start);
+					if (exp->range_size == 0)
+						break;
+					set_single_base(exp, host);
+				}
 			}
-			else
-			{
-				logline(LOG_DEBUG, "    Work item %s has an unknown problem. Return code was: %d", line, ret);
-				error = 1;
-			}	
+			if (exp->cursor >= expansion_size(queue, exp))
+				break;
+			heap_push(queue, exp);
 		}
-	
-		regfree(&regex_ip);
+		else if (strcmp(type, "M") == 0)
+		{
+			exp = take_expansion(queue);
+			if (exp == NULL)
+				break;
+			exp->mut = &exp->mutation;
+			memset(exp->mut, 0, sizeof(mutator));
+			exp->base_count = 1;
+			if (fscanf(f, "%d %lu %d %d %63s %511s", &exp->depth, &exp->seq, &exp->mut->rule,
+				&exp->mut->index, exp->mut->seed, host) != 6)
+				break;
+			set_single_base(exp, host);
+			*last = exp;
+			last = &exp->next;
+		}
+		else if (strcmp(type, "P") == 0)
+		{
+			if (fscanf(f, "%d %d %d %d %511s", &item.depth, &item.label_len, &item.mutation,
+				&item.attempts, item.host) != 5)
+				break;
+			requeue_workitem(queue, &item);
+		}
+		else
+		{
+			break;
+		}
+
+		if (exp && (exp->seq >= queue->seq))
+			queue->seq = exp->seq + 1;
+		damaged = 0;
+	}
+	fclose(f);
+
+	/* The expansion being read is not part of the queue yet */
+	if (damaged)
+	{
+		if (exp)
+			free_expansion(exp);
+		return -1;
+	}
+
+	/* The log may hold hosts found after the checkpoint as well, they
+	 * are listed once at the end */
+	snprintf(filename, sizeof(filename), "%s.results", params->state);
+	f = fopen(filename, "r");
+	while (f && (fscanf(f, "%511s %511s", host, ip) == 2))
+	{
+		res = new_result(host, ip, NULL);
+		if (res == NULL)
+			break;
+		add_results(queue, res);
+		found++;
+
+		/* Hits joined and swapped by the mutations */
+		if (params->mutate && !params->reverse)
+			mutate_add_hit(host, strcspn(host, "."));
+	}
+	if (f)
 		fclose(f);
-		
-		if (error == 1)
+	queue->results_logged = queue->results_last;
+
+	return found;
+}
+
+
+/*
+ * Marks the run as interrupted. The workers stop taking names, and the
+ * hosts found so far are reported as usual.
+ */
+void handle_sigint(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+}
+
+
+/*
+ * Removes a thread from the queue when it fails, so the others do not
+ * wait for it. The names it held may have been queued again, so the
+ * idle threads only stop when nothing is left.
+ */
+void leave_queue(work_queue *queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->workers--;
+	if ((queue->workers > 0) && (queue->idle == queue->workers) &&
+		(queue->mutations == NULL) && (queue->heap_count == 0) &&
+		(queue->retry_count == 0))
+	{
+		queue->done = 1;
+	}
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+
+/*
+ * Snoops the caches of the resolvers for the words below the domain and
+ * reorders them: cached names and names sharing their stem come first,
+ * names with a cached NXDOMAIN last.
+ */
+void rank_words(char **words, double *weights, int count)
+{
+	char **hosts, **ranked;
+	double *reweighted;
+	char *servers[5];
+	unsigned char *states;
+	int *order;
+	int i, cached, neighbors;
+	int server_count = 0;
+
+	logline(LOG_INFO, "Snooping resolver caches...");
+
+	/* Only resolvers which honor the recursion desired bit tell the truth */
+	for (i = 0; i < get_servers_count(); i++)
+	{
+		if (snoop_check_server(params->servers[i], params->domain) == 0)
+			servers[server_count++] = params->servers[i];
+		else
+			logline(LOG_INFO, "    %s can not be snooped, skipping it.", params->servers[i]);
+	}
+	if (server_count == 0)
+	{
+		logline(LOG_INFO, "    None of the servers can be snooped. Keeping the input order.");
+		return;
+	}
+
+	hosts = (char **)calloc(count, sizeof(char *));
+	ranked = (char **)malloc(sizeof(char *) * count);
+	reweighted = (double *)malloc(sizeof(double) * count);
+	states = (unsigned char *)malloc(count);
+	order = (int *)malloc(sizeof(int) * count);
+	if ((hosts == NULL) || (ranked == NULL) || (reweighted == NULL) || (states == NULL) || (order == NULL))
+	{
+		logline(LOG_ERROR, "    Not enough memory for snooping. Keeping the input order.");
+		free(hosts);
+		free(ranked);
+		free(reweighted);
+		free(states);
+		free(order);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		hosts[i] = (char *)malloc(strlen(words[i]) + strlen(params->domain) + 2);
+		sprintf(hosts[i], "%s.%s", words[i], params->domain);
+	}
+
+	cached = snoop_cache(servers, server_count, hosts, count, states);
+	neighbors = (cached > 0) ? snoop_rank(hosts, states, count, order) : -1;
+	if (neighbors >= 0)
+	{
+		/* The ranking overrides the weights, which must not increase
+		 * along the word list */
+		for (i = 0; i < count; i++)
+		{
+			ranked[i] = words[order[i]];
+			reweighted[i] = count - i;
+		}
+		memcpy(words, ranked, sizeof(char *) * count);
+		memcpy(weights, reweighted, sizeof(double) * count);
+
+		logline(LOG_INFO, "    %d names cached, %d neighbors moved up.", cached, neighbors);
+	}
+	else
+	{
+		logline(LOG_INFO, "    No names cached. Keeping the input order.");
+	}
+
+	for (i = 0; i < count; i++)
+		free(hosts[i]);
+	free(hosts);
+	free(ranked);
+	free(reweighted);
+	free(states);
+	free(order);
+}
+
+
+/*
+ * Process work items until the queue runs dry. Names found by forward
+ * lookups are fed back into the queue until the recursion depth is
+ * reached, and their mutations are tried if enabled.
+ */
+void *proc_workitems(void *arg)
+{
+	int ret = 0;
+	workitem item;
+	result *found;
+
+	/* Cast input param to thread_params struct */
+	thread_params* t_params = (thread_params *)arg;
+	work_queue *queue = t_params->queue;
+
+	logline(LOG_DEBUG, "    Thread %d: Input params: reverse = %d, server = %s", t_params->thread_id, t_params->reverse, t_params->server);   
+
+	/* Pinned before the first query, so the socket and the buffers of
+	 * the thread come from the memory of its NUMA node */
+	if ((t_params->cpu >= 0) && (affinity_pin(pthread_self(), &t_params->cpu, 1) < 0))
+		logline(LOG_ERROR, "    Thread %d: Could not move to CPU %d", t_params->thread_id, t_params->cpu);
+
+	while (next_workitem(queue, t_params->thread_id - 1, &item, 1))
+	{
+		if (skip_workitem(queue, &item, t_params->thread_id))
+			continue;
+
+		logline(LOG_DEBUG, "    Thread %d: Processing workitem %s", t_params->thread_id, item.host);
+		trace_set_attempt(item.attempts);
+		found = NULL;
+		if (t_params->reverse)
+		{
+			ret = do_reverse_dns_lookup(t_params->server, item.host, &found);
+		}
+		else
+		{
+			ret = do_forward_dns_lookup(t_params->server, item.host, &found);
+		}
+		if (found)
 		{
-			return -2;
+			add_results(queue, found);
+		}
+
+		if (finish_workitem(queue, &item, ret, t_params->thread_id) < 0)
+		{
+			logline(LOG_ERROR, "    Thread %d: Out of resources, stopping. Error code: %d", t_params->thread_id, ret);
+			leave_queue(queue);
+			return THREAD_FAILED;
 		}
 	}
-	else
-	{ 
-		/* File could not be opened */
-		return -3;
+
+	return NULL;
+}
+
+
+/*
+ * Checks whether a name need not be queried: a mutation which is one
+ * of the words anyway, or a name generated before.
+ */
+int skip_workitem(work_queue *queue, workitem *item, int thread_id)
+{
+	int ret;
+
+	/* A mutation may be one of the words below a domain */
+	if (item->mutation && (item->depth == 1) && (item->attempts == 0))
+	{
+		item->host[item->label_len] = '\0';
+		ret = hashset_contains(queue->wordset, hashset_hash_name(item->host));
+		item->host[item->label_len] = '.';
+		if (ret)
+			return 1;
 	}
-	
+
+	/* The words and domains are unique, so only names generated
+	 * below hosts found and mutations can repeat. Tracking just
+	 * these keeps the set small even for huge cross products. */
+	if (((item->depth > 1) || item->mutation) && (item->attempts == 0) &&
+		(dedup_add(queue->seen, hashset_hash_name(item->host)) == 0))
+	{
+		logline(LOG_DEBUG, "    Thread %d: Skipping duplicate workitem %s", thread_id, item->host);
+		return 1;
+	}
+
 	return 0;
 }
 
 
 /*
- * Writes results to a file.
+ * Acts on the outcome of the lookup of a name: names which timed out
+ * are queued again, names whose query failed are skipped, hits are
+ * mutated and expanded. ret is the value returned by the lookup.
+ * Returns -1 if the thread ran out of resources and cannot go on, the
+ * name is queued again for the others then.
  */
-void write_results(result *results)
+int finish_workitem(work_queue *queue, workitem *item, int ret, int thread_id)
 {
-	FILE *f;
+	char *base;
 
-	f = fopen(params->outputfile, "w");
-	if (f != NULL)
+	if (ret < 0)
+	{
+		if ((ret == -2) && (++item->attempts < MAX_ATTEMPTS))
+		{
+			logline(LOG_DEBUG, "    Thread %d: DNS server temporarily not available. Retrying %s later", thread_id, item->host);
+			requeue_workitem(queue, item);
+			stats_retry();
+		}
+		else if (ret == -2)
+		{
+			logline(LOG_ERROR, "    Thread %d: DNS server temporarily not available. Skipping %s", thread_id, item->host);
+		}
+		else if (ret == -3)
+		{
+			requeue_workitem(queue, item);
+			return -1;
+		}
+		else
+		{
+			/* A bad reply or a name which cannot be encoded only
+			 * costs this name, not the thread */
+			logline(LOG_ERROR, "    Thread %d: Could not query %s. Error code: %d. Skipping", thread_id, item->host, ret);
+		}
+	}
+	else if ((ret > 0) && !params->reverse)
 	{
-		fprintf(f, "Host,IP\n");
+		/* Hits seed mutations of their own label */
+		if (params->mutate)
+		{
+			logline(LOG_DEBUG, "    Thread %d: Mutating %s", thread_id, item->host);
+			mutate_add_hit(item->host, item->label_len);
+			queue_mutations(queue, item->host, item->label_len, item->depth);
+		}
 
-		while (results)
+		/* Try the words one level below the name just found, unless
+		 * it is one of the domains and already being scanned */
+		if ((item->depth < params->depth) &&
+			!hashset_contains(queue->listed, hashset_hash_name(item->host)))
 		{
-			fprintf(f, "%s,%s\n", results->host, results->ip);
-			results = results->next;
+			logline(LOG_DEBUG, "    Thread %d: Expanding %s", thread_id, item->host);
+			base = item->host;
+			queue_expansion(queue, &base, 1, item->depth + 1);
 		}
+	}
 
-		fclose(f);
+	return 0;
+}
+
+/*
+ * Takes up to max names off the queue for a remote worker. Waits for
+ * the first one, but hands out what is there for the others. Returns
+ * the number of names, 0 once the work is done.
+ */
+int lease_workitems(work_queue *queue, workitem *lease, int max)
+{
+	int count = 0;
+
+	while ((count < max) && next_workitem(queue, -1, &lease[count], count == 0))
+	{
+		if (!skip_workitem(queue, &lease[count], 0))
+			count++;
 	}
+
+	return count;
 }
 
 
 /*
- * Load ip's/hosts in a linked list.
+ * Hands out the names of the queue to the remote workers connecting
+ * to the listen address, one thread serving each of them, until the
+ * work is done or the user pressed Ctrl-C. Returns -1 if the address
+ * cannot be listened on.
  */
-void load_workitems(char *inputfile, workitem **wi_start, int reverse)
+int serve_workers(work_queue *queue)
 {
-	FILE *f;
-	workitem *curr, *head;
-	char host[256];
-	char line[256];
-	int first = 1;
-
-	head = NULL;
+	struct pollfd pfd;
+	struct sigaction ignore;
+	sigset_t mask, old_mask;
+	session_params *session;
+	pthread_t *threads = NULL;
+	pthread_t *grown_threads;
+	int *fds = NULL;
+	int *grown_fds;
+	int count = 0;
+	int size = 0;
+	int listener, fd, done, i;
 
-	f = fopen(params->inputfile, "r");
-	if (f != NULL)
+	listener = net_listen(params->listen);
+	if (listener < 0)
 	{
-		while (fgets(line, 255, f) != NULL)
+		logline(LOG_ERROR, "Error: Could not listen for workers on %s.", params->listen);
+		return -1;
+	}
+	logline(LOG_INFO, "    Waiting for workers on %s...", params->listen);
+
+	/* A worker going away must not take the coordinator with it */
+	memset(&ignore, 0, sizeof(ignore));
+	ignore.sa_handler = SIG_IGN;
+	sigemptyset(&ignore.sa_mask);
+	sigaction(SIGPIPE, &ignore, NULL);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	pfd.fd = listener;
+	pfd.events = POLLIN;
+	while (1)
+	{
+		pthread_mutex_lock(&queue->lock);
+		if (interrupted && !queue->done)
 		{
-			memset(host, 0, sizeof(host));
-			chomp(line);
-			if (reverse)
-			{
-				strcpy(host, line);
-			}
-			else
-			{
-				strcat(host, line);
-				strcat(host, ".");
-				strcat(host, params->domain);
-			}
+			queue->interrupted = 1;
+			queue->done = 1;
+			pthread_cond_broadcast(&queue->cond);
+		}
+		done = queue->done;
+		pthread_mutex_unlock(&queue->lock);
+		if (done)
+			break;
 
-			curr = (workitem *)malloc(sizeof(workitem));  /* free memory! */
-			memset(curr, 0, sizeof(workitem));
-			curr->wi = (char *)malloc(strlen(host) + 1);
-			memset(curr->wi, 0, strlen(host) + 1);
-			strcpy(curr->wi, host);
+		/* Wake up every second to notice the end of the work */
+		if (poll(&pfd, 1, 1000) <= 0)
+			continue;
+		fd = accept(listener, NULL, NULL);
+		if (fd < 0)
+			continue;
 
-			curr->next = head;
-			head = curr;
+		if (count == size)
+		{
+			grown_threads = (pthread_t *)realloc(threads, (size + 16) * sizeof(pthread_t));
+			if (grown_threads)
+				threads = grown_threads;
+			grown_fds = (int *)realloc(fds, (size + 16) * sizeof(int));
+			if (grown_fds)
+				fds = grown_fds;
+			if ((grown_threads == NULL) || (grown_fds == NULL))
+			{
+				close(fd);
+				continue;
+			}
+			size += 16;
+		}
+		session = (session_params *)malloc(sizeof(session_params));
+		session->session_id = count + 1;
+		session->fd = fd;
+		session->queue = queue;
+
+		/* Sessions leave Ctrl-C to this thread, like the workers */
+		pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+		if (pthread_create(&threads[count], NULL, serve_session, session))
+		{
+			logline(LOG_ERROR, "    Worker %d: Could not be served", count + 1);
+			close(fd);
+			free(session);
+		}
+		else
+		{
+			fds[count++] = fd;
 		}
-		fclose(f);	
+		pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	}
+	close(listener);
+	if (strchr(params->listen, '/'))
+		unlink(params->listen);
 
-		*wi_start = head;
+	/* After Ctrl-C the workers are not waited for, the names they
+	 * were busy with are reported as unprocessed */
+	for (i = 0; i < count; i++)
+	{
+		if (queue->interrupted)
+			shutdown(fds[i], SHUT_RDWR);
 	}
-	else
+	for (i = 0; i < count; i++)
 	{
-		printf("Error: File %s could not be opened\n", inputfile);
-		exit -1;
+		pthread_join(threads[i], NULL);
+		close(fds[i]);
 	}
+	free(threads);
+	free(fds);
+
+	return 0;
 }
 
 
 /*
- * Distribute work items among threads.
+ * Serves a remote worker: hands out a lease of names each time it asks
+ * for work and takes the hosts it found and the outcome of each lookup.
+ * Names the worker does not report on, because it went away or stayed
+ * silent too long, are queued again for the others.
  */
-void dist_workitems(workitem **wi_list, workitem **wi_t1, workitem **wi_t2,
-		workitem **wi_t3, workitem **wi_t4, workitem **wi_t5)
+void *serve_session(void *arg)
 {
-	workitem *wi_t1_start, *wi_t2_start, *wi_t3_start, *wi_t4_start, *wi_t5_start;
-	int t1_first = 1, t2_first = 1, t3_first = 1, t4_first = 1, t5_first = 1;
-	int max_trays = 5, tray = 0;
-	int count = 0;
-
-	wi_t1_start = NULL;
-	wi_t2_start = NULL;
-	wi_t3_start = NULL;
-	wi_t4_start = NULL;
-	wi_t5_start = NULL;
-
-	while (*wi_list)
+	session_params *session = (session_params *)arg;
+	work_queue *queue = session->queue;
+	int id = session->session_id;
+	workitem lease[LEASE_SIZE];
+	int reported[LEASE_SIZE];
+	char line[1024];
+	char host[512];
+	char ip[64];
+	struct timeval timeout;
+	result *found;
+	FILE *in, *out;
+	int count, left, index, ret, i;
+
+	timeout.tv_sec = LEASE_TIMEOUT;
+	timeout.tv_usec = 0;
+	setsockopt(session->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	in = fdopen(dup(session->fd), "r");
+	out = fdopen(dup(session->fd), "w");
+	free(session);
+	if ((in == NULL) || (out == NULL))
 	{
-		/* Choose tray */
-		tray = count % max_trays;
+		logline(LOG_ERROR, "    Worker %d: Connection could not be set up", id);
+		if (in)
+			fclose(in);
+		if (out)
+			fclose(out);
+		return THREAD_FAILED;
+	}
 
-		logline(LOG_DEBUG, "    Assigning work item %s to thread %d", (*wi_list)->wi, tray);
+	pthread_mutex_lock(&queue->lock);
+	queue->workers++;
+	pthread_mutex_unlock(&queue->lock);
+	logline(LOG_INFO, "    Worker %d: Connected", id);
 
-		switch (tray)
+	while (fgets(line, sizeof(line), in) && (strcmp(line, "GET\n") == 0))
+	{
+		count = lease_workitems(queue, lease, LEASE_SIZE);
+		if (count == 0)
 		{
-			case 0:
-				if (t1_first)
-				{
-					*wi_t1 = *wi_list;
-					wi_t1_start = *wi_t1;
-					t1_first = 0;
-				}
-				else
-				{
-					(*wi_t1)->next = *wi_list;
-					*wi_t1 = *wi_list;
-				}
-				break;
-			
-			case 1:
-				if (t2_first)
-				{
-					*wi_t2 = *wi_list;
-					wi_t2_start = *wi_t2;
-					t2_first = 0;
-				}
-				else
-				{
-					(*wi_t2)->next = *wi_list;
-					*wi_t2 = *wi_list;
-				}
-				break;
-			
-			case 2:
-				if (t3_first)
-				{
-					*wi_t3 = *wi_list;
-					wi_t3_start = *wi_t3;
-					t3_first = 0;
-				}
-				else
-				{
-					(*wi_t3)->next = *wi_list;
-					*wi_t3 = *wi_list;
-				}
-				break;
+			fputs("DONE\n", out);
+			fflush(out);
+			break;
+		}
 
-			case 3:
-				if (t4_first)
-				{
-					*wi_t4 = *wi_list;
-					wi_t4_start = *wi_t4;
-					t4_first = 0;
-				}
-				else
-				{
-					(*wi_t4)->next = *wi_list;
-					*wi_t4 = *wi_list;
-				}
-				break;
+		fprintf(out, "LEASE %d %d\n", count, params->reverse);
+		for (i = 0; i < count; i++)
+		{
+			fprintf(out, "%s\n", lease[i].host);
+			reported[i] = 0;
+		}
+		fflush(out);
 
-			case 4:
-				if (t5_first)
-				{
-					*wi_t5 = *wi_list;
-					wi_t5_start = *wi_t5;
-					t5_first = 0;
-				}
-				else
-				{
-					(*wi_t5)->next = *wi_list;
-					*wi_t5 = *wi_list;
-				}
+		/* The hosts found for a name come before its outcome */
+		left = count;
+		while ((left > 0) && fgets(line, sizeof(line), in))
+		{
+			if (sscanf(line, "A %511s %63s", host, ip) == 2)
+			{
+				found = new_result(host, ip, NULL);
+				found->next = NULL;
+				add_results(queue, found);
+			}
+			else if ((sscanf(line, "R %d %d", &index, &ret) == 2) &&
+				(index >= 0) && (index < count) && !reported[index])
+			{
+				reported[index] = 1;
+				left--;
+				if (finish_workitem(queue, &lease[index], ret, id) < 0)
+					logline(LOG_ERROR, "    Worker %d: Out of resources for %s, queueing it again", id, lease[index].host);
+			}
+			else
+			{
 				break;
+			}
 		}
 
-		/* Load next item in list */
-		*wi_list = (*wi_list)->next;
-		count++;
+		if (left > 0)
+		{
+			/* Counted as a timeout, so a name which keeps killing
+			 * workers is given up after a few attempts */
+			logline(LOG_ERROR, "    Worker %d: Lost with %d names unreported, queueing them again", id, left);
+			for (i = 0; i < count; i++)
+			{
+				if (!reported[i])
+					finish_workitem(queue, &lease[i], -2, id);
+			}
+			break;
+		}
 	}
 
-	/* Terminate linked lists */
-	if (*wi_t1 != NULL) { (*wi_t1)->next = NULL; }
-	if (*wi_t2 != NULL) { (*wi_t2)->next = NULL; }
-	if (*wi_t3 != NULL) { (*wi_t3)->next = NULL; }
-	if (*wi_t4 != NULL) { (*wi_t4)->next = NULL; }
-	if (*wi_t5 != NULL) { (*wi_t5)->next = NULL; }
+	fclose(in);
+	fclose(out);
+	leave_queue(queue);
+	logline(LOG_INFO, "    Worker %d: Disconnected", id);
 
-	/* Return pointers to start of lists */
-	*wi_t1 = wi_t1_start;
-	*wi_t2 = wi_t2_start;
-	*wi_t3 = wi_t3_start;
-	*wi_t4 = wi_t4_start;
-	*wi_t5 = wi_t5_start;
+	return NULL;
 }
 
 
 /*
- * Counts work items in list.
+ * Works for the coordinator given with -w. Each thread connects on its
+ * own and queries the names leased to it with the servers given with
+ * -s. The hosts found are reported to the coordinator only.
  */
-int count_workitems(workitem *wi_list)
+int run_worker(void)
 {
-	int count = 0;
+	thread_params t_params[WORKER_THREADS];
+	pthread_t threads[WORKER_THREADS];
+	struct sigaction ignore;
+	void *status;
+	int i, started;
+	int failed = 0;
 
-	while (wi_list)
+	logline(LOG_INFO, "Run configuration:");
+	logline(LOG_INFO, "    Using DNS servers:");
+	for (i = 0; params->servers[i] != NULL; i++)
+		logline(LOG_INFO, "        %s", params->servers[i]);
+	logline(LOG_INFO, "    Coordinator       : %s", params->worker);
+	if (params->trace)
+		logline(LOG_INFO, "    Query trace       : %s", params->trace);
+	if (params->metrics)
+		logline(LOG_INFO, "    Metrics served on : %s", params->metrics);
+	if (params->cpu_count)
+		log_cpus();
+	if (params->progress == 0)
+		logline(LOG_INFO, "    Progress          : Disabled");
+	else if (params->progress != PROGRESS_INTERVAL)
+		logline(LOG_INFO, "    Progress          : Every %d seconds", params->progress);
+	if (params->port != 53)
+		logline(LOG_INFO, "    Using port        : %d", params->port);
+	if (params->cache)
+		logline(LOG_INFO, "    Answer cache      : %s", params->cache);
+
+	if (wildcard_init() < 0)
 	{
-		count++;
-		wi_list = wi_list->next;
+		logline(LOG_ERROR, "Error: Could not allocate wildcard zone table.");
+		return -1;
+	}
+	if (params->cache && (cache_open(params->cache) < 0))
+	{
+		logline(LOG_ERROR, "Error: %s is not a valid cache file.", params->cache);
+		wildcard_free();
+		return -1;
 	}
 
-	return count;
-}
+	/* A coordinator going away must not kill the worker */
+	memset(&ignore, 0, sizeof(ignore));
+	ignore.sa_handler = SIG_IGN;
+	sigemptyset(&ignore.sa_mask);
+	sigaction(SIGPIPE, &ignore, NULL);
 
+	if (params->cpu_count && (affinity_pin(pthread_self(), params->cpus, 1) < 0))
+	{
+		logline(LOG_ERROR, "    Could not move to CPU %d", params->cpus[0]);
+	}
+	if (stats_start(params->progress) < 0)
+	{
+		logline(LOG_ERROR, "    Progress thread could not be created");
+	}
 
-/*
- * Process a list of work items.
- */
-void *proc_workitems(void *arg)
-{
-	int ret = 0;
-	workitem *wi_list;
+	/* Start worker threads */
+	for (started = 0; started < WORKER_THREADS; started++)
+	{
+		t_params[started].thread_id = started + 1;
+		t_params[started].queue = NULL;
+		t_params[started].reverse = 0;
+		t_params[started].server = get_random_server();
+		t_params[started].cpu = params->cpu_count ? params->cpus[(started + 1) % params->cpu_count] : -1;
+		if (pthread_create(&threads[started], NULL, work_remote, &t_params[started]))
+		{
+			logline(LOG_ERROR, "    Thread %d: Could not be created", started + 1);
+			break;
+		}
+	}
 
-	/* Cast input param to thread_params struct */
-	thread_params* t_params = (thread_params *)arg;
+	/* Wait for threads to finish */
+	for (i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], &status);
+		if (status == THREAD_FAILED)
+			failed++;
+	}
+	stats_stop();
+	stats_report();
+
+	if (params->cache)
+	{
+		logline(LOG_INFO, "%u lookups answered from cache.", cache_hits());
+		if (cache_close() < 0)
+			logline(LOG_ERROR, "Error: Cache file %s could not be written.", params->cache);
+	}
+	wildcard_free();
 
-	wi_list = t_params->wi_list;
+	return (failed == started) ? -1 : 0;
+}
 
-	logline(LOG_DEBUG, "    Thread %d: Input params: reverse = %d, server = %s", t_params->thread_id, t_params->reverse, t_params->server);   
 
-	while (wi_list)
+/*
+ * Thread of a remote worker. Asks the coordinator for names until it
+ * has no more, and reports the hosts found and the outcome of each
+ * lookup as soon as it is known.
+ */
+void *work_remote(void *arg)
+{
+	thread_params *t_params = (thread_params *)arg;
+	char hosts[LEASE_SIZE][512];
+	char line[1024];
+	result *found, *r;
+	FILE *in, *out;
+	int fd, count, ret, i;
+	int looked_up = 0;
+	int hits = 0;
+
+	if ((t_params->cpu >= 0) && (affinity_pin(pthread_self(), &t_params->cpu, 1) < 0))
+		logline(LOG_ERROR, "    Thread %d: Could not move to CPU %d", t_params->thread_id, t_params->cpu);
+
+	fd = net_connect(params->worker);
+	if (fd < 0)
 	{
-		logline(LOG_DEBUG, "    Thread %d: Processing workitem %s", t_params->thread_id, wi_list->wi);
-		if (t_params->reverse)
-		{
-			ret = do_reverse_dns_lookup(t_params->server, wi_list->wi, &(t_params->result_list));
-		}
+		logline(LOG_ERROR, "    Thread %d: Could not connect to coordinator %s", t_params->thread_id, params->worker);
+		return THREAD_FAILED;
+	}
+	in = fdopen(fd, "r");
+	out = fdopen(dup(fd), "w");
+	if ((in == NULL) || (out == NULL))
+	{
+		if (in)
+			fclose(in);
 		else
+			close(fd);
+		if (out)
+			fclose(out);
+		return THREAD_FAILED;
+	}
+
+	while (1)
+	{
+		fputs("GET\n", out);
+		fflush(out);
+		if ((fgets(line, sizeof(line), in) == NULL) ||
+			(sscanf(line, "LEASE %d %d", &count, &t_params->reverse) != 2) ||
+			(count < 1) || (count > LEASE_SIZE))
+			break;
+		for (i = 0; (i < count) && fgets(hosts[i], sizeof(hosts[i]), in); i++)
+			chomp(hosts[i]);
+		if (i < count)
+			break;
+
+		for (i = 0; i < count; i++)
 		{
-			ret = do_forward_dns_lookup(t_params->server, wi_list->wi, &(t_params->result_list));
-		}
-		
-		if (ret < 0)
-		{
-			if (ret == -2)
-			{
-				logline(LOG_ERROR, "    Thread %d: DNS server temporarily not available. Skipping %s", t_params->thread_id, wi_list->wi);
-			}
+			found = NULL;
+			if (t_params->reverse)
+				ret = do_reverse_dns_lookup(t_params->server, hosts[i], &found);
 			else
+				ret = do_forward_dns_lookup(t_params->server, hosts[i], &found);
+			for (r = found; r; r = r->next)
 			{
-				logline(LOG_ERROR, "    Thread %d: Error querying DNS server. Error code: %d", t_params->thread_id, ret);
-				pthread_exit(&ret);
+				fprintf(out, "A %s %s\n", r->host, r->ip);
+				hits++;
 			}
+			fprintf(out, "R %d %d\n", i, ret);
+			fflush(out);
+			looked_up++;
 		}
-
-		wi_list = wi_list->next;
 	}
+
+	fclose(in);
+	fclose(out);
+	logline(LOG_INFO, "    Thread %d: %d names looked up, %d hosts found", t_params->thread_id, looked_up, hits);
+
+	return NULL;
 }
 
 
+
 /*
- * Perform a forward DNS lookup
+ * Perform a forward DNS lookup. Returns the number of addresses found,
+ * -2 if the server did not answer in time, -3 if there was no socket
+ * or memory left for the lookup and -1 on any other error.
  */
 int do_forward_dns_lookup(char *server, char *host, result **result_list)
 {
@@ -1024,43 +3835,67 @@ int do_forward_dns_lookup(char *server, char *host, result **result_list)
 	result *list_entry = NULL;
 	result *list_start = NULL;
 	int ret = 0;
+	int found = 0;
 	int i;
-	char *ip_addr[20];
-
-	/* Initialize array of ip adresses */
-	for (i = 0; i < 20; i++) { ip_addr[i] = NULL; }
+	int server_class;
+	char *resolver;
+	struct DNS_REPLY reply;
 
-	ret = dns_query_a_record(server, host, ip_addr);
+	server_class = params->authoritative ? CACHE_AUTHORITATIVE : CACHE_RESOLVER;
+	if (params->authoritative)
+	{
+		/* Ask the zone's name servers directly, server is only
+		 * needed to resolve name servers lacking glue records */
+		resolver = server;
+		server = get_ns_server();
+		if (!cache_lookup(host, DNS_RES_REC_A, server_class, &reply))
+		{
+			ret = dns_query_authoritative(server, params->domain, host, DNS_RES_REC_A, resolver, &reply);
+			if (ret == 0)
+				cache_store(host, DNS_RES_REC_A, server_class, &reply);
+		}
+	}
+	else if (!cache_lookup(host, DNS_RES_REC_A, server_class, &reply))
+	{
+		ret = dns_query(server, host, DNS_RES_REC_A, 0, &reply);
+		if (ret == 0)
+			cache_store(host, DNS_RES_REC_A, server_class, &reply);
+	}
 	if (ret != 0)
 	{
 		if (ret == -4)
 		{
 			return -2;
 		}
+		else if (ret == -3)
+		{
+			return -3;
+		}
 		else
 		{
-			//logline(LOG_INFO, "ERRORCODE dns_query_ptr_record was: %d", ret);
 			return -1;
 		}
 	}	
-	//if (ret != 0)
-	//{
-	//	return -1;
-	//}
+
+	/* Drop answers synthesized by a wildcard record */
+	if (wildcard_check(server, host, &reply))
+	{
+		logline(LOG_DEBUG, "    Host %s matches wildcard fingerprint. Skipping", host);
+		return 0;
+	}
 
 	/* Add found ips to a local linked list */
-	for (i = 0; i < 20; i++)
+	for (i = 0; i < reply.ans_count; i++)
 	{
-		/* Exit loop as soon as an empty entry appears */
-		if (ip_addr[i] == NULL) { break; }
+		/* Only address records are of interest */
+		if (reply.answers[i].type != DNS_RES_REC_A) { continue; }
 
 		/* Add new entry to list */
-		list_entry = (result *)malloc(sizeof(result));
-		list_entry->host = (char *)malloc(strlen(host));
-		list_entry->ip = (char *)malloc(strlen(ip_addr[i]));
-		strcpy(list_entry->host, host);
-		strcpy(list_entry->ip, ip_addr[i]);
+		list_entry = new_result(host, reply.answers[i].data, NULL);
+		if (list_entry == NULL)
+			return -3;
 		list_entry->next = NULL;
+		found++;
 		if (list_head == NULL)
 		{
 			list_head = list_entry;
@@ -1071,39 +3906,43 @@ int do_forward_dns_lookup(char *server, char *host, result **result_list)
 			list_head->next = list_entry;
 			list_head = list_head->next;
 		}
+	}
+
+	/* Nothing to attach if no address records were returned */
+	if (list_start == NULL) { return 0; }
 
-		/* Attach local linked list to existing list of results */
-		if (*result_list == NULL)
+	/* Attach local linked list to existing list of results */
+	if (*result_list == NULL)
+	{
+		/* This is the first entry in the list, therefore it is ok
+		 * that this remains the start address of the list
+		 */
+		*result_list = list_start;
+	}
+	else
+	{
+		/* Iterate through end of list and attach */
+		while ((*result_list)->next)
 		{
-			/* This is the first entry in the list, therefore it is ok
-			 * that this remains the start address of the list
-			 */
-			*result_list = list_start;
+			*result_list = (*result_list)->next;
 		}
-		else
-		{
-			/* Iterate through end of list and attach */
-			while ((*result_list)->next)
-			{
-				*result_list = (*result_list)->next;
-			}
 
-			/* Attach newly generated linked list to the end of
-			 * master linked list
-			 */
-			(*result_list)->next = list_start;
+		/* Attach newly generated linked list to the end of
+		 * master linked list
+		 */
+		(*result_list)->next = list_start;
 
-			/* Restore beginning of list pointer */
-			*result_list = list_orig_startaddr;
-		}
+		/* Restore beginning of list pointer */
+		*result_list = list_orig_startaddr;
 	}
 	
-	return 0;
+	return found;
 }
 
 
 /*
- * Perform a reverse dns lookup
+ * Perform a reverse dns lookup. Errors are returned as by
+ * do_forward_dns_lookup.
  */
 int do_reverse_dns_lookup(char *server, char *ip, result **result_list)
 {
@@ -1112,25 +3951,45 @@ int do_reverse_dns_lookup(char *server, char *ip, result **result_list)
 	result *list_entry = NULL;
 	result *list_start = NULL;
 	int i = 0;
+	int j = 0;
 	int ret = 0;
 	char *domains[20];
+	char ip_inaddr_arpa[256];
+	struct DNS_REPLY reply;
 
 	/* Initialize array of domains */
 	for (i = 0; i < 20; i++) { domains[i] = NULL; }
 
-	ret = dns_query_ptr_record(server, ip, domains);
+	/* Same query as dns_query_ptr_record, but the reply is cached */
+	if (prep_inaddr_arpa(ip_inaddr_arpa, ip) < 0)
+		return -1;
+	if (!cache_lookup(ip_inaddr_arpa, DNS_RES_REC_PTR, CACHE_RESOLVER, &reply))
+	{
+		ret = dns_query(server, ip_inaddr_arpa, DNS_RES_REC_PTR, 0, &reply);
+		if (ret == 0)
+			cache_store(ip_inaddr_arpa, DNS_RES_REC_PTR, CACHE_RESOLVER, &reply);
+	}
 	if (ret != 0)
 	{
 		if (ret == -4)
 		{
 			return -2;
 		}
+		else if (ret == -3)
+		{
+			return -3;
+		}
 		else
 		{
 			//logline(LOG_INFO, "ERRORCODE dns_query_ptr_record was: %d", ret);
 			return -1;
 		}
 	}
+	for (i = 0; (i < reply.ans_count) && (j < 20); i++)
+	{
+		if (reply.answers[i].type == DNS_RES_REC_PTR)
+			domains[j++] = reply.answers[i].data;
+	}
 
 	/* Add found domains to a local linked list */
 	for (i = 0; i < 20; i++)
@@ -1139,11 +3998,9 @@ int do_reverse_dns_lookup(char *server, char *ip, result **result_list)
 		if (domains[i] == NULL) { break; }
 
 		/* Add new entry to list */	
-		list_entry = (result *)malloc(sizeof(result));
-		list_entry->host = (char *)malloc(strlen(domains[i]));
-		list_entry->ip = (char *)malloc(strlen(ip));
-		strcpy(list_entry->host, domains[i]);
-		strcpy(list_entry->ip, ip);
+		list_entry = new_result(domains[i], ip, NULL);
+		if (list_entry == NULL)
+			return -3;
 		list_entry->next = NULL;
 		if (list_head == NULL)
 		{
@@ -1203,6 +4060,24 @@ int get_servers_count(void)
 }
 
 
+/*
+ * Logs the CPUs the threads are placed on. The first one runs the
+ * thread feeding the workers, the workers take the others in turn.
+ */
+void log_cpus(void)
+{
+	char list[256];
+	int i, len = 0;
+
+	list[0] = '\0';
+	for (i = 0; (i < params->cpu_count) && (len < (int)sizeof(list) - 16); i++)
+		len += snprintf(list + len, sizeof(list) - len, "%s%d", i ? "," : "", params->cpus[i]);
+	if (i < params->cpu_count)
+		snprintf(list + len, sizeof(list) - len, ",...");
+	logline(LOG_INFO, "    CPUs              : %s (%s)", list, params->cpu_spec);
+}
+
+
 /*
  * Choose a random server out of server array.
  */
@@ -1253,6 +4128,8 @@ void display_help_page(void)
 	printf("--domain=<mydomain>, -d <mydomain>         Specify the domain to be queried. Only\n");
 	printf("                                           used when doing forward DNS lookups\n");
 	printf("                                           (e.g. -d foo.org).\n");
+	printf("                                           <mydomain> may also name a file\n");
+	printf("                                           listing one domain per line.\n");
 	printf("--inputfile=<inputfile>, -i <inputfile>    The file containing either a list of\n");
 	printf("                                           ip addresses or host names, depending\n");
 	printf("                                           on the lookup mode (reverse, forward).\n");
@@ -1265,6 +4142,60 @@ void display_help_page(void)
 	printf("                                             1 = ERROR (Log errors only)\n");
 	printf("                                             2 = INFO (Log additional information)\n");
 	printf("                                             3 = DEBUG (Log debug level information)\n");
+	printf("--nsec, -n                                 Enumerate the domain by walking its\n");
+	printf("                                           NSEC chain. No input file is needed.\n");
+	printf("--nsec3, -N                                Collect the NSEC3 hashes of the domain\n");
+	printf("                                           and match the input file against them\n");
+	printf("                                           offline.\n");
+	printf("--authoritative, -a                        Send forward DNS lookups directly to the\n");
+	printf("                                           domain's name servers with recursion\n");
+	printf("                                           disabled. The servers given with -s\n");
+	printf("                                           are only used to find them.\n");
+	printf("--snoop, -c                                Ask the servers without recursion which\n");
+	printf("                                           names they have cached and look these\n");
+	printf("                                           names and their neighbors up first.\n");
+	printf("--mutate, -m                               Try numbered, affixed, joined and\n");
+	printf("                                           swapped variants of every host found.\n");
+	printf("--time-budget=<secs>, -T <secs>            Stop after <secs> seconds and report\n");
+	printf("                                           the work left.\n");
+	printf("--history=<file>, -H <file>                Try words found in past scans first\n");
+	printf("                                           and add the hosts found to <file>.\n");
+	printf("--dedup-memory=<MiB>, -D <MiB>             Memory for dropping duplicate names\n");
+	printf("                                           exactly (default 64).\n");
+	printf("--cache=<file>, -C <file>                  Answer lookups from <file> while the\n");
+	printf("                                           answers are valid, and add new ones.\n");
+	printf("--checkpoint=<file>, -k <file>             Save the progress of the scan to <file>\n");
+	printf("                                           every 30 seconds and on Ctrl-C.\n");
+	printf("--resume=<file>, -K <file>                 Continue the scan saved in <file>.\n");
+	printf("--shard=<i/N>, -S <i/N>                    Only do the i-th of N parts of the\n");
+	printf("                                           scan, e.g. on N machines.\n");
+	printf("--merge <files>, -M <files>                Merge the output files of shards into\n");
+	printf("                                           the file given with -o.\n");
+	printf("--listen=<address>, -L <address>           Hand out the names to workers\n");
+	printf("                                           connecting to <port>, <host:port>\n");
+	printf("                                           or a UNIX socket path.\n");
+	printf("--worker=<address>, -w <address>           Query the names handed out by the\n");
+	printf("                                           coordinator at <address>.\n");
+	printf("--trace=<file>, -t <file>                  Record every query in <file>, see\n");
+	printf("                                           dnstrace.\n");
+	printf("--progress=<seconds>, -P <seconds>         Log the query rates and latencies\n");
+	printf("                                           every <seconds>, 0 for never.\n");
+	printf("                                           Defaults to 10.\n");
+	printf("--metrics=<address>, -e <address>          Serve metrics for Prometheus on\n");
+	printf("                                           <port>, <host:port> or a UNIX\n");
+	printf("                                           socket path.\n");
+	printf("--cpus=<list>, -A <list>                   Run on the CPUs in <list>, e.g. 0-3,8,\n");
+	printf("                                           the %d worker threads taking them in\n", WORKER_THREADS);
+	printf("                                           turn, or \"auto\" to choose them by\n");
+	printf("                                           the topology.\n");
+	printf("--recursive=<depth>, -R <depth>            Also try the input file below every\n");
+	printf("                                           name found, down to <depth> levels\n");
+	printf("                                           below the domain. Defaults to 1.\n");
+	printf("--port=<port>, -p <port>                   Port the DNS servers listen on.\n");
+	printf("                                           Defaults to 53.\n");
+	printf("--noaxfr, -x                               Do not try a zone transfer from the\n");
+	printf("                                           domain's name servers before doing\n");
+	printf("                                           forward DNS lookups.\n");
 	printf("--version, -v                              Displays version information.\n");
 	printf("--help, -h                                 Displays this help page.\n");
 	printf("\n");
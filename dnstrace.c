@@ -0,0 +1,319 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+/*
+ * dnstrace - summarizes the query trace written by dnsninja --trace:
+ * latency distribution, loss per server and throughput over time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "trace.h"
+
+/* Latencies are counted in buckets of 1/16 of a power of two, so
+ * percentiles are accurate to about 6% */
+#define SUB_BUCKETS  16
+#define BUCKETS      (29 * SUB_BUCKETS)
+
+/* Queries sent to one server */
+typedef struct
+{
+	unsigned int addr;             // network byte order, 0 if undefined
+	unsigned long queries;
+	unsigned long timeouts;
+	unsigned long failed;
+	unsigned long latency[BUCKETS];
+} server_stats;
+
+/* Queries sent during one interval of the run */
+typedef struct
+{
+	unsigned long sent;
+	unsigned long answered;
+	unsigned long timeouts;
+} interval_stats;
+
+
+/*
+ * Returns the bucket counting a latency of us microseconds.
+ */
+static int bucket_of(unsigned int us)
+{
+	int shift;
+
+	if (us < SUB_BUCKETS)
+		return us;
+	shift = 31 - __builtin_clz(us) - 4;
+
+	return (shift + 1) * SUB_BUCKETS + ((us >> shift) & (SUB_BUCKETS - 1));
+}
+
+
+/*
+ * Returns the smallest latency counted in a bucket.
+ */
+static unsigned long bucket_value(int bucket)
+{
+	int shift;
+
+	if (bucket < SUB_BUCKETS)
+		return bucket;
+	shift = bucket / SUB_BUCKETS - 1;
+
+	return (unsigned long)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+}
+
+
+/*
+ * Returns the latency below which a fraction p of the counted
+ * latencies lie, in milliseconds.
+ */
+static double percentile(unsigned long *hist, unsigned long total, double p)
+{
+	unsigned long rank = (unsigned long)(p * total + 0.999999);
+	unsigned long seen = 0;
+	int i;
+
+	if (rank == 0)
+		rank = 1;
+	for (i = 0; i < BUCKETS; i++)
+	{
+		seen += hist[i];
+		if (seen >= rank)
+			return bucket_value(i) / 1000.0;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Displays the usage of the tool.
+ */
+static void usage(const char *name)
+{
+	printf("Usage: %s [-i <seconds>] <tracefile>\n\n", name);
+	printf("Summarizes a trace written by dnsninja --trace.\n\n");
+	printf("-i <seconds>    Length of the intervals throughput is shown for.\n");
+	printf("                Defaults to 10.\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+	trace_header header;
+	trace_record rec;
+	server_stats *servers;
+	interval_stats *intervals = NULL;
+	interval_stats *grown;
+	unsigned long latency[BUCKETS];
+	unsigned long rcodes[16];
+	unsigned long queries = 0;
+	unsigned long answered = 0;
+	unsigned long timeouts = 0;
+	unsigned long failed = 0;
+	unsigned long retries = 0;
+	unsigned long long bytes = 0;
+	unsigned long long first = 0;
+	unsigned long long last = 0;
+	unsigned long long slot;
+	unsigned int max_size = 0;
+	long interval_count = 0;
+	int interval = 10;
+	int server_count = 0;
+	double seconds;
+	struct in_addr addr;
+	char timestr[32];
+	time_t started;
+	FILE *f;
+	long i;
+	int c;
+
+	while ((c = getopt(argc, argv, "i:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'i':
+				interval = atoi(optarg);
+				if (interval < 1)
+				{
+					fprintf(stderr, "Error: Invalid interval %s.\n", optarg);
+					return -1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return (c == 'h') ? 0 : -1;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return -1;
+	}
+
+	f = fopen(argv[optind], "rb");
+	if (f == NULL)
+	{
+		fprintf(stderr, "Error: %s could not be opened.\n", argv[optind]);
+		return -1;
+	}
+	if ((fread(&header, sizeof(header), 1, f) != 1) ||
+		(memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0))
+	{
+		fprintf(stderr, "Error: %s is not a dnsninja trace.\n", argv[optind]);
+		fclose(f);
+		return -1;
+	}
+
+	servers = (server_stats *)calloc(TRACE_MAX_SERVERS, sizeof(server_stats));
+	if (servers == NULL)
+	{
+		fprintf(stderr, "Error: Out of memory.\n");
+		fclose(f);
+		return -1;
+	}
+	memset(latency, 0, sizeof(latency));
+	memset(rcodes, 0, sizeof(rcodes));
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1)
+	{
+		if (rec.kind == TRACE_SERVER)
+		{
+			servers[rec.server].addr = rec.latency;
+			if (rec.server >= server_count)
+				server_count = rec.server + 1;
+			continue;
+		}
+		if (rec.server >= server_count)
+			server_count = rec.server + 1;
+
+		queries++;
+		servers[rec.server].queries++;
+		if (rec.attempt > 0)
+			retries++;
+		if ((first == 0) || (rec.sent < first))
+			first = rec.sent;
+		if (rec.sent + rec.latency > last)
+			last = rec.sent + rec.latency;
+
+		/* Records are written per thread, so they are not in order */
+		slot = (rec.sent > header.started) ? (rec.sent - header.started) / 1000000 / interval : 0;
+		if ((long)slot >= interval_count)
+		{
+			grown = (interval_stats *)realloc(intervals, (slot + 1) * sizeof(interval_stats));
+			if (grown == NULL)
+			{
+				fprintf(stderr, "Error: Out of memory.\n");
+				break;
+			}
+			intervals = grown;
+			memset(intervals + interval_count, 0, (slot + 1 - interval_count) * sizeof(interval_stats));
+			interval_count = slot + 1;
+		}
+		intervals[slot].sent++;
+
+		switch (rec.kind)
+		{
+			case TRACE_ANSWERED:
+				answered++;
+				intervals[slot].answered++;
+				rcodes[rec.rcode & 15]++;
+				latency[bucket_of(rec.latency)]++;
+				servers[rec.server].latency[bucket_of(rec.latency)]++;
+				bytes += rec.size;
+				if (rec.size > max_size)
+					max_size = rec.size;
+				break;
+			case TRACE_TIMEOUT:
+				timeouts++;
+				intervals[slot].timeouts++;
+				servers[rec.server].timeouts++;
+				break;
+			default:
+				failed++;
+				servers[rec.server].failed++;
+		}
+	}
+	fclose(f);
+
+	started = header.started / 1000000;
+	strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", localtime(&started));
+	seconds = (last > first) ? (last - first) / 1000000.0 : 0;
+	printf("Trace of the run started %s\n\n", timestr);
+	printf("Queries          : %lu in %.1f seconds (%.0f per second)\n", queries, seconds,
+		(seconds > 0) ? queries / seconds : 0);
+	if (queries == 0)
+	{
+		free(servers);
+		free(intervals);
+		return 0;
+	}
+	printf("Answered         : %lu (%.2f%%)\n", answered, 100.0 * answered / queries);
+	printf("Timed out        : %lu (%.2f%%)\n", timeouts, 100.0 * timeouts / queries);
+	printf("Failed           : %lu (%.2f%%)\n", failed, 100.0 * failed / queries);
+	printf("Retries          : %lu\n", retries);
+	if (answered > 0)
+	{
+		printf("Reply size       : %.0f bytes average, %u at most\n", (double)bytes / answered, max_size);
+		printf("Response codes   :");
+		for (i = 0; i < 16; i++)
+		{
+			if (rcodes[i] > 0)
+				printf(" %s=%lu", (i == 0) ? "NOERROR" : (i == 2) ? "SERVFAIL" : (i == 3) ? "NXDOMAIN" : "other", rcodes[i]);
+		}
+		printf("\n\nLatency of answered queries (ms):\n");
+		printf("    min %.2f  p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n",
+			percentile(latency, answered, 0), percentile(latency, answered, 0.5),
+			percentile(latency, answered, 0.9), percentile(latency, answered, 0.99),
+			percentile(latency, answered, 0.999), percentile(latency, answered, 1.0));
+	}
+
+	printf("\nServers:\n");
+	printf("    %-16s %10s %10s %8s %10s %10s\n", "Address", "Queries", "Timeouts", "Loss", "p50 (ms)", "p99 (ms)");
+	for (i = 0; i < server_count; i++)
+	{
+		if (servers[i].queries == 0)
+			continue;
+		addr.s_addr = servers[i].addr;
+		answered = servers[i].queries - servers[i].timeouts - servers[i].failed;
+		printf("    %-16s %10lu %10lu %7.2f%% %10.2f %10.2f\n", inet_ntoa(addr),
+			servers[i].queries, servers[i].timeouts,
+			100.0 * (servers[i].timeouts + servers[i].failed) / servers[i].queries,
+			answered ? percentile(servers[i].latency, answered, 0.5) : 0,
+			answered ? percentile(servers[i].latency, answered, 0.99) : 0);
+	}
+
+	printf("\nThroughput per %d seconds:\n", interval);
+	printf("    %-8s %10s %10s %10s %10s\n", "Second", "Sent", "Per sec", "Answered", "Timeouts");
+	for (i = 0; i < interval_count; i++)
+	{
+		printf("    %-8ld %10lu %10.0f %10lu %10lu\n", i * interval, intervals[i].sent,
+			(double)intervals[i].sent / interval, intervals[i].answered, intervals[i].timeouts);
+	}
+
+	free(servers);
+	free(intervals);
+
+	return 0;
+}
@@ -0,0 +1,226 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "hashset.h"
+
+
+/*
+ * Creates a set with room for at least size hashes. Returns NULL if
+ * there is not enough memory.
+ */
+hashset *hashset_create(unsigned int size)
+{
+	hashset *set;
+	unsigned int slots = 64;
+
+	while (slots < size * 2)
+		slots *= 2;
+
+	set = (hashset *)malloc(sizeof(hashset));
+	if (set == NULL)
+		return NULL;
+
+	set->slots = (unsigned long long *)calloc(slots, sizeof(unsigned long long));
+	if (set->slots == NULL)
+	{
+		free(set);
+		return NULL;
+	}
+	set->size = slots;
+	set->used = 0;
+	pthread_rwlock_init(&set->lock, NULL);
+
+	return set;
+}
+
+
+/*
+ * Index of the first slot probed for a hash.
+ */
+static unsigned int first_slot(hashset *set, unsigned long long hash)
+{
+	return (unsigned int)(hash ^ (hash >> 32)) & (set->size - 1);
+}
+
+
+/*
+ * Doubles the number of slots. Must be called with the write lock held.
+ * Returns -1 if there is not enough memory.
+ */
+static int grow(hashset *set)
+{
+	unsigned long long *old = set->slots;
+	unsigned int old_size = set->size;
+	unsigned int i, j;
+
+	set->slots = (unsigned long long *)calloc(old_size * 2, sizeof(unsigned long long));
+	if (set->slots == NULL)
+	{
+		set->slots = old;
+		return -1;
+	}
+	set->size = old_size * 2;
+
+	for (i = 0; i < old_size; i++)
+	{
+		if (old[i] == 0)
+			continue;
+		j = first_slot(set, old[i]);
+		while (set->slots[j] != 0)
+			j = (j + 1) & (set->size - 1);
+		set->slots[j] = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+
+/*
+ * Adds a hash to the set. Threads adding concurrently only share the
+ * read lock and claim empty slots with compare-and-swap, the write lock
+ * is taken while the set grows. Returns 1 if the hash was added, 0 if
+ * it was present already and -1 if there is not enough memory.
+ */
+int hashset_add(hashset *set, unsigned long long hash)
+{
+	unsigned long long current;
+	unsigned int i;
+	int ret = -1;
+
+	if (hash == 0)
+		hash = 1;
+
+	pthread_rwlock_rdlock(&set->lock);
+
+	/* Keep the load below 3/4, a full table would never terminate */
+	while ((set->used + 1) * 4 > set->size * 3)
+	{
+		pthread_rwlock_unlock(&set->lock);
+		pthread_rwlock_wrlock(&set->lock);
+		if (((set->used + 1) * 4 > set->size * 3) && (grow(set) < 0))
+		{
+			pthread_rwlock_unlock(&set->lock);
+			return -1;
+		}
+		pthread_rwlock_unlock(&set->lock);
+		pthread_rwlock_rdlock(&set->lock);
+	}
+
+	i = first_slot(set, hash);
+	while (1)
+	{
+		current = set->slots[i];
+		if (current == hash)
+		{
+			ret = 0;
+			break;
+		}
+		if (current == 0)
+		{
+			current = __sync_val_compare_and_swap(&set->slots[i], 0, hash);
+			if (current == 0)
+			{
+				__sync_add_and_fetch(&set->used, 1);
+				ret = 1;
+				break;
+			}
+			/* Another thread took the slot, it may have added the same hash */
+			if (current == hash)
+			{
+				ret = 0;
+				break;
+			}
+		}
+		i = (i + 1) & (set->size - 1);
+	}
+
+	pthread_rwlock_unlock(&set->lock);
+
+	return ret;
+}
+
+
+/*
+ * Checks whether a hash is part of the set.
+ */
+int hashset_contains(hashset *set, unsigned long long hash)
+{
+	unsigned int i;
+	int ret = 0;
+
+	if (hash == 0)
+		hash = 1;
+
+	pthread_rwlock_rdlock(&set->lock);
+	for (i = first_slot(set, hash); set->slots[i] != 0; i = (i + 1) & (set->size - 1))
+	{
+		if (set->slots[i] == hash)
+		{
+			ret = 1;
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&set->lock);
+
+	return ret;
+}
+
+
+/*
+ * Returns the number of hashes in the set.
+ */
+unsigned int hashset_count(hashset *set)
+{
+	return set->used;
+}
+
+
+/*
+ * Frees a set and its slots.
+ */
+void hashset_free(hashset *set)
+{
+	if (set == NULL)
+		return;
+
+	pthread_rwlock_destroy(&set->lock);
+	free(set->slots);
+	free(set);
+}
+
+
+/*
+ * FNV-1a hash of a domain name, ignoring case.
+ */
+unsigned long long hashset_hash_name(const char *name)
+{
+	unsigned long long h = 14695981039346656037ULL;
+
+	while (*name)
+	{
+		h ^= (unsigned char)tolower((unsigned char)*name++);
+		h *= 1099511628211ULL;
+	}
+
+	return h ? h : 1;
+}
@@ -0,0 +1,41 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef HASHSET_H
+#define HASHSET_H
+
+#include <pthread.h>
+
+/* Set of 64 bit hashes, safe for concurrent use by several threads */
+typedef struct
+{
+	unsigned long long *slots;  // 0 marks an empty slot
+	unsigned int size;          // number of slots (power of two)
+	unsigned int used;
+	pthread_rwlock_t lock;      // held for writing while the set grows
+} hashset;
+
+hashset *hashset_create(unsigned int size);
+int hashset_add(hashset *set, unsigned long long hash);
+int hashset_contains(hashset *set, unsigned long long hash);
+unsigned int hashset_count(hashset *set);
+void hashset_free(hashset *set);
+unsigned long long hashset_hash_name(const char *name);
+
+#endif /* HASHSET_H */
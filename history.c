@@ -0,0 +1,168 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "history.h"
+
+
+/*
+ * Compares two history entries by label for qsort and bsearch.
+ */
+static int compare_entries(const void *a, const void *b)
+{
+	return strcasecmp(((const history_entry *)a)->label, ((const history_entry *)b)->label);
+}
+
+
+/*
+ * Loads a history file. Each line holds a label and the number of hosts
+ * found with it, separated by a space. The entries are returned sorted
+ * by label. Returns the number of entries, 0 if the file does not exist
+ * yet.
+ */
+int history_load(char *file, history_entry **entries)
+{
+	FILE *f;
+	char line[256];
+	char label[256];
+	unsigned int hits;
+	int count = 0, size = 0;
+
+	*entries = NULL;
+
+	f = fopen(file, "r");
+	if (f == NULL)
+		return 0;
+
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		if (sscanf(line, "%255s %u", label, &hits) != 2)
+			continue;
+
+		if (count == size)
+		{
+			size = size ? size * 2 : 256;
+			*entries = (history_entry *)realloc(*entries, size * sizeof(history_entry));
+		}
+		(*entries)[count].label = strdup(label);
+		(*entries)[count].hits = hits;
+		count++;
+	}
+	fclose(f);
+
+	qsort(*entries, count, sizeof(history_entry), compare_entries);
+
+	return count;
+}
+
+
+/*
+ * Returns the number of hosts found with a label in past scans.
+ */
+unsigned int history_hits(history_entry *entries, int count, const char *label)
+{
+	history_entry key, *entry;
+
+	if (count == 0)
+		return 0;
+
+	key.label = (char *)label;
+	entry = (history_entry *)bsearch(&key, entries, count, sizeof(history_entry), compare_entries);
+
+	return entry ? entry->hits : 0;
+}
+
+
+/*
+ * Adds the labels of the hosts found in this scan to the history and
+ * writes it to file. The file is replaced atomically, so an interrupted
+ * scan never leaves a truncated history behind. Returns -1 if the file
+ * could not be written.
+ */
+int history_save(char *file, history_entry *entries, int count, char **labels, int label_count)
+{
+	history_entry *merged;
+	history_entry key, *entry;
+	char tmpfile[4096];
+	FILE *f;
+	int i, j, total = count;
+
+	merged = (history_entry *)malloc(sizeof(history_entry) * (count + label_count + 1));
+	if (merged == NULL)
+		return -1;
+	memcpy(merged, entries, sizeof(history_entry) * count);
+
+	for (i = 0; i < label_count; i++)
+	{
+		key.label = labels[i];
+		entry = (history_entry *)bsearch(&key, merged, count, sizeof(history_entry), compare_entries);
+
+		/* New labels are appended behind the sorted part */
+		for (j = count; (entry == NULL) && (j < total); j++)
+		{
+			if (strcasecmp(merged[j].label, labels[i]) == 0)
+				entry = &merged[j];
+		}
+
+		if (entry)
+		{
+			entry->hits++;
+		}
+		else
+		{
+			merged[total].label = labels[i];
+			merged[total].hits = 1;
+			total++;
+		}
+	}
+
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", file);
+	f = fopen(tmpfile, "w");
+	if (f == NULL)
+	{
+		free(merged);
+		return -1;
+	}
+	for (i = 0; i < total; i++)
+		fprintf(f, "%s %u\n", merged[i].label, merged[i].hits);
+	if (fclose(f) != 0)
+	{
+		free(merged);
+		return -1;
+	}
+	free(merged);
+
+	return rename(tmpfile, file);
+}
+
+
+/*
+ * Frees the entries of a history.
+ */
+void history_free(history_entry *entries, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		free(entries[i].label);
+	free(entries);
+}
@@ -0,0 +1,35 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/* Label of a host found in past scans */
+typedef struct
+{
+	char *label;
+	unsigned int hits;  // number of hosts found with this label
+} history_entry;
+
+int history_load(char *file, history_entry **entries);
+unsigned int history_hits(history_entry *entries, int count, const char *label);
+int history_save(char *file, history_entry *entries, int count, char **labels, int label_count);
+void history_free(history_entry *entries, int count);
+
+#endif /* HISTORY_H */
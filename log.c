@@ -19,46 +19,360 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <stdarg.h>
+#include <signal.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <pthread.h>
 #include "log.h"
 
-/* static reduces this variables scope to file scope.
- * This variable is global, but only throughout this file.
- */
-static int global_loglevel = LOG_INFO;
+/* Line waiting in the ring of the thread which logged it */
+typedef struct
+{
+	unsigned long seq;   // order of logging across all threads
+	time_t time;
+	int loglevel;
+	char text[LOG_LINE_MAX];
+} log_entry;
 
-void logline(int loglevel, const char* format, ...) 
+/* Lines of one thread. Only the thread writes head and only the logger
+ * thread writes tail, so neither side needs a lock */
+typedef struct log_ring
 {
-	va_list args;
-		
-	if (loglevel <= global_loglevel)
+	log_entry slots[LOG_RING_SLOTS];
+	unsigned long head;  // lines written
+	unsigned long tail;  // lines printed
+	int orphaned;        // thread has ended, ring may be taken over
+	struct log_ring *next;
+} log_ring;
+
+/* Read by the logline macro of every module */
+int log_level = LOG_INFO;
+
+static log_ring *rings = NULL;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_t logger;
+static sem_t wakeup;  // posted when a ring fills up
+static int running = 0;
+static int stopping = 0;
+static unsigned long next_seq = 0;
+static time_t now;   // refreshed by the logger thread
+
+
+/*
+ * Formats a line the way it is printed: timestamp, level and text.
+ */
+static void format_line(char *line, size_t size, const char *timestr, int loglevel, const char *text)
+{
+	char *loginfo;
+
+	switch (loglevel)
 	{
-		char timestr[20];
-		char *loginfo;
-		struct tm *ptr;
-		time_t lt;
+		case LOG_ERROR: loginfo = "E"; break;
+		case LOG_INFO: loginfo = "I"; break;
+		case LOG_DEBUG: loginfo = "D"; break;
+		default: loginfo = "I"; 
+	}
+
+	snprintf(line, size, "[%s %s] %s\n", timestr, loginfo, text);
+}
+
+
+/*
+ * Prints a line at once, used while the logger thread is not running.
+ */
+static void print_line(int loglevel, const char *text)
+{
+	char timestr[20];
+	char line[LOG_LINE_MAX + 32];
+	struct tm tm;
+	time_t lt;
+
+	lt = time(NULL);
+	localtime_r(&lt, &tm);
+	strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tm);
+	format_line(line, sizeof(line), timestr, loglevel, text);
+
+	pthread_mutex_lock(&print_lock);
+	fputs(line, stdout);
+	fflush(stdout);
+	pthread_mutex_unlock(&print_lock);
+}
+
+
+/*
+ * Hands the ring of an ending thread over to threads started later.
+ */
+static void orphan_ring(void *arg)
+{
+	log_ring *ring = (log_ring *)arg;
+
+	__atomic_store_n(&ring->orphaned, 1, __ATOMIC_RELEASE);
+}
 
-		lt = time(NULL);
-		ptr = localtime(&lt);
-		strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", ptr);
 
-		switch (loglevel)
+/*
+ * Returns the ring of the calling thread, taking over the ring of an
+ * ended thread or creating one on its first line. Returns NULL if
+ * there is no memory for it.
+ */
+static log_ring *own_ring(void)
+{
+	log_ring *ring = (log_ring *)pthread_getspecific(ring_key);
+
+	if (ring)
+		return ring;
+
+	pthread_mutex_lock(&rings_lock);
+	for (ring = rings; ring; ring = ring->next)
+	{
+		if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE))
+		{
+			ring->orphaned = 0;
+			break;
+		}
+	}
+	if (ring == NULL)
+	{
+		ring = (log_ring *)malloc(sizeof(log_ring));
+		if (ring)
 		{
-			case LOG_ERROR: loginfo = "E"; break;
-			case LOG_INFO: loginfo = "I"; break;
-			case LOG_DEBUG: loginfo = "D"; break;
-			default: loginfo = "I"; 
+			ring->head = 0;
+			ring->tail = 0;
+			ring->orphaned = 0;
+			ring->next = rings;
+			__atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
 		}
+	}
+	pthread_mutex_unlock(&rings_lock);
+
+	if (ring)
+		pthread_setspecific(ring_key, ring);
+
+	return ring;
+}
 
-		printf("[%s %s] ", timestr, loginfo);
+
+/*
+ * Logs a line. Call it through the logline macro, which drops lines
+ * above the log level before their arguments are evaluated. While the
+ * logger thread runs, the line is only copied to the ring of the
+ * calling thread and printed in the background.
+ */
+void log_write(int loglevel, const char* format, ...) 
+{
+	va_list args;
+	log_ring *ring = NULL;
+	log_entry *entry;
+	char text[LOG_LINE_MAX];
+	unsigned long head;
+
+	if (loglevel > log_level)
+		return;
+
+	if (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+		ring = own_ring();
+	if (ring == NULL)
+	{
 		va_start(args, format);
-		vfprintf(stdout, format, args);
+		vsnprintf(text, sizeof(text), format, args);
 		va_end(args);
-		printf("\n");
+		print_line(loglevel, text);
+		return;
+	}
+
+	/* A full ring means the terminal cannot keep up, so wait for it
+	 * rather than losing lines */
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SLOTS)
+	{
+		sem_post(&wakeup);
+		while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SLOTS)
+			sched_yield();
 	}
+
+	entry = &ring->slots[head & (LOG_RING_SLOTS - 1)];
+	entry->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+	entry->time = __atomic_load_n(&now, __ATOMIC_RELAXED);
+	entry->loglevel = loglevel;
+	va_start(args, format);
+	vsnprintf(entry->text, sizeof(entry->text), format, args);
+	va_end(args);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	/* Busy threads get the logger going before their ring is full */
+	if (head + 1 - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SLOTS / 2)
+		sem_post(&wakeup);
 }
 
+
+/*
+ * Prints the lines waiting in all rings, in the order they were logged.
+ * The lines are collected in a buffer and written in large chunks. The
+ * timestamp is only formatted again when the second changes. Returns
+ * the number of lines printed.
+ */
+static int print_rings(time_t *last, char *timestr, size_t size)
+{
+	static char batch[65536];
+	char line[LOG_LINE_MAX + 32];
+	log_ring *ring, *first;
+	log_entry *entry;
+	struct tm tm;
+	size_t used = 0;
+	size_t len;
+	int printed = 0;
+
+	while (1)
+	{
+		/* The ring holding the oldest line goes first */
+		first = NULL;
+		for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+		{
+			if (ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+				continue;
+			if ((first == NULL) ||
+				(ring->slots[ring->tail & (LOG_RING_SLOTS - 1)].seq <
+				 first->slots[first->tail & (LOG_RING_SLOTS - 1)].seq))
+				first = ring;
+		}
+		if (first == NULL)
+		{
+			fwrite(batch, 1, used, stdout);
+			return printed;
+		}
+
+		entry = &first->slots[first->tail & (LOG_RING_SLOTS - 1)];
+		if (entry->time != *last)
+		{
+			*last = entry->time;
+			localtime_r(last, &tm);
+			strftime(timestr, size, "%Y-%m-%d %H:%M:%S", &tm);
+		}
+		format_line(line, sizeof(line), timestr, entry->loglevel, entry->text);
+		len = strlen(line);
+		if (used + len > sizeof(batch))
+		{
+			fwrite(batch, 1, used, stdout);
+			used = 0;
+		}
+		memcpy(batch + used, line, len);
+		used += len;
+		__atomic_store_n(&first->tail, first->tail + 1, __ATOMIC_RELEASE);
+		printed++;
+	}
+}
+
+
+/*
+ * Logger thread. Prints the lines of the other threads until stopped
+ * and keeps the time they are stamped with up to date.
+ */
+static void *drain_rings(void *arg)
+{
+	struct timespec until;
+	char timestr[20];
+	time_t last = 0;
+	int stop;
+
+	(void)arg;
+	timestr[0] = '\0';
+	while (1)
+	{
+		__atomic_store_n(&now, time(NULL), __ATOMIC_RELAXED);
+		stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+		if (print_rings(&last, timestr, sizeof(timestr)) == 0)
+		{
+			fflush(stdout);
+			if (stop)
+				break;
+
+			/* Sleep a few milliseconds unless a ring fills up */
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += 5000000;
+			if (until.tv_nsec >= 1000000000)
+			{
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000;
+			}
+			sem_timedwait(&wakeup, &until);
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Starts the logger thread. Until then and after log_stop, lines are
+ * printed right away. Returns -1 if the thread cannot be started.
+ */
+int log_start(void)
+{
+	sigset_t mask, old_mask;
+	int ret;
+
+	if (running)
+		return 0;
+	if (pthread_key_create(&ring_key, orphan_ring) != 0)
+		return -1;
+	if (sem_init(&wakeup, 0, 0) != 0)
+	{
+		pthread_key_delete(ring_key);
+		return -1;
+	}
+
+	/* Signals are left to the other threads */
+	__atomic_store_n(&now, time(NULL), __ATOMIC_RELAXED);
+	stopping = 0;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+	ret = pthread_create(&logger, NULL, drain_rings, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (ret != 0)
+	{
+		sem_destroy(&wakeup);
+		pthread_key_delete(ring_key);
+		return -1;
+	}
+	__atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+
+/*
+ * Prints the lines still waiting and stops the logger thread. The
+ * threads logging must have ended, except for the calling one.
+ */
+void log_stop(void)
+{
+	log_ring *ring;
+
+	if (!running)
+		return;
+
+	__atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	sem_post(&wakeup);
+	pthread_join(logger, NULL);
+	sem_destroy(&wakeup);
+
+	pthread_setspecific(ring_key, NULL);
+	pthread_key_delete(ring_key);
+	while (rings)
+	{
+		ring = rings->next;
+		free(rings);
+		rings = ring;
+	}
+}
+
+
 /*
  * This function sets the loglevel of the logger.
  */
@@ -66,7 +380,6 @@ void set_loglevel(int loglevel)
 {
 	if ((loglevel == LOG_ERROR) || (loglevel == LOG_INFO) || (loglevel == LOG_DEBUG))
 	{
-		global_loglevel = loglevel;
+		log_level = loglevel;
 	}
 }
-
@@ -24,7 +24,19 @@
 #define LOG_INFO  2
 #define LOG_DEBUG 3
 
-void logline(int loglevel, const char* format, ...);
+#define LOG_RING_SLOTS 128   /* Lines a thread may have waiting (power of two) */
+#define LOG_LINE_MAX   1024  /* Longer lines are cut */
+
+extern int log_level;
+
+/* Lines above the log level cost a single comparison, their arguments
+ * are not even evaluated */
+#define logline(loglevel, ...) \
+	do { if ((loglevel) <= log_level) log_write((loglevel), __VA_ARGS__); } while (0)
+
+void log_write(int loglevel, const char* format, ...);
 void set_loglevel(int loglevel);
+int log_start(void);
+void log_stop(void);
 
 #endif /* LOG_H */
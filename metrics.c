@@ -0,0 +1,217 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "net.h"
+#include "stats.h"
+#include "metrics.h"
+
+static int listener = -1;
+static char *socket_path = NULL;   // removed when stopping
+static pthread_t server;
+static pthread_mutex_t source_lock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_source source = NULL;
+static void *source_arg = NULL;
+static time_t started;
+static int stopping = 0;
+
+
+/*
+ * Writes the memory use of the process: resident now and at most.
+ */
+static void write_memory(FILE *out)
+{
+	struct rusage usage;
+	unsigned long size, resident = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (f)
+	{
+		if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	getrusage(RUSAGE_SELF, &usage);
+
+	fprintf(out, "# HELP dnsninja_resident_memory_bytes Resident memory of the process.\n");
+	fprintf(out, "# TYPE dnsninja_resident_memory_bytes gauge\n");
+	fprintf(out, "dnsninja_resident_memory_bytes %lu\n", resident * (unsigned long)sysconf(_SC_PAGESIZE));
+	fprintf(out, "# HELP dnsninja_peak_memory_bytes Largest resident memory of the process so far.\n");
+	fprintf(out, "# TYPE dnsninja_peak_memory_bytes gauge\n");
+	fprintf(out, "dnsninja_peak_memory_bytes %lu\n", (unsigned long)usage.ru_maxrss * 1024);
+}
+
+
+/*
+ * Answers a scrape. Whatever was asked for, the metrics are sent back.
+ */
+static void serve_scrape(int fd)
+{
+	struct pollfd pfd;
+	char request[4096];
+	int len = 0;
+	int n;
+	FILE *out;
+
+	/* Read the request until its empty line, waiting a second at most */
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while ((len < (int)sizeof(request) - 1) && (poll(&pfd, 1, 1000) > 0))
+	{
+		n = read(fd, request + len, sizeof(request) - 1 - len);
+		if (n <= 0)
+			break;
+		len += n;
+		request[len] = '\0';
+		if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+			break;
+	}
+
+	out = fdopen(fd, "w");
+	if (out == NULL)
+	{
+		close(fd);
+		return;
+	}
+	fprintf(out, "HTTP/1.0 200 OK\r\n");
+	fprintf(out, "Content-Type: text/plain; version=0.0.4\r\n");
+	fprintf(out, "Connection: close\r\n\r\n");
+	fprintf(out, "# HELP dnsninja_start_time_seconds Start of the process since the epoch.\n");
+	fprintf(out, "# TYPE dnsninja_start_time_seconds gauge\n");
+	fprintf(out, "dnsninja_start_time_seconds %ld\n", (long)started);
+	write_memory(out);
+	stats_write_metrics(out);
+
+	pthread_mutex_lock(&source_lock);
+	if (source)
+		source(out, source_arg);
+	pthread_mutex_unlock(&source_lock);
+
+	fclose(out);
+}
+
+
+/*
+ * Metrics thread. Serves one scrape after the other until stopped.
+ */
+static void *serve_metrics(void *arg)
+{
+	struct pollfd pfd;
+	int fd;
+
+	(void)arg;
+	pfd.fd = listener;
+	pfd.events = POLLIN;
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+	{
+		if (poll(&pfd, 1, 500) <= 0)
+			continue;
+		fd = accept(listener, NULL, NULL);
+		if (fd >= 0)
+			serve_scrape(fd);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Serves the metrics on an address: a port on the local host,
+ * host:port or the path of a UNIX socket. Returns -1 if the address
+ * cannot be listened on.
+ */
+int metrics_start(const char *address)
+{
+	sigset_t mask, old_mask;
+	char local[64];
+	int ret;
+
+	/* A bare port is only served to the local host */
+	if (!strchr(address, ':') && !strchr(address, '/') && (strlen(address) < sizeof(local) - 11))
+	{
+		snprintf(local, sizeof(local), "127.0.0.1:%s", address);
+		address = local;
+	}
+
+	listener = net_listen(address);
+	if (listener < 0)
+		return -1;
+	if (strchr(address, '/'))
+		socket_path = strdup(address);
+	started = time(NULL);
+
+	/* Signals are left to the other threads, a scraper going away
+	 * must not end the run */
+	signal(SIGPIPE, SIG_IGN);
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+	ret = pthread_create(&server, NULL, serve_metrics, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (ret != 0)
+	{
+		close(listener);
+		listener = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Sets the function adding metrics to each scrape, NULL for none.
+ */
+void metrics_set_source(metrics_source fn, void *arg)
+{
+	pthread_mutex_lock(&source_lock);
+	source = fn;
+	source_arg = arg;
+	pthread_mutex_unlock(&source_lock);
+}
+
+
+/*
+ * Stops serving the metrics.
+ */
+void metrics_stop(void)
+{
+	if (listener < 0)
+		return;
+
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(server, NULL);
+	close(listener);
+	listener = -1;
+	if (socket_path)
+	{
+		unlink(socket_path);
+		free(socket_path);
+		socket_path = NULL;
+	}
+}
@@ -0,0 +1,32 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+/* Adds the metrics of the caller to each scrape */
+typedef void (*metrics_source)(FILE *out, void *arg);
+
+int metrics_start(const char *address);
+void metrics_set_source(metrics_source source, void *arg);
+void metrics_stop(void);
+
+#endif /* METRICS_H */
@@ -0,0 +1,1290 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+/*
+ * mockdns - a small authoritative DNS server for testing and benchmarking
+ * dnsninja offline. It answers from a zone file over UDP and TCP, hands
+ * out the zone by AXFR over TCP and can add a wildcard, latency, jitter,
+ * loss, truncation and a rate limit.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "dns.h"
+
+#define MOCK_PORT         5353
+#define MOCK_THREADS      4
+#define MOCK_TTL          300
+#define MOCK_MAX_DOMAINS  16
+#define MOCK_MAX_THREADS  64
+#define MOCK_UDP_SIZE     512
+#define MOCK_TCP_SIZE     65535
+#define MOCK_BATCH        64      // datagrams read per wakeup
+#define MOCK_MAX_PENDING  65536   // delayed replies per thread
+#define MOCK_MAX_CHAIN    8       // CNAMEs followed per answer
+#define MOCK_TCP_TIMEOUT  10      // seconds a TCP client may stay idle
+#define MOCK_BURST        100000  // microseconds of queries let through at once
+#define MOCK_SOA_SIZE     600     // room for the SOA record of a domain
+
+#define DNS_RES_REC_ANY   255
+
+/* Resource record of a name in the zone */
+typedef struct mock_rr
+{
+	unsigned short type;
+	unsigned short rdlength;
+	unsigned char rdata[256];
+	char *target;               // name a CNAME points to
+	struct mock_rr *next;
+} mock_rr;
+
+/* Name in the zone, without records if it is an empty non-terminal */
+typedef struct
+{
+	char *name;                 // lower case, without trailing dot
+	mock_rr *rrs;
+} mock_name;
+
+/* Reply waiting for its latency to pass */
+typedef struct
+{
+	unsigned long long due;     // microseconds
+	struct sockaddr_in addr;
+	int len;
+	unsigned char buf[MOCK_UDP_SIZE];
+} mock_pending;
+
+/* Zone transfer being sent to a TCP client */
+typedef struct
+{
+	int fd;
+	unsigned char *buf;         // length prefix and message
+	int pos;                    // length of the header and question
+	int len;                    // length of the message so far
+	int answers;
+} mock_transfer;
+
+/* Thread answering queries on a UDP socket of its own */
+typedef struct
+{
+	pthread_t thread;
+	int fd;
+	unsigned int seed;
+	mock_pending *pending;      // min-heap ordered by due
+	int pending_count;
+	int pending_size;
+	unsigned long queries;
+	unsigned long replies;
+	unsigned long lost;
+	unsigned long truncated;
+	unsigned long limited;
+} mock_worker;
+
+/* Configuration */
+static char *domains[MOCK_MAX_DOMAINS];
+static int domain_count = 0;
+static struct in_addr wildcard;
+static int has_wildcard = 0;
+static unsigned int ttl = MOCK_TTL;
+static long latency = 0;        // microseconds
+static long jitter = 0;         // microseconds
+static double loss = 0;         // percent
+static double truncation = 0;   // percent
+static double rate = 0;         // queries per second, 0 for no limit
+static int refuse_axfr = 0;
+
+/* Zone, read-only once the threads run */
+static mock_name *zone = NULL;
+static unsigned int zone_size = 0;
+static unsigned int zone_used = 0;
+
+/* Shared token bucket of the rate limit */
+static pthread_mutex_t rate_lock = PTHREAD_MUTEX_INITIALIZER;
+static double tokens = 0;
+static double burst = 0;        // tokens of MOCK_BURST microseconds
+static unsigned long long refilled = 0;
+
+static volatile int stopping = 0;
+static unsigned long tcp_queries = 0;
+static unsigned long transfers = 0;
+
+
+/*
+ * Returns the current time in microseconds.
+ */
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*
+ * Hashes a name with FNV-1a.
+ */
+static unsigned int hash_name(const char *name)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*name)
+	{
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+
+/*
+ * Returns the zone entry of name, NULL if the name does not exist.
+ */
+static mock_name *zone_find(const char *name)
+{
+	unsigned int i;
+
+	if (zone_size == 0)
+		return NULL;
+
+	for (i = hash_name(name) & (zone_size - 1); zone[i].name; i = (i + 1) & (zone_size - 1))
+	{
+		if (strcmp(zone[i].name, name) == 0)
+			return &zone[i];
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Returns the zone entry of name, adding it if it does not exist yet.
+ * Returns NULL if out of memory.
+ */
+static mock_name *zone_add(const char *name)
+{
+	mock_name *old = zone;
+	mock_name *entry;
+	unsigned int old_size = zone_size;
+	unsigned int i, j;
+
+	entry = zone_find(name);
+	if (entry)
+		return entry;
+
+	/* Keep the table at most half full */
+	if ((zone_used + 1) * 2 > zone_size)
+	{
+		zone_size = zone_size ? zone_size * 2 : 1024;
+		zone = calloc(zone_size, sizeof(mock_name));
+		if (zone == NULL)
+			return NULL;
+		for (i = 0; i < old_size; i++)
+		{
+			if (old[i].name == NULL)
+				continue;
+			for (j = hash_name(old[i].name) & (zone_size - 1); zone[j].name; j = (j + 1) & (zone_size - 1))
+				;
+			zone[j] = old[i];
+		}
+		free(old);
+	}
+
+	for (i = hash_name(name) & (zone_size - 1); zone[i].name; i = (i + 1) & (zone_size - 1))
+		;
+	zone[i].name = strdup(name);
+	zone[i].rrs = NULL;
+	if (zone[i].name == NULL)
+		return NULL;
+	zone_used++;
+
+	return &zone[i];
+}
+
+
+/*
+ * Checks whether name is domain or lies below it.
+ */
+static int in_domain(const char *name, const char *domain)
+{
+	size_t len = strlen(name);
+	size_t dlen = strlen(domain);
+
+	if ((len == dlen) && (strcmp(name, domain) == 0))
+		return 1;
+
+	return (len > dlen) && (name[len - dlen - 1] == '.') && (strcmp(name + len - dlen, domain) == 0);
+}
+
+
+/*
+ * Returns the domain name is in or below, NULL if there is none.
+ */
+static const char *domain_of(const char *name)
+{
+	int i;
+
+	for (i = 0; i < domain_count; i++)
+	{
+		if (in_domain(name, domains[i]))
+			return domains[i];
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Converts name to lower case and strips a trailing dot.
+ */
+static void normalize_name(char *name)
+{
+	size_t len;
+
+	for (len = 0; name[len]; len++)
+		name[len] = tolower((unsigned char)name[len]);
+	if ((len > 1) && (name[len - 1] == '.'))
+		name[len - 1] = '\0';
+}
+
+
+/*
+ * Writes name in the DNS wire format to dest. Returns the length of the
+ * encoded name or -1 if the name is not valid.
+ */
+static int encode_name(const char *name, unsigned char *dest)
+{
+	const char *dot;
+	int len = 0;
+	int label;
+
+	while (*name)
+	{
+		dot = strchr(name, '.');
+		label = dot ? (int)(dot - name) : (int)strlen(name);
+		if ((label == 0) || (label > 63) || (len + label + 2 > 255))
+			return -1;
+		dest[len++] = label;
+		memcpy(dest + len, name, label);
+		len += label;
+		name += label;
+		if (*name == '.')
+			name++;
+	}
+	dest[len++] = 0;
+
+	return len;
+}
+
+
+/*
+ * Reads a zone file with one record per line, e.g. "www.example.com A
+ * 10.0.0.1". Supported types are A, NS, CNAME and PTR. Returns the number
+ * of records read or -1 on error.
+ */
+static int load_zone(const char *file)
+{
+	FILE *f;
+	char line[1024];
+	char name[256];
+	char type[16];
+	char data[256];
+	char *parent;
+	mock_name *entry;
+	mock_rr *rr;
+	int count = 0;
+	int len;
+
+	f = fopen(file, "r");
+	if (f == NULL)
+	{
+		fprintf(stderr, "Error: Zone file %s could not be opened.\n", file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if ((sscanf(line, "%255s %15s %255s", name, type, data) != 3) || (name[0] == '#'))
+			continue;
+		normalize_name(name);
+		normalize_name(data);
+
+		rr = calloc(1, sizeof(mock_rr));
+		if (rr == NULL)
+			break;
+		if (strcasecmp(type, "A") == 0)
+		{
+			rr->type = DNS_RES_REC_A;
+			len = (inet_pton(AF_INET, data, rr->rdata) == 1) ? 4 : -1;
+		}
+		else if ((strcasecmp(type, "NS") == 0) || (strcasecmp(type, "CNAME") == 0) || (strcasecmp(type, "PTR") == 0))
+		{
+			rr->type = (toupper((unsigned char)type[0]) == 'N') ? DNS_RES_REC_NS :
+				(toupper((unsigned char)type[0]) == 'C') ? DNS_RES_REC_CNAME : DNS_RES_REC_PTR;
+			len = encode_name(data, rr->rdata);
+			if (rr->type == DNS_RES_REC_CNAME)
+				rr->target = strdup(data);
+		}
+		else
+		{
+			len = -1;
+		}
+
+		entry = (len > 0) ? zone_add(name) : NULL;
+		if (entry == NULL)
+		{
+			fprintf(stderr, "Warning: Skipping record %s %s %s.\n", name, type, data);
+			free(rr->target);
+			free(rr);
+			continue;
+		}
+		rr->rdlength = len;
+		rr->next = entry->rrs;
+		entry->rrs = rr;
+		count++;
+
+		/* Names between the record and its domain exist without
+		 * records, so the wildcard does not cover them */
+		if (domain_of(name))
+		{
+			for (parent = strchr(name, '.'); parent && domain_of(parent + 1); parent = strchr(parent + 1, '.'))
+				zone_add(parent + 1);
+		}
+	}
+
+	fclose(f);
+
+	return count;
+}
+
+
+/*
+ * Appends a resource record to the reply. The owner is a pointer to the
+ * question if owner is NULL. Returns the new length of the reply or -1
+ * if the record does not fit.
+ */
+static int append_rr(unsigned char *reply, int len, int max, const unsigned char *owner, int owner_len,
+	unsigned short type, const unsigned char *rdata, int rdlength)
+{
+	int needed = (owner ? owner_len : 2) + 10 + rdlength;
+
+	if (len + needed > max)
+		return -1;
+
+	if (owner)
+	{
+		memcpy(reply + len, owner, owner_len);
+		len += owner_len;
+	}
+	else
+	{
+		reply[len++] = 0xc0;
+		reply[len++] = 12;
+	}
+	reply[len++] = type >> 8;
+	reply[len++] = type & 0xff;
+	reply[len++] = 0;
+	reply[len++] = 1;
+	reply[len++] = ttl >> 24;
+	reply[len++] = (ttl >> 16) & 0xff;
+	reply[len++] = (ttl >> 8) & 0xff;
+	reply[len++] = ttl & 0xff;
+	reply[len++] = rdlength >> 8;
+	reply[len++] = rdlength & 0xff;
+	memcpy(reply + len, rdata, rdlength);
+
+	return len + rdlength;
+}
+
+
+/*
+ * Reads the single question of a query of len bytes into name, a buffer
+ * of 256 bytes, and qtype. Returns the length of the header and the
+ * question or -1 if the query is malformed.
+ */
+static int read_question(const unsigned char *query, int len, char *name, unsigned short *qtype)
+{
+	int pos = 12;
+	int out = 0;
+	int label;
+
+	if ((len < 12) || (query[4] != 0) || (query[5] != 1))
+		return -1;
+	while ((pos < len) && (query[pos] != 0))
+	{
+		label = query[pos];
+		if ((label > 63) || (pos + label + 1 >= len) || (out + label + 1 >= 256))
+			return -1;
+		if (out)
+			name[out++] = '.';
+		memcpy(name + out, query + pos + 1, label);
+		out += label;
+		pos += label + 1;
+	}
+	if (pos + 5 > len)
+		return -1;
+	name[out] = '\0';
+	normalize_name(name);
+	*qtype = (query[pos + 1] << 8) | query[pos + 2];
+
+	return pos + 5;
+}
+
+
+/*
+ * Builds the reply to a query of len bytes. Only the question is returned
+ * with the TC bit set if truncate is set or the answer does not fit into
+ * max bytes. Returns the length of the reply, 0 if the query is not worth
+ * a reply.
+ */
+static int answer_query(const unsigned char *query, int len, unsigned char *reply, int max, int truncate)
+{
+	const unsigned char *owner = NULL;
+	mock_name *entry;
+	mock_rr *rr;
+	char name[256];
+	unsigned short qtype;
+	int owner_len = 0;
+	int answers = 0;
+	int rcode = DNS_RCODE_NOERROR;
+	int pos;
+	int next;
+	int chain;
+
+	/* Ignore replies and anything too short to answer */
+	if ((len < 12) || (query[2] & 0x80))
+		return 0;
+
+	memcpy(reply, query, 12);
+	reply[2] = 0x84 | (query[2] & 0x79);    // QR, AA, opcode and RD
+	reply[3] = 0;
+	memset(reply + 4, 0, 8);
+
+	pos = read_question(query, len, name, &qtype);
+	if (pos < 0)
+	{
+		reply[3] = 1;    // FORMERR
+		return 12;
+	}
+
+	memcpy(reply + 12, query + 12, pos - 12);
+	reply[5] = 1;
+	if (query[2] & 0x78)
+	{
+		reply[3] = 4;    // NOTIMP
+		return pos;
+	}
+	if (qtype == DNS_RES_REC_AXFR)
+	{
+		/* Transfers are only handed out over TCP */
+		reply[3] = 5;    // REFUSED
+		return pos;
+	}
+	if (truncate)
+	{
+		reply[2] |= 0x02;
+		return pos;
+	}
+
+	/* Collect the answers, following CNAMEs within the zone */
+	len = pos;
+	entry = zone_find(name);
+	if ((entry == NULL) && (!has_wildcard || (domain_of(name) == NULL)))
+	{
+		rcode = DNS_RCODE_NXDOMAIN;
+	}
+	else if ((entry == NULL) && ((qtype == DNS_RES_REC_A) || (qtype == DNS_RES_REC_ANY)))
+	{
+		/* The domains themselves are in the zone, so this name is
+		 * below one of them */
+		len = append_rr(reply, len, max, NULL, 0, DNS_RES_REC_A, (unsigned char *)&wildcard, 4);
+		answers++;
+	}
+
+	for (chain = 0; entry && (len > 0) && (chain < MOCK_MAX_CHAIN); chain++)
+	{
+		next = 0;
+		for (rr = entry->rrs; rr && (len > 0); rr = rr->next)
+		{
+			if ((rr->type != qtype) && (qtype != DNS_RES_REC_ANY) && (rr->type != DNS_RES_REC_CNAME))
+				continue;
+			len = append_rr(reply, len, max, owner, owner_len, rr->type, rr->rdata, rr->rdlength);
+			answers++;
+			if ((rr->type == DNS_RES_REC_CNAME) && (qtype != DNS_RES_REC_CNAME) && (next == 0))
+			{
+				entry = zone_find(rr->target);
+				owner = rr->rdata;
+				owner_len = rr->rdlength;
+				next = 1;
+			}
+		}
+		if (next == 0)
+			break;
+	}
+
+	if (len < 0)
+	{
+		reply[2] |= 0x02;
+		reply[6] = 0;
+		reply[7] = 0;
+		return pos;
+	}
+	reply[3] = rcode;
+	reply[6] = answers >> 8;
+	reply[7] = answers & 0xff;
+
+	return len;
+}
+
+
+/*
+ * Writes the SOA record of domain to rdata, a buffer of MOCK_SOA_SIZE
+ * bytes. The first name server of the domain is named as the primary,
+ * the domain itself if it has none. Returns the length of the record or
+ * -1 if the domain is not a valid name.
+ */
+static int build_soa(const char *domain, unsigned char *rdata)
+{
+	unsigned char encoded[256];
+	unsigned int values[5];
+	mock_name *entry;
+	mock_rr *rr;
+	int dlen;
+	int len;
+	int i;
+
+	dlen = encode_name(domain, encoded);
+	if (dlen < 0)
+		return -1;
+
+	entry = zone_find(domain);
+	for (rr = entry ? entry->rrs : NULL; rr && (rr->type != DNS_RES_REC_NS); rr = rr->next)
+		;
+	if (rr)
+	{
+		memcpy(rdata, rr->rdata, rr->rdlength);
+		len = rr->rdlength;
+	}
+	else
+	{
+		memcpy(rdata, encoded, dlen);
+		len = dlen;
+	}
+
+	/* Mailbox hostmaster@domain, if the name stays short enough */
+	if (dlen + 11 <= 255)
+	{
+		memcpy(rdata + len, "\012hostmaster", 11);
+		len += 11;
+	}
+	memcpy(rdata + len, encoded, dlen);
+	len += dlen;
+
+	/* Serial, refresh, retry, expire and minimum TTL */
+	values[0] = 1;
+	values[1] = 3600;
+	values[2] = 600;
+	values[3] = 86400;
+	values[4] = ttl;
+	for (i = 0; i < 5; i++)
+	{
+		rdata[len++] = values[i] >> 24;
+		rdata[len++] = (values[i] >> 16) & 0xff;
+		rdata[len++] = (values[i] >> 8) & 0xff;
+		rdata[len++] = values[i] & 0xff;
+	}
+
+	return len;
+}
+
+
+/*
+ * Sends the message being built for a zone transfer and starts the next
+ * one after the question. Returns -1 if the client went away.
+ */
+static int flush_transfer(mock_transfer *t)
+{
+	unsigned char *msg = t->buf + 2;
+
+	msg[6] = t->answers >> 8;
+	msg[7] = t->answers & 0xff;
+	t->buf[0] = t->len >> 8;
+	t->buf[1] = t->len & 0xff;
+	if (write(t->fd, t->buf, t->len + 2) != t->len + 2)
+		return -1;
+
+	t->len = t->pos;
+	t->answers = 0;
+
+	return 0;
+}
+
+
+/*
+ * Adds a record to a zone transfer, sending the message first if the
+ * record does not fit into it anymore. Returns -1 if the client went
+ * away.
+ */
+static int add_transfer_rr(mock_transfer *t, const unsigned char *owner, int owner_len,
+	unsigned short type, const unsigned char *rdata, int rdlength)
+{
+	int len;
+
+	len = append_rr(t->buf + 2, t->len, MOCK_TCP_SIZE, owner, owner_len, type, rdata, rdlength);
+	if (len < 0)
+	{
+		if (flush_transfer(t) < 0)
+			return -1;
+		len = append_rr(t->buf + 2, t->len, MOCK_TCP_SIZE, owner, owner_len, type, rdata, rdlength);
+	}
+	t->len = len;
+	t->answers++;
+
+	return 0;
+}
+
+
+/*
+ * Hands out domain to a TCP client by AXFR: its SOA record, the records
+ * of every name in or below it and the SOA record again, in as many
+ * messages as needed. pos is the length of the header and question of
+ * the query, buf has room for MOCK_TCP_SIZE bytes and the length prefix.
+ * Returns -1 if the client went away.
+ */
+static int transfer_zone(int fd, const unsigned char *query, int pos, const char *domain, unsigned char *buf)
+{
+	unsigned char soa[MOCK_SOA_SIZE];
+	unsigned char owner[256];
+	mock_transfer t;
+	mock_rr *rr;
+	unsigned int i;
+	int soa_len;
+	int owner_len;
+
+	t.fd = fd;
+	t.buf = buf;
+	t.pos = pos;
+	t.len = pos;
+	t.answers = 0;
+
+	memcpy(buf + 2, query, pos);
+	buf[4] = 0x84 | (query[2] & 0x01);      // QR, AA and RD
+	buf[5] = 0;
+	memset(buf + 8, 0, 6);
+
+	soa_len = build_soa(domain, soa);
+	owner_len = encode_name(domain, owner);
+	if ((soa_len < 0) || (owner_len < 0))
+	{
+		buf[5] = 5;    // REFUSED
+		return flush_transfer(&t);
+	}
+	if (add_transfer_rr(&t, owner, owner_len, DNS_RES_REC_SOA, soa, soa_len) < 0)
+		return -1;
+
+	for (i = 0; i < zone_size; i++)
+	{
+		if ((zone[i].name == NULL) || (zone[i].rrs == NULL) || !in_domain(zone[i].name, domain))
+			continue;
+		owner_len = encode_name(zone[i].name, owner);
+		for (rr = zone[i].rrs; rr && (owner_len > 0); rr = rr->next)
+		{
+			if (add_transfer_rr(&t, owner, owner_len, rr->type, rr->rdata, rr->rdlength) < 0)
+				return -1;
+		}
+	}
+
+	owner_len = encode_name(domain, owner);
+	if (add_transfer_rr(&t, owner, owner_len, DNS_RES_REC_SOA, soa, soa_len) < 0)
+		return -1;
+	__atomic_fetch_add(&transfers, 1, __ATOMIC_RELAXED);
+
+	return flush_transfer(&t);
+}
+
+
+/*
+ * Returns a random number in [0, 100).
+ */
+static double random_percent(unsigned int *seed)
+{
+	return (rand_r(seed) % 1000000) / 10000.0;
+}
+
+
+/*
+ * Takes a token from the rate limit. Returns 0 if the query is over the
+ * limit.
+ */
+static int take_token(void)
+{
+	unsigned long long now = now_us();
+	int ret = 0;
+
+	pthread_mutex_lock(&rate_lock);
+	tokens += (now - refilled) * rate / 1000000.0;
+	if (tokens > burst)
+		tokens = burst;
+	refilled = now;
+	if (tokens >= 1)
+	{
+		tokens -= 1;
+		ret = 1;
+	}
+	pthread_mutex_unlock(&rate_lock);
+
+	return ret;
+}
+
+
+/*
+ * Returns the latency of a reply in microseconds.
+ */
+static long reply_delay(unsigned int *seed)
+{
+	long delay = latency;
+
+	if (jitter)
+		delay += (long)(rand_r(seed) % (2 * jitter + 1)) - jitter;
+
+	return (delay > 0) ? delay : 0;
+}
+
+
+/*
+ * Queues a reply until due. Returns -1 if too many replies are waiting.
+ */
+static int push_pending(mock_worker *w, unsigned long long due, struct sockaddr_in *addr,
+	unsigned char *buf, int len)
+{
+	mock_pending *grown;
+	mock_pending tmp;
+	int i, parent;
+
+	if (w->pending_count == w->pending_size)
+	{
+		if (w->pending_size == MOCK_MAX_PENDING)
+			return -1;
+		grown = realloc(w->pending, (w->pending_size ? w->pending_size * 2 : 256) * sizeof(mock_pending));
+		if (grown == NULL)
+			return -1;
+		w->pending = grown;
+		w->pending_size = w->pending_size ? w->pending_size * 2 : 256;
+	}
+
+	i = w->pending_count++;
+	w->pending[i].due = due;
+	w->pending[i].addr = *addr;
+	w->pending[i].len = len;
+	memcpy(w->pending[i].buf, buf, len);
+
+	while (i > 0)
+	{
+		parent = (i - 1) / 2;
+		if (w->pending[parent].due <= w->pending[i].due)
+			break;
+		tmp = w->pending[parent];
+		w->pending[parent] = w->pending[i];
+		w->pending[i] = tmp;
+		i = parent;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Sends the queued replies due by now.
+ */
+static void send_due(mock_worker *w, unsigned long long now)
+{
+	mock_pending tmp;
+	int i, child;
+
+	while ((w->pending_count > 0) && (w->pending[0].due <= now))
+	{
+		sendto(w->fd, w->pending[0].buf, w->pending[0].len, 0,
+			(struct sockaddr *)&w->pending[0].addr, sizeof(struct sockaddr_in));
+		w->replies++;
+
+		w->pending[0] = w->pending[--w->pending_count];
+		for (i = 0; (child = 2 * i + 1) < w->pending_count; i = child)
+		{
+			if ((child + 1 < w->pending_count) && (w->pending[child + 1].due < w->pending[child].due))
+				child++;
+			if (w->pending[i].due <= w->pending[child].due)
+				break;
+			tmp = w->pending[i];
+			w->pending[i] = w->pending[child];
+			w->pending[child] = tmp;
+		}
+	}
+}
+
+
+/*
+ * Answers queries arriving on the UDP socket of a worker.
+ */
+static void *serve_udp(void *arg)
+{
+	mock_worker *w = (mock_worker *)arg;
+	unsigned char query[MOCK_UDP_SIZE];
+	unsigned char reply[MOCK_UDP_SIZE];
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	struct pollfd pfd;
+	struct timespec ts;
+	unsigned long long now;
+	unsigned long long wait;
+	long delay;
+	int truncate;
+	int len;
+	int i;
+
+	pfd.fd = w->fd;
+	pfd.events = POLLIN;
+
+	while (!stopping)
+	{
+		now = now_us();
+		send_due(w, now);
+
+		/* Sleep until the next reply is due, but look at stopping
+		 * every 100 ms */
+		wait = 100000;
+		if ((w->pending_count > 0) && (w->pending[0].due - now < wait))
+			wait = w->pending[0].due - now;
+		ts.tv_sec = wait / 1000000;
+		ts.tv_nsec = (wait % 1000000) * 1000;
+		if (ppoll(&pfd, 1, &ts, NULL) <= 0)
+			continue;
+
+		for (i = 0; i < MOCK_BATCH; i++)
+		{
+			addrlen = sizeof(addr);
+			len = recvfrom(w->fd, query, sizeof(query), MSG_DONTWAIT, (struct sockaddr *)&addr, &addrlen);
+			if (len < 0)
+				break;
+			w->queries++;
+
+			if ((rate > 0) && !take_token())
+			{
+				w->limited++;
+				continue;
+			}
+			if ((loss > 0) && (random_percent(&w->seed) < loss))
+			{
+				w->lost++;
+				continue;
+			}
+			truncate = (truncation > 0) && (random_percent(&w->seed) < truncation);
+			len = answer_query(query, len, reply, sizeof(reply), truncate);
+			if (len == 0)
+				continue;
+			if (reply[2] & 0x02)
+				w->truncated++;
+
+			delay = reply_delay(&w->seed);
+			if (delay == 0)
+			{
+				sendto(w->fd, reply, len, 0, (struct sockaddr *)&addr, addrlen);
+				w->replies++;
+			}
+			else if (push_pending(w, now_us() + delay, &addr, reply, len) < 0)
+			{
+				w->lost++;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Reads exactly len bytes from fd. Returns -1 on error or end of stream.
+ */
+static int read_full(int fd, unsigned char *buf, int len)
+{
+	int got = 0;
+	int ret;
+
+	while (got < len)
+	{
+		ret = read(fd, buf + got, len - got);
+		if (ret <= 0)
+			return -1;
+		got += ret;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Answers the queries of a TCP client until it closes the connection.
+ * Latency applies, but loss, truncation and the rate limit do not.
+ */
+static void *serve_tcp_client(void *arg)
+{
+	int fd = (int)(long)arg;
+	unsigned char *query;
+	unsigned char *reply;
+	unsigned int seed = (unsigned int)(now_us() ^ fd);
+	const char *domain;
+	char name[256];
+	unsigned short qtype;
+	struct timespec ts;
+	struct timeval tv;
+	long delay;
+	int len;
+	int pos;
+	int i;
+
+	tv.tv_sec = MOCK_TCP_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	query = malloc(MOCK_TCP_SIZE);
+	reply = malloc(MOCK_TCP_SIZE + 2);
+	while (query && reply && !stopping)
+	{
+		if (read_full(fd, query, 2) < 0)
+			break;
+		len = (query[0] << 8) | query[1];
+		if (read_full(fd, query, len) < 0)
+			break;
+		__atomic_fetch_add(&tcp_queries, 1, __ATOMIC_RELAXED);
+
+		delay = reply_delay(&seed);
+		if (delay)
+		{
+			ts.tv_sec = delay / 1000000;
+			ts.tv_nsec = (delay % 1000000) * 1000;
+			nanosleep(&ts, NULL);
+		}
+
+		/* Standard queries for the zone of one of the domains are
+		 * answered with the zone, anything else is refused */
+		domain = NULL;
+		pos = ((len >= 12) && ((query[2] & 0xf8) == 0) && !refuse_axfr) ?
+			read_question(query, len, name, &qtype) : -1;
+		for (i = 0; (pos > 0) && (qtype == DNS_RES_REC_AXFR) && (i < domain_count) && !domain; i++)
+		{
+			if (strcmp(name, domains[i]) == 0)
+				domain = domains[i];
+		}
+		if (domain)
+		{
+			if (transfer_zone(fd, query, pos, domain, reply) < 0)
+				break;
+			continue;
+		}
+
+		len = answer_query(query, len, reply + 2, MOCK_TCP_SIZE, 0);
+		if (len == 0)
+			continue;
+		reply[0] = len >> 8;
+		reply[1] = len & 0xff;
+		if (write(fd, reply, len + 2) != len + 2)
+			break;
+	}
+
+	free(query);
+	free(reply);
+	close(fd);
+
+	return NULL;
+}
+
+
+/*
+ * Accepts TCP clients, each served by a thread of its own.
+ */
+static void *serve_tcp(void *arg)
+{
+	int fd = (int)(long)arg;
+	struct pollfd pfd;
+	pthread_t thread;
+	int client;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (!stopping)
+	{
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		client = accept(fd, NULL, NULL);
+		if (client < 0)
+			continue;
+		if (pthread_create(&thread, NULL, serve_tcp_client, (void *)(long)client) != 0)
+		{
+			close(client);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Creates a socket bound to addr. Returns the socket or -1 on error.
+ */
+static int bind_socket(int type, struct sockaddr_in *addr)
+{
+	int one = 1;
+	int fd;
+
+	fd = socket(AF_INET, type, 0);
+	if (fd < 0)
+		return -1;
+
+	/* Every UDP thread binds a socket of its own to the same port and
+	 * the kernel spreads the clients across them */
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (type == SOCK_DGRAM)
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+	if ((bind(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0) ||
+		((type == SOCK_STREAM) && (listen(fd, 64) < 0)))
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"\n"
+		"  -p <port>     Port to answer on over UDP and TCP (default %d)\n"
+		"  -b <ip>       Address to bind to (default 127.0.0.1)\n"
+		"  -z <file>     Zone file with lines like \"www.example.com A 10.0.0.1\",\n"
+		"                types A, NS, CNAME and PTR\n"
+		"  -d <domain>   Domain the zone belongs to, may be given several times\n"
+		"  -W <ip>       Answer names below the domains missing from the zone\n"
+		"                with <ip> as a wildcard would\n"
+		"  -l <ms>       Latency added to every reply\n"
+		"  -j <ms>       Random jitter of up to <ms> added to or taken from the\n"
+		"                latency\n"
+		"  -x <percent>  Drop this percentage of UDP queries\n"
+		"  -c <percent>  Truncate this percentage of UDP replies\n"
+		"  -r <qps>      Drop UDP queries above this rate\n"
+		"  -T <ttl>      TTL of the records (default %d)\n"
+		"  -t <threads>  Threads answering UDP queries (default %d)\n"
+		"  -X            Refuse zone transfers, which are handed out over\n"
+		"                TCP otherwise\n",
+		name, MOCK_PORT, MOCK_TTL, MOCK_THREADS);
+}
+
+
+int main(int argc, char *argv[])
+{
+	mock_worker *workers;
+	struct sockaddr_in addr;
+	pthread_t tcp_thread;
+	sigset_t signals;
+	unsigned long queries = 0;
+	unsigned long replies = 0;
+	unsigned long lost = 0;
+	unsigned long truncated = 0;
+	unsigned long limited = 0;
+	char *zonefile = NULL;
+	char *bind_addr = "127.0.0.1";
+	int threads = MOCK_THREADS;
+	int port = MOCK_PORT;
+	int records = 0;
+	int tcp_fd;
+	int sig;
+	int i;
+	int c;
+
+	while ((c = getopt(argc, argv, "p:b:z:d:W:l:j:x:c:r:T:t:Xh")) != -1)
+	{
+		switch (c)
+		{
+			case 'p':
+				port = atoi(optarg);
+				if ((port < 1) || (port > 65535))
+				{
+					fprintf(stderr, "Error: Invalid port %s.\n", optarg);
+					return -1;
+				}
+				break;
+			case 'b':
+				bind_addr = optarg;
+				break;
+			case 'z':
+				zonefile = optarg;
+				break;
+			case 'd':
+				if (domain_count == MOCK_MAX_DOMAINS)
+				{
+					fprintf(stderr, "Error: At most %d domains are supported.\n", MOCK_MAX_DOMAINS);
+					return -1;
+				}
+				domains[domain_count] = strdup(optarg);
+				normalize_name(domains[domain_count++]);
+				break;
+			case 'W':
+				if (inet_pton(AF_INET, optarg, &wildcard) != 1)
+				{
+					fprintf(stderr, "Error: Invalid wildcard address %s.\n", optarg);
+					return -1;
+				}
+				has_wildcard = 1;
+				break;
+			case 'l':
+				latency = (long)(atof(optarg) * 1000);
+				break;
+			case 'j':
+				jitter = (long)(atof(optarg) * 1000);
+				break;
+			case 'x':
+				loss = atof(optarg);
+				break;
+			case 'c':
+				truncation = atof(optarg);
+				break;
+			case 'r':
+				rate = atof(optarg);
+				break;
+			case 'T':
+				ttl = (unsigned int)atoi(optarg);
+				break;
+			case 'X':
+				refuse_axfr = 1;
+				break;
+			case 't':
+				threads = atoi(optarg);
+				if ((threads < 1) || (threads > MOCK_MAX_THREADS))
+				{
+					fprintf(stderr, "Error: Invalid thread count %s.\n", optarg);
+					return -1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return (c == 'h') ? 0 : -1;
+		}
+	}
+	if ((optind != argc) || (latency < 0) || (jitter < 0) || (loss < 0) || (truncation < 0) || (rate < 0))
+	{
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (zonefile)
+	{
+		records = load_zone(zonefile);
+		if (records < 0)
+			return -1;
+	}
+	for (i = 0; i < domain_count; i++)
+		zone_add(domains[i]);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, bind_addr, &addr.sin_addr) != 1)
+	{
+		fprintf(stderr, "Error: Invalid address %s.\n", bind_addr);
+		return -1;
+	}
+
+	/* Signals are only taken by the main thread */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	workers = calloc(threads, sizeof(mock_worker));
+	tcp_fd = bind_socket(SOCK_STREAM, &addr);
+	if ((workers == NULL) || (tcp_fd < 0))
+	{
+		fprintf(stderr, "Error: Could not listen on %s:%d.\n", bind_addr, port);
+		return -1;
+	}
+	for (i = 0; i < threads; i++)
+	{
+		workers[i].fd = bind_socket(SOCK_DGRAM, &addr);
+		workers[i].seed = (unsigned int)now_us() + i;
+		if (workers[i].fd < 0)
+		{
+			fprintf(stderr, "Error: Could not listen on %s:%d.\n", bind_addr, port);
+			return -1;
+		}
+	}
+
+	refilled = now_us();
+	burst = (rate * MOCK_BURST / 1000000.0 > 1) ? rate * MOCK_BURST / 1000000.0 : 1;
+	tokens = burst;
+	for (i = 0; i < threads; i++)
+		pthread_create(&workers[i].thread, NULL, serve_udp, &workers[i]);
+	pthread_create(&tcp_thread, NULL, serve_tcp, (void *)(long)tcp_fd);
+
+	fprintf(stderr, "mockdns: serving %d records on %s:%d with %d threads\n", records, bind_addr, port, threads);
+
+	sigwait(&signals, &sig);
+	stopping = 1;
+
+	pthread_join(tcp_thread, NULL);
+	for (i = 0; i < threads; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		close(workers[i].fd);
+		free(workers[i].pending);
+		queries += workers[i].queries;
+		replies += workers[i].replies;
+		lost += workers[i].lost;
+		truncated += workers[i].truncated;
+		limited += workers[i].limited;
+	}
+	close(tcp_fd);
+
+	fprintf(stderr, "mockdns: %lu UDP queries, %lu replies, %lu lost, %lu truncated, %lu rate limited, %lu TCP queries, %lu zone transfers\n",
+		queries, replies, lost, truncated, limited, __atomic_load_n(&tcp_queries, __ATOMIC_RELAXED),
+		__atomic_load_n(&transfers, __ATOMIC_RELAXED));
+	free(workers);
+
+	return 0;
+}
@@ -0,0 +1,332 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "mutate.h"
+
+/* Mutation rules, applied in this order */
+#define RULE_NUMBERS 0  // web -> web1, web-1, web01; web01 -> web02
+#define RULE_AFFIXES 1  // api -> dev-api, api-dev, devapi, apidev
+#define RULE_PAIRS   2  // joins the label with other hits
+#define RULE_SWAPS   3  // dev-api -> api-dev, web-api
+#define RULE_DONE    4
+
+/* Number of forms each rule produces per step */
+#define NUMBER_FORMS 3
+#define AFFIX_FORMS  4
+#define PAIR_FORMS   3
+
+/* Affixes commonly found in host names */
+static const char *affixes[] =
+{
+	"dev", "test", "stage", "staging", "prod", "qa", "uat", "api",
+	"admin", "int", "ext", "internal", "old", "new", "beta", "demo",
+	"backup", "app", "web", "vpn", "corp", "secure"
+};
+
+/* Labels of the hosts found so far */
+static char *hits[MUTATE_MAX_HITS];
+static int hit_count = 0;
+static pthread_mutex_t hits_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Prepares a mutator for the first len characters of seed.
+ */
+void mutator_init(mutator *m, const char *seed, int len)
+{
+	if (len >= (int)sizeof(m->seed))
+		len = sizeof(m->seed) - 1;
+	memcpy(m->seed, seed, len);
+	m->seed[len] = '\0';
+	m->rule = RULE_NUMBERS;
+	m->index = 0;
+}
+
+
+/*
+ * Remembers the label of a host found, so it can be joined with and
+ * swapped into other labels. The label is dropped if there is no
+ * memory left for it.
+ */
+void mutate_add_hit(const char *label, int len)
+{
+	int i;
+
+	pthread_mutex_lock(&hits_lock);
+	for (i = 0; i < hit_count; i++)
+	{
+		if ((strncasecmp(hits[i], label, len) == 0) && (hits[i][len] == '\0'))
+			break;
+	}
+	if ((i == hit_count) && (hit_count < MUTATE_MAX_HITS) &&
+		((hits[hit_count] = (char *)malloc(len + 1)) != NULL))
+	{
+		memcpy(hits[hit_count], label, len);
+		hits[hit_count][len] = '\0';
+		hit_count++;
+	}
+	pthread_mutex_unlock(&hits_lock);
+}
+
+
+/*
+ * Returns the ith hit or NULL if there are not that many.
+ */
+static char *get_hit(int i)
+{
+	char *hit = NULL;
+
+	pthread_mutex_lock(&hits_lock);
+	if (i < hit_count)
+		hit = hits[i];
+	pthread_mutex_unlock(&hits_lock);
+
+	return hit;
+}
+
+
+/*
+ * Checks whether a generated label is a valid host name label.
+ */
+static int valid_label(const char *label)
+{
+	int len = strlen(label);
+
+	if ((len == 0) || (len > 63))
+		return 0;
+	if ((label[0] == '-') || (label[len - 1] == '-'))
+		return 0;
+
+	return 1;
+}
+
+
+/*
+ * Empties dest if the ret characters snprintf wanted to write did not
+ * fit into its len bytes, so the cut label is skipped.
+ */
+static void check_fit(char *dest, int len, int ret)
+{
+	if ((ret < 0) || (ret >= len))
+		dest[0] = '\0';
+}
+
+
+/*
+ * Writes the label with the ith number of the numeric range appended
+ * to dest. Trailing digits of the label are replaced, so web01 leads
+ * to web02 as well.
+ */
+static void apply_number(mutator *m, int i, char *dest, int len)
+{
+	char stem[64];
+	int n = strlen(m->seed);
+	int number = i / NUMBER_FORMS;
+	int ret = 0;
+
+	while ((n > 0) && isdigit((unsigned char)m->seed[n - 1]))
+		n--;
+	if ((n > 0) && (m->seed[n - 1] == '-'))
+		n--;
+	memcpy(stem, m->seed, n);
+	stem[n] = '\0';
+
+	switch (i % NUMBER_FORMS)
+	{
+		case 0: ret = snprintf(dest, len, "%s%d", stem, number); break;
+		case 1: ret = snprintf(dest, len, "%s-%d", stem, number); break;
+		case 2: ret = snprintf(dest, len, "%s%02d", stem, number); break;
+	}
+	check_fit(dest, len, ret);
+}
+
+
+/*
+ * Writes the label with the ith affix form to dest.
+ */
+static void apply_affix(mutator *m, int i, char *dest, int len)
+{
+	const char *affix = affixes[i / AFFIX_FORMS];
+	int ret = 0;
+
+	switch (i % AFFIX_FORMS)
+	{
+		case 0: ret = snprintf(dest, len, "%s-%s", affix, m->seed); break;
+		case 1: ret = snprintf(dest, len, "%s-%s", m->seed, affix); break;
+		case 2: ret = snprintf(dest, len, "%s%s", affix, m->seed); break;
+		case 3: ret = snprintf(dest, len, "%s%s", m->seed, affix); break;
+	}
+	check_fit(dest, len, ret);
+}
+
+
+/*
+ * Writes the label joined with the ith pair form of the hits to dest.
+ * Returns 0 once all hits are used up.
+ */
+static int apply_pair(mutator *m, int i, char *dest, int len)
+{
+	char *hit = get_hit(i / PAIR_FORMS);
+	int ret = 0;
+
+	if (hit == NULL)
+		return 0;
+
+	if (strcasecmp(hit, m->seed) == 0)
+	{
+		dest[0] = '\0';
+		return 1;
+	}
+
+	switch (i % PAIR_FORMS)
+	{
+		case 0: ret = snprintf(dest, len, "%s-%s", m->seed, hit); break;
+		case 1: ret = snprintf(dest, len, "%s-%s", hit, m->seed); break;
+		case 2: ret = snprintf(dest, len, "%s%s", m->seed, hit); break;
+	}
+	check_fit(dest, len, ret);
+
+	return 1;
+}
+
+
+/*
+ * Writes the ith swap of the dash separated parts of the label to dest.
+ * The first swap reverses the parts, the following ones replace one
+ * part with a hit. Returns 0 once all swaps are used up.
+ */
+static int apply_swap(mutator *m, int i, char *dest, int len)
+{
+	char *parts[16];
+	char copy[64];
+	char *hit;
+	int count = 0, part, j, pos = 0;
+
+	strcpy(copy, m->seed);
+	parts[count++] = copy;
+	for (j = 0; copy[j] && (count < 16); j++)
+	{
+		if (copy[j] == '-')
+		{
+			copy[j] = '\0';
+			parts[count++] = &copy[j + 1];
+		}
+	}
+	if (count < 2)
+		return 0;
+
+	dest[0] = '\0';
+	if (i == 0)
+	{
+		for (j = count - 1; j >= 0; j--)
+			pos += snprintf(dest + pos, (pos < len) ? len - pos : 0, (j > 0) ? "%s-" : "%s", parts[j]);
+		check_fit(dest, len, pos);
+		return 1;
+	}
+
+	i--;
+	part = i % count;
+	hit = get_hit(i / count);
+	if (hit == NULL)
+		return 0;
+
+	/* Hits made of several parts would not fit in a single part */
+	if (strchr(hit, '-') || (strcasecmp(hit, parts[part]) == 0))
+		return 1;
+
+	for (j = 0; j < count; j++)
+		pos += snprintf(dest + pos, (pos < len) ? len - pos : 0, (j < count - 1) ? "%s-" : "%s",
+			(j == part) ? hit : parts[j]);
+	check_fit(dest, len, pos);
+
+	return 1;
+}
+
+
+/*
+ * Writes the next mutation of the seed to dest. Returns 1 if a
+ * mutation was written, 0 once all rules are exhausted. Mutations are
+ * not unique, callers have to skip names they already tried.
+ */
+int mutator_next(mutator *m, char *dest, int len)
+{
+	int more;
+
+	while (m->rule != RULE_DONE)
+	{
+		more = 1;
+		dest[0] = '\0';
+
+		switch (m->rule)
+		{
+			case RULE_NUMBERS:
+				if (m->index < (MUTATE_MAX_NUMBER + 1) * NUMBER_FORMS)
+					apply_number(m, m->index, dest, len);
+				else
+					more = 0;
+				break;
+			case RULE_AFFIXES:
+				if (m->index < (int)(sizeof(affixes) / sizeof(affixes[0])) * AFFIX_FORMS)
+					apply_affix(m, m->index, dest, len);
+				else
+					more = 0;
+				break;
+			case RULE_PAIRS:
+				more = apply_pair(m, m->index, dest, len);
+				break;
+			case RULE_SWAPS:
+				more = apply_swap(m, m->index, dest, len);
+				break;
+		}
+
+		if (!more)
+		{
+			m->rule++;
+			m->index = 0;
+			continue;
+		}
+
+		m->index++;
+		if (valid_label(dest) && (strcasecmp(dest, m->seed) != 0))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Frees the hits remembered so far.
+ */
+void mutate_free(void)
+{
+	int i;
+
+	pthread_mutex_lock(&hits_lock);
+	for (i = 0; i < hit_count; i++)
+		free(hits[i]);
+	hit_count = 0;
+	pthread_mutex_unlock(&hits_lock);
+}
@@ -0,0 +1,42 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef MUTATE_H
+#define MUTATE_H
+
+/* Highest number appended to a label */
+#define MUTATE_MAX_NUMBER 20
+
+/* Number of hits remembered for joining and swapping labels */
+#define MUTATE_MAX_HITS 256
+
+/* State of the mutations derived from a single label */
+typedef struct
+{
+	char seed[64];   // label the mutations are derived from
+	int rule;        // rule currently applied
+	int index;       // position within the rule
+} mutator;
+
+void mutator_init(mutator *m, const char *seed, int len);
+int mutator_next(mutator *m, char *dest, int len);
+void mutate_add_hit(const char *label, int len);
+void mutate_free(void);
+
+#endif /* MUTATE_H */
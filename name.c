@@ -0,0 +1,286 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "name.h"
+
+/* Decimal digits of every byte, for building in-addr.arpa names */
+static const struct
+{
+	unsigned char len;
+	char digits[3];
+} decimal[256] = {
+	{1, "0"}, {1, "1"}, {1, "2"}, {1, "3"}, {1, "4"}, {1, "5"}, {1, "6"}, {1, "7"},
+	{1, "8"}, {1, "9"}, {2, "10"}, {2, "11"}, {2, "12"}, {2, "13"}, {2, "14"}, {2, "15"},
+	{2, "16"}, {2, "17"}, {2, "18"}, {2, "19"}, {2, "20"}, {2, "21"}, {2, "22"}, {2, "23"},
+	{2, "24"}, {2, "25"}, {2, "26"}, {2, "27"}, {2, "28"}, {2, "29"}, {2, "30"}, {2, "31"},
+	{2, "32"}, {2, "33"}, {2, "34"}, {2, "35"}, {2, "36"}, {2, "37"}, {2, "38"}, {2, "39"},
+	{2, "40"}, {2, "41"}, {2, "42"}, {2, "43"}, {2, "44"}, {2, "45"}, {2, "46"}, {2, "47"},
+	{2, "48"}, {2, "49"}, {2, "50"}, {2, "51"}, {2, "52"}, {2, "53"}, {2, "54"}, {2, "55"},
+	{2, "56"}, {2, "57"}, {2, "58"}, {2, "59"}, {2, "60"}, {2, "61"}, {2, "62"}, {2, "63"},
+	{2, "64"}, {2, "65"}, {2, "66"}, {2, "67"}, {2, "68"}, {2, "69"}, {2, "70"}, {2, "71"},
+	{2, "72"}, {2, "73"}, {2, "74"}, {2, "75"}, {2, "76"}, {2, "77"}, {2, "78"}, {2, "79"},
+	{2, "80"}, {2, "81"}, {2, "82"}, {2, "83"}, {2, "84"}, {2, "85"}, {2, "86"}, {2, "87"},
+	{2, "88"}, {2, "89"}, {2, "90"}, {2, "91"}, {2, "92"}, {2, "93"}, {2, "94"}, {2, "95"},
+	{2, "96"}, {2, "97"}, {2, "98"}, {2, "99"}, {3, "100"}, {3, "101"}, {3, "102"}, {3, "103"},
+	{3, "104"}, {3, "105"}, {3, "106"}, {3, "107"}, {3, "108"}, {3, "109"}, {3, "110"}, {3, "111"},
+	{3, "112"}, {3, "113"}, {3, "114"}, {3, "115"}, {3, "116"}, {3, "117"}, {3, "118"}, {3, "119"},
+	{3, "120"}, {3, "121"}, {3, "122"}, {3, "123"}, {3, "124"}, {3, "125"}, {3, "126"}, {3, "127"},
+	{3, "128"}, {3, "129"}, {3, "130"}, {3, "131"}, {3, "132"}, {3, "133"}, {3, "134"}, {3, "135"},
+	{3, "136"}, {3, "137"}, {3, "138"}, {3, "139"}, {3, "140"}, {3, "141"}, {3, "142"}, {3, "143"},
+	{3, "144"}, {3, "145"}, {3, "146"}, {3, "147"}, {3, "148"}, {3, "149"}, {3, "150"}, {3, "151"},
+	{3, "152"}, {3, "153"}, {3, "154"}, {3, "155"}, {3, "156"}, {3, "157"}, {3, "158"}, {3, "159"},
+	{3, "160"}, {3, "161"}, {3, "162"}, {3, "163"}, {3, "164"}, {3, "165"}, {3, "166"}, {3, "167"},
+	{3, "168"}, {3, "169"}, {3, "170"}, {3, "171"}, {3, "172"}, {3, "173"}, {3, "174"}, {3, "175"},
+	{3, "176"}, {3, "177"}, {3, "178"}, {3, "179"}, {3, "180"}, {3, "181"}, {3, "182"}, {3, "183"},
+	{3, "184"}, {3, "185"}, {3, "186"}, {3, "187"}, {3, "188"}, {3, "189"}, {3, "190"}, {3, "191"},
+	{3, "192"}, {3, "193"}, {3, "194"}, {3, "195"}, {3, "196"}, {3, "197"}, {3, "198"}, {3, "199"},
+	{3, "200"}, {3, "201"}, {3, "202"}, {3, "203"}, {3, "204"}, {3, "205"}, {3, "206"}, {3, "207"},
+	{3, "208"}, {3, "209"}, {3, "210"}, {3, "211"}, {3, "212"}, {3, "213"}, {3, "214"}, {3, "215"},
+	{3, "216"}, {3, "217"}, {3, "218"}, {3, "219"}, {3, "220"}, {3, "221"}, {3, "222"}, {3, "223"},
+	{3, "224"}, {3, "225"}, {3, "226"}, {3, "227"}, {3, "228"}, {3, "229"}, {3, "230"}, {3, "231"},
+	{3, "232"}, {3, "233"}, {3, "234"}, {3, "235"}, {3, "236"}, {3, "237"}, {3, "238"}, {3, "239"},
+	{3, "240"}, {3, "241"}, {3, "242"}, {3, "243"}, {3, "244"}, {3, "245"}, {3, "246"}, {3, "247"},
+	{3, "248"}, {3, "249"}, {3, "250"}, {3, "251"}, {3, "252"}, {3, "253"}, {3, "254"}, {3, "255"},
+};
+
+static const char hex_digits[16] = "0123456789abcdef";
+
+/* Characters of the random labels used to probe a zone */
+static const char label_chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+
+#ifdef __SSE2__
+/*
+ * Copies 16 bytes from src to dest, lowering their case if lower is set.
+ * Returns a mask with a bit set for every dot among them.
+ */
+static inline unsigned int copy_block(const char *src, unsigned char *dest, int lower)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)src);
+	__m128i upper;
+
+	if (lower)
+	{
+		/* Bytes above 0x7f compare as negative and stay untouched */
+		upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+		v = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+	}
+	_mm_storeu_si128((__m128i *)dest, v);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+}
+#endif
+
+
+/*
+ * Writes a dotted name in wire format to wire, which must hold
+ * NAME_WIRE_MAX bytes. A trailing dot is optional and the empty name is
+ * the root. The labels are converted to lower case if lower is set.
+ * Returns the length of the wire format name or -1 if the name is not
+ * valid.
+ */
+int name_encode(const char *name, unsigned char *wire, int lower)
+{
+	int len = strlen(name);
+	int prev = 0;
+	int i = 0;
+	int at;
+	unsigned int dots;
+	unsigned char c;
+
+	if ((len > 0) && (name[len - 1] == '.'))
+		len--;
+	if (len == 0)
+	{
+		wire[0] = 0;
+		return 1;
+	}
+	if (len + 2 > NAME_WIRE_MAX)
+		return -1;
+
+	/* The name is copied one byte further on, so every dot lands where
+	 * the length of the label following it belongs */
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16)
+	{
+		for (dots = copy_block(name + i, wire + i + 1, lower); dots; dots &= dots - 1)
+		{
+			at = i + __builtin_ctz(dots) + 1;
+			if ((at - prev < 2) || (at - prev > 64))
+				return -1;
+			wire[prev] = at - prev - 1;
+			prev = at;
+		}
+	}
+#endif
+	for (; i < len; i++)
+	{
+		c = name[i];
+		if (c == '.')
+		{
+			if ((i + 1 - prev < 2) || (i + 1 - prev > 64))
+				return -1;
+			wire[prev] = i - prev;
+			prev = i + 1;
+		}
+		else if (lower && (c >= 'A') && (c <= 'Z'))
+		{
+			c |= 0x20;
+		}
+		wire[i + 1] = c;
+	}
+
+	if ((len + 1 - prev < 2) || (len + 1 - prev > 64))
+		return -1;
+	wire[prev] = len - prev;
+	wire[len + 1] = 0;
+
+	return len + 2;
+}
+
+
+/*
+ * Decodes a (possibly compressed) name starting at offset pos of a
+ * message of len bytes into dotted format. Returns the number of bytes
+ * the name occupies at pos, or -1 if the name is malformed or longer
+ * than namelen.
+ */
+int name_decode(const unsigned char *msg, int len, int pos, char *name, int namelen)
+{
+	int start = pos;
+	int count = -1;
+	int jumps = 0;
+	int p = 0;
+	int label;
+
+	while (1)
+	{
+		if (pos >= len)
+			return -1;
+
+		label = msg[pos];
+		if (label == 0)
+		{
+			if (count < 0)
+				count = pos + 1;
+			break;
+		}
+
+		if ((label & 0xC0) == 0xC0)
+		{
+			/* Compression pointer, guard against loops */
+			if ((pos + 1 >= len) || (++jumps > 32))
+				return -1;
+			if (count < 0)
+				count = pos + 2;
+			pos = ((label & 0x3F) << 8) | msg[pos + 1];
+			continue;
+		}
+
+		if ((label > 63) || (pos + 1 + label > len) || (p + label + 2 > namelen))
+			return -1;
+
+		memcpy(name + p, msg + pos + 1, label);
+		p += label;
+		name[p++] = '.';
+		pos += label + 1;
+	}
+
+	/* Drop the dot after the last label */
+	name[p ? p - 1 : 0] = '\0';
+
+	return count - start;
+}
+
+
+/*
+ * Writes the in-addr.arpa name of an IPv4 address given in network byte
+ * order to dest, which must hold 30 bytes. Returns the length of the
+ * name.
+ */
+int name_arpa4(const unsigned char *addr, char *dest)
+{
+	char *p = dest;
+	int i;
+
+	for (i = 3; i >= 0; i--)
+	{
+		/* Always copying three digits is cheaper than a loop */
+		memcpy(p, decimal[addr[i]].digits, 3);
+		p += decimal[addr[i]].len;
+		*p++ = '.';
+	}
+	memcpy(p, "in-addr.arpa", 13);
+
+	return p - dest + 12;
+}
+
+
+/*
+ * Writes the ip6.arpa name of an IPv6 address given in network byte
+ * order to dest, which must hold 73 bytes. Returns the length of the
+ * name.
+ */
+int name_arpa6(const unsigned char *addr, char *dest)
+{
+	char *p = dest;
+	int i;
+
+	for (i = 15; i >= 0; i--)
+	{
+		p[0] = hex_digits[addr[i] & 0x0f];
+		p[1] = '.';
+		p[2] = hex_digits[addr[i] >> 4];
+		p[3] = '.';
+		p += 4;
+	}
+	memcpy(p, "ip6.arpa", 9);
+
+	return p - dest + 8;
+}
+
+
+/*
+ * Writes a name made of a random label of NAME_RANDOM_LEN characters
+ * below zone to dest, which holds len bytes. seed is the state passed
+ * to rand_r. Returns the length of the name, or -1 if it does not fit.
+ */
+int name_random(const char *zone, char *dest, int len, unsigned int *seed)
+{
+	int i, ret;
+
+	if (len < NAME_RANDOM_LEN + 2)
+		return -1;
+
+	for (i = 0; i < NAME_RANDOM_LEN; i++)
+		dest[i] = label_chars[rand_r(seed) % (sizeof(label_chars) - 1)];
+	dest[i] = '.';
+
+	ret = snprintf(dest + i + 1, len - i - 1, "%s", zone);
+	if ((ret < 0) || (ret >= len - i - 1))
+		return -1;
+
+	return i + 1 + ret;
+}
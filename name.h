@@ -0,0 +1,33 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef NAME_H
+#define NAME_H
+
+#define NAME_WIRE_MAX    255  // longest name in wire format
+#define NAME_TEXT_MAX    256  // longest dotted name including the '\0'
+#define NAME_RANDOM_LEN  12   // length of the random labels built by name_random
+
+int name_encode(const char *name, unsigned char *wire, int lower);
+int name_decode(const unsigned char *msg, int len, int pos, char *name, int namelen);
+int name_arpa4(const unsigned char *addr, char *dest);
+int name_arpa6(const unsigned char *addr, char *dest);
+int name_random(const char *zone, char *dest, int len, unsigned int *seed);
+
+#endif /* NAME_H */
@@ -0,0 +1,150 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "net.h"
+
+
+/*
+ * Splits an address of the form host:port or port into its parts. A
+ * missing host is left empty. Returns -1 if the port is missing or a
+ * part is too long.
+ */
+static int split_address(const char *address, char *host, int hostlen, char *port, int portlen)
+{
+	const char *colon = strrchr(address, ':');
+
+	host[0] = '\0';
+	if (colon == NULL)
+	{
+		if ((int)strlen(address) >= portlen)
+			return -1;
+		strcpy(port, address);
+		return 0;
+	}
+
+	if ((colon - address >= hostlen) || (colon[1] == '\0') || ((int)strlen(colon + 1) >= portlen))
+		return -1;
+	memcpy(host, address, colon - address);
+	host[colon - address] = '\0';
+	strcpy(port, colon + 1);
+
+	return 0;
+}
+
+
+/*
+ * Opens a stream socket to an address, bound and listening if server
+ * is set. Addresses containing a slash name UNIX sockets, all others
+ * are host:port or just a port. Returns the socket or -1.
+ */
+static int open_socket(const char *address, int server)
+{
+	struct sockaddr_un un;
+	struct addrinfo hints, *ai, *p;
+	char host[256], port[32];
+	int s = -1;
+	int one = 1;
+
+	if (strchr(address, '/'))
+	{
+		if (strlen(address) >= sizeof(un.sun_path))
+			return -1;
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strcpy(un.sun_path, address);
+
+		s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (s < 0)
+			return -1;
+		if (server)
+		{
+			/* A socket file left by an earlier coordinator is stale */
+			unlink(address);
+			if ((bind(s, (struct sockaddr *)&un, sizeof(un)) < 0) || (listen(s, 64) < 0))
+			{
+				close(s);
+				return -1;
+			}
+		}
+		else if (connect(s, (struct sockaddr *)&un, sizeof(un)) < 0)
+		{
+			close(s);
+			return -1;
+		}
+		return s;
+	}
+
+	if (split_address(address, host, sizeof(host), port, sizeof(port)) < 0)
+		return -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = server ? AI_PASSIVE : 0;
+	if (getaddrinfo(host[0] ? host : NULL, port, &hints, &ai) != 0)
+		return -1;
+
+	for (p = ai; p; p = p->ai_next)
+	{
+		s = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (s < 0)
+			continue;
+		if (server)
+		{
+			setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if ((bind(s, p->ai_addr, p->ai_addrlen) == 0) && (listen(s, 64) == 0))
+				break;
+		}
+		else if (connect(s, p->ai_addr, p->ai_addrlen) == 0)
+		{
+			break;
+		}
+		close(s);
+		s = -1;
+	}
+	freeaddrinfo(ai);
+
+	return s;
+}
+
+
+/*
+ * Listens for connections on an address. Returns the socket or -1.
+ */
+int net_listen(const char *address)
+{
+	return open_socket(address, 1);
+}
+
+
+/*
+ * Connects to an address. Returns the socket or -1.
+ */
+int net_connect(const char *address)
+{
+	return open_socket(address, 0);
+}
@@ -0,0 +1,302 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include "dns.h"
+#include "log.h"
+#include "hashset.h"
+#include "nsec.h"
+
+/* Number of attempts per query before a walker gives up */
+#define NSEC_RETRIES 3
+
+/* State of a single walker thread */
+typedef struct
+{
+	int walker_id;
+	char *server;
+	char *zone;
+	char entry[256];  // name the walker enters the chain at
+	int queries;
+} walker_params;
+
+/* Names claimed by the walkers, shared by all of them */
+static hashset *claimed = NULL;
+static nsec_name *found = NULL;
+static pthread_mutex_t walk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Claims a name of the chain for the calling walker and records it with
+ * its record types. Returns 0 if another walker got there first, in which
+ * case the rest of the chain is already being walked.
+ */
+static int claim_name(char *name, unsigned char *typemap)
+{
+	nsec_name *entry;
+	int ret;
+
+	/* Only the walker claiming the name records it */
+	ret = hashset_add(claimed, hashset_hash_name(name));
+	if (ret <= 0)
+		return 0;
+
+	entry = (nsec_name *)malloc(sizeof(nsec_name));
+	entry->name = (char *)malloc(strlen(name) + 1);
+	strcpy(entry->name, name);
+	memcpy(entry->typemap, typemap, sizeof(entry->typemap));
+
+	pthread_mutex_lock(&walk_lock);
+	entry->next = found;
+	found = entry;
+	pthread_mutex_unlock(&walk_lock);
+
+	return 1;
+}
+
+
+/*
+ * Checks whether an NSEC record proves that name does not exist, i.e.
+ * name sorts between the record's owner and its next name. The last
+ * record of the chain points back to the apex.
+ */
+static int nsec_covers(struct DNS_RR *rr, char *name)
+{
+	if (dns_name_compare(rr->name, name) >= 0)
+		return 0;
+
+	if (dns_name_compare(rr->data, rr->name) <= 0)
+		return 1;
+
+	return dns_name_compare(name, rr->data) < 0;
+}
+
+
+/*
+ * Asks for the NSEC record of name. If name exists, its own record is
+ * returned; otherwise the record covering it is taken from the authority
+ * section. Returns 0 and fills owner, next and typemap on success.
+ */
+static int query_nsec(walker_params *w, char *name, char *owner, char *next, unsigned char *typemap)
+{
+	struct DNS_REPLY reply;
+	struct DNS_RR *rr = NULL;
+	int i, ret = -1, attempt;
+
+	for (attempt = 0; (attempt < NSEC_RETRIES) && (ret < 0); attempt++)
+	{
+		w->queries++;
+		ret = dns_query(w->server, name, DNS_RES_REC_NSEC, DNS_QF_DNSSEC, &reply);
+	}
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; (i < reply.ans_count) && (rr == NULL); i++)
+	{
+		if ((reply.answers[i].type == DNS_RES_REC_NSEC) &&
+			(dns_name_compare(reply.answers[i].name, name) == 0))
+			rr = &reply.answers[i];
+	}
+
+	for (i = 0; (i < reply.auth_count) && (rr == NULL); i++)
+	{
+		if ((reply.authority[i].type == DNS_RES_REC_NSEC) && nsec_covers(&reply.authority[i], name))
+			rr = &reply.authority[i];
+	}
+
+	if (rr == NULL)
+		return -7;  /* zone is not signed with NSEC */
+
+	strcpy(owner, rr->name);
+	strcpy(next, rr->data);
+	memcpy(typemap, rr->typemap, 32);
+
+	return 0;
+}
+
+
+/*
+ * Follows the NSEC chain from the walker's entry point until it wraps
+ * around to the apex or reaches a name claimed by another walker.
+ */
+static void *walk_chain(void *arg)
+{
+	walker_params *w = (walker_params *)arg;
+	unsigned char typemap[32];
+	char owner[256], next[256];
+	int ret;
+
+	ret = query_nsec(w, w->entry, owner, next, typemap);
+
+	while (ret == 0)
+	{
+		/* Owner names must belong to the zone */
+		if ((dns_name_compare(owner, w->zone) != 0) &&
+			((strlen(owner) <= strlen(w->zone)) ||
+			 (strcasecmp(owner + strlen(owner) - strlen(w->zone), w->zone) != 0)))
+		{
+			logline(LOG_ERROR, "    Walker %d: NSEC owner %s is outside of zone %s", w->walker_id, owner, w->zone);
+			break;
+		}
+
+		if (!claim_name(owner, typemap))
+		{
+			logline(LOG_DEBUG, "    Walker %d: Reached %s, which is already walked", w->walker_id, owner);
+			break;
+		}
+
+		logline(LOG_DEBUG, "    Walker %d: %s -> %s", w->walker_id, owner, next);
+
+		/* The chain wraps around to the apex at its end */
+		if (dns_name_compare(next, w->zone) == 0)
+			break;
+
+		/* The next query is sent as soon as the record arrives */
+		strcpy(w->entry, next);
+		ret = query_nsec(w, w->entry, owner, next, typemap);
+	}
+
+	if (ret < 0)
+		logline(LOG_DEBUG, "    Walker %d: Stopped at %s. Error code: %d", w->walker_id, w->entry, ret);
+
+	return NULL;
+}
+
+
+/*
+ * Enumerates all names of an NSEC signed zone by walking its NSEC chain.
+ * Walker 0 starts at the apex, the others enter the chain at names spread
+ * over the alphabet and stop once they reach a part another walker has
+ * already covered. Returns the number of queries sent or a negative
+ * value if the zone could not be walked.
+ */
+int nsec_walk(char *server, char *zone, nsec_name **names)
+{
+	static const char entries[] = "0abcdefghijklmnopqrstuvwxyz";
+	walker_params walkers[NSEC_WALKERS];
+	pthread_t threads[NSEC_WALKERS];
+	int i, queries = 0;
+
+	claimed = hashset_create(1024);
+	if (claimed == NULL)
+		return -1;
+	found = NULL;
+
+	for (i = 0; i < NSEC_WALKERS; i++)
+	{
+		walkers[i].walker_id = i;
+		walkers[i].server = server;
+		walkers[i].zone = zone;
+		walkers[i].queries = 0;
+		if (i == 0)
+			snprintf(walkers[i].entry, sizeof(walkers[i].entry), "%s", zone);
+		else
+			snprintf(walkers[i].entry, sizeof(walkers[i].entry), "%c.%s",
+				entries[i * (sizeof(entries) - 1) / NSEC_WALKERS], zone);
+
+		if (pthread_create(&threads[i], NULL, walk_chain, &walkers[i]))
+		{
+			logline(LOG_ERROR, "    Walker %d: Could not be created", i);
+			walkers[i].queries = -1;
+		}
+	}
+
+	for (i = 0; i < NSEC_WALKERS; i++)
+	{
+		if (walkers[i].queries >= 0)
+		{
+			pthread_join(threads[i], NULL);
+			queries += walkers[i].queries;
+		}
+	}
+
+	hashset_free(claimed);
+	claimed = NULL;
+
+	*names = found;
+	if (found == NULL)
+		return -7;
+
+	return queries;
+}
+
+
+/*
+ * Formats the record types of a type bitmap as a space separated list.
+ */
+void nsec_types_to_string(unsigned char *typemap, char *dest, int len)
+{
+	static const struct { int type; const char *name; } types[] =
+	{
+		{ 1, "A" }, { 2, "NS" }, { 5, "CNAME" }, { 6, "SOA" }, { 12, "PTR" },
+		{ 13, "HINFO" }, { 15, "MX" }, { 16, "TXT" }, { 28, "AAAA" }, { 29, "LOC" },
+		{ 33, "SRV" }, { 35, "NAPTR" }, { 39, "DNAME" }, { 43, "DS" }, { 44, "SSHFP" },
+		{ 46, "RRSIG" }, { 47, "NSEC" }, { 48, "DNSKEY" }, { 50, "NSEC3" },
+		{ 51, "NSEC3PARAM" }, { 52, "TLSA" }, { 99, "SPF" }
+	};
+	struct DNS_RR rr;
+	char name[16];
+	int i, j, known, pos = 0;
+
+	dest[0] = '\0';
+	memcpy(rr.typemap, typemap, sizeof(rr.typemap));
+
+	for (i = 1; i < 256; i++)
+	{
+		if (!dns_rr_has_type(&rr, i))
+			continue;
+
+		known = 0;
+		for (j = 0; j < (int)(sizeof(types) / sizeof(types[0])); j++)
+		{
+			if (types[j].type == i)
+			{
+				snprintf(name, sizeof(name), "%s", types[j].name);
+				known = 1;
+			}
+		}
+		if (!known)
+			snprintf(name, sizeof(name), "TYPE%d", i);
+
+		if (pos + (int)strlen(name) + 2 > len)
+			break;
+		pos += snprintf(dest + pos, len - pos, "%s%s", pos ? " " : "", name);
+	}
+}
+
+
+/*
+ * Frees a list of names found while walking.
+ */
+void nsec_free(nsec_name *names)
+{
+	nsec_name *next;
+
+	while (names)
+	{
+		next = names->next;
+		free(names->name);
+		free(names);
+		names = next;
+	}
+}
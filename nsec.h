@@ -0,0 +1,38 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef NSEC_H
+#define NSEC_H
+
+/* Number of threads walking the NSEC chain in parallel */
+#define NSEC_WALKERS 5
+
+/* Name found while walking the NSEC chain */
+typedef struct nsec_name
+{
+	char *name;
+	unsigned char typemap[32];  // record types present at this name
+	struct nsec_name *next;
+} nsec_name;
+
+int nsec_walk(char *server, char *zone, nsec_name **names);
+void nsec_types_to_string(unsigned char *typemap, char *dest, int len);
+void nsec_free(nsec_name *names);
+
+#endif /* NSEC_H */
@@ -0,0 +1,597 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "dns.h"
+#include "name.h"
+#include "log.h"
+#include "sha1.h"
+#include "nsec3.h"
+
+/* Number of random names hashed without finding an uncovered gap
+ * before the chain is considered complete */
+#define NSEC3_MAX_MISSES 200000
+
+/* Hash of the chain whose NSEC3 record is known */
+typedef struct
+{
+	unsigned char hash[20];
+	unsigned char next[20];
+	unsigned char typemap[32];
+} nsec3_range;
+
+/* Hash parameters of the zone */
+static int iterations = 0;
+static unsigned char salt[255];
+static int saltlen = 0;
+static int have_params = 0;
+
+/* Known records, sorted by hash to find the gap a hash falls into */
+static nsec3_range *ranges = NULL;
+static int range_count = 0;
+static int range_size = 0;
+
+/* Every hash known to exist (owners and next hashes), sorted */
+static nsec3_range *known = NULL;
+static int known_count = 0;
+
+/* Arguments of a matching thread */
+typedef struct
+{
+	char **labels;
+	int first;
+	int last;
+	char *zone;
+	nsec3_match *matches;
+	int matched;
+} crack_params;
+
+
+/*
+ * Computes the NSEC3 hash of a name using the zone's parameters.
+ */
+static int hash_name(const char *name, unsigned char digest[20])
+{
+	unsigned char buffer[512];
+	int i, len;
+
+	len = name_encode(name, buffer, 1);
+	if (len < 0)
+		return -1;
+
+	memcpy(buffer + len, salt, saltlen);
+	sha1(buffer, len + saltlen, digest);
+
+	for (i = 0; i < iterations; i++)
+	{
+		memcpy(buffer, digest, 20);
+		memcpy(buffer + 20, salt, saltlen);
+		sha1(buffer, 20 + saltlen, digest);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Finds the record whose range a hash falls into. Returns the index
+ * of the last record with a hash less than or equal to hash, or -1 if
+ * hash sorts before all known records.
+ */
+static int find_range(const unsigned char *hash)
+{
+	int lo = 0, hi = range_count - 1, mid, found = -1;
+
+	while (lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		if (memcmp(ranges[mid].hash, hash, 20) <= 0)
+		{
+			found = mid;
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+
+	return found;
+}
+
+
+/*
+ * Checks whether the collected records already tell something about
+ * hash, i.e. it is an existing hash or lies in a known gap.
+ */
+static int is_covered(const unsigned char *hash)
+{
+	nsec3_range *r;
+	int i;
+
+	if (range_count == 0)
+		return 0;
+
+	i = find_range(hash);
+	if (i < 0)
+	{
+		/* Only covered by the last record if it wraps around */
+		r = &ranges[range_count - 1];
+		return (memcmp(r->next, r->hash, 20) <= 0) && (memcmp(hash, r->next, 20) < 0);
+	}
+
+	r = &ranges[i];
+	if (memcmp(r->hash, hash, 20) == 0)
+		return 1;
+	if (memcmp(r->next, r->hash, 20) <= 0)
+		return 1;  /* last record of the chain */
+
+	return memcmp(hash, r->next, 20) < 0;
+}
+
+
+/*
+ * Checks whether the collected records form a closed chain, in which
+ * case every hash of the zone is known.
+ */
+static int chain_complete(void)
+{
+	int i, j;
+
+	for (i = 0; i < range_count; i++)
+	{
+		j = find_range(ranges[i].next);
+		if ((j < 0) || (memcmp(ranges[j].hash, ranges[i].next, 20) != 0))
+			return 0;
+	}
+
+	return range_count > 0;
+}
+
+
+/*
+ * Adds an NSEC3 record to the sorted list of known records. Returns 1
+ * if the record was new, -1 if out of memory.
+ */
+static int add_range(char *zone, struct DNS_RR *rr)
+{
+	nsec3_range *grown;
+	unsigned char hash[20], next[20], rrsalt[255];
+	char salthex[512], nexthash[64];
+	int rriterations, rrsaltlen = 0, i;
+	unsigned int byte;
+
+	/* Owner is <base32hex hash>.<zone> */
+	if (strchr(rr->name, '.') == NULL)
+		return 0;
+	if ((strchr(rr->name, '.') - rr->name != 32) ||
+		(dns_base32hex_decode(rr->name, 32, hash) != 20))
+		return 0;
+	if (dns_name_compare(strchr(rr->name, '.') + 1, zone) != 0)
+		return 0;
+
+	if (sscanf(rr->data, "%d %511s %63s", &rriterations, salthex, nexthash) != 3)
+		return 0;
+	if ((strlen(nexthash) != 32) || (dns_base32hex_decode(nexthash, 32, next) != 20))
+		return 0;
+	if (strcmp(salthex, "-") != 0)
+	{
+		for (i = 0; (salthex[i * 2] != '\0') && (i < 255); i++)
+		{
+			if (sscanf(salthex + i * 2, "%2x", &byte) != 1)
+				return 0;
+			rrsalt[i] = byte;
+		}
+		rrsaltlen = i;
+	}
+
+	if (!have_params)
+	{
+		iterations = rriterations;
+		saltlen = rrsaltlen;
+		memcpy(salt, rrsalt, saltlen);
+		have_params = 1;
+		logline(LOG_INFO, "    NSEC3 parameters: %d iterations, salt %s", iterations, salthex);
+	}
+
+	i = find_range(hash);
+	if ((i >= 0) && (memcmp(ranges[i].hash, hash, 20) == 0))
+		return 0;
+
+	if (range_count == range_size)
+	{
+		grown = (nsec3_range *)realloc(ranges, (range_size ? range_size * 2 : 256) * sizeof(nsec3_range));
+		if (grown == NULL)
+			return -1;
+		ranges = grown;
+		range_size = range_size ? range_size * 2 : 256;
+	}
+
+	/* Insert after the record sorting before the new one */
+	i++;
+	memmove(&ranges[i + 1], &ranges[i], (range_count - i) * sizeof(nsec3_range));
+	memcpy(ranges[i].hash, hash, 20);
+	memcpy(ranges[i].next, next, 20);
+	memcpy(ranges[i].typemap, rr->typemap, 32);
+	range_count++;
+
+	return 1;
+}
+
+
+/*
+ * Collects the NSEC3 records of a zone by querying random names. Once
+ * the hash parameters are known, names are hashed locally first and
+ * only those falling into a gap of the chain not seen yet are queried.
+ * Returns the number of queries sent, -3 if out of memory or another
+ * negative value if the zone is not signed using NSEC3.
+ */
+int nsec3_collect(char *server, char *zone, int max_queries)
+{
+	struct DNS_REPLY reply;
+	unsigned char hash[20];
+	char name[NAME_TEXT_MAX];
+	unsigned int seed;
+	int i, ret, queries = 0, misses = 0, unsigned_replies = 0, added, new_range;
+
+	seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+
+	while (queries < max_queries)
+	{
+		if (name_random(zone, name, sizeof(name), &seed) < 0)
+			return -1;
+
+		/* Skip names whose answer is known already */
+		if (have_params)
+		{
+			if (hash_name(name, hash) < 0)
+				return -5;
+			if (is_covered(hash))
+			{
+				if (++misses > NSEC3_MAX_MISSES)
+					break;
+				continue;
+			}
+			misses = 0;
+		}
+
+		queries++;
+		ret = dns_query(server, name, DNS_RES_REC_A, DNS_QF_DNSSEC, &reply);
+		if (ret < 0)
+			continue;
+
+		added = 0;
+		for (i = 0; i < reply.auth_count; i++)
+		{
+			if (reply.authority[i].type != DNS_RES_REC_NSEC3)
+				continue;
+			new_range = add_range(zone, &reply.authority[i]);
+			if (new_range < 0)
+				return -3;
+			added += new_range;
+		}
+
+		if (!have_params)
+		{
+			if (++unsigned_replies >= 3)
+				return -7;
+			continue;
+		}
+
+		logline(LOG_DEBUG, "    Query %d: %d new NSEC3 records, %d known", queries, added, range_count);
+
+		if (added && chain_complete())
+		{
+			logline(LOG_INFO, "    NSEC3 chain is complete.");
+			break;
+		}
+	}
+
+	return have_params ? queries : -7;
+}
+
+
+/*
+ * Looks up a hash among the collected records. Returns the record or
+ * NULL if the hash is unknown.
+ */
+static nsec3_range *lookup_hash(const unsigned char *hash)
+{
+	int lo = 0, hi = known_count - 1, mid, cmp;
+
+	while (lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		cmp = memcmp(known[mid].hash, hash, 20);
+		if (cmp == 0)
+			return &known[mid];
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Orders records by hash for qsort.
+ */
+static int compare_hash(const void *a, const void *b)
+{
+	return memcmp(((const nsec3_range *)a)->hash, ((const nsec3_range *)b)->hash, 20);
+}
+
+
+/*
+ * Builds the sorted list of all hashes known to exist. Next hashes of
+ * records are existing names too, even if their own record was never
+ * seen; their record types are unknown.
+ */
+static void build_known(void)
+{
+	int i, j;
+
+	known = (nsec3_range *)malloc((range_count * 2 + 1) * sizeof(nsec3_range));
+	memcpy(known, ranges, range_count * sizeof(nsec3_range));
+	known_count = range_count;
+
+	for (i = 0; i < range_count; i++)
+	{
+		j = find_range(ranges[i].next);
+		if ((j >= 0) && (memcmp(ranges[j].hash, ranges[i].next, 20) == 0))
+			continue;
+
+		memcpy(known[known_count].hash, ranges[i].next, 20);
+		memset(known[known_count].next, 0, 20);
+		memset(known[known_count].typemap, 0, 32);
+		known_count++;
+	}
+
+	qsort(known, known_count, sizeof(nsec3_range), compare_hash);
+}
+
+
+/*
+ * Records a name whose hash is known to exist in the zone.
+ */
+static void add_match(crack_params *p, const char *label, nsec3_range *r)
+{
+	nsec3_match *m;
+
+	m = (nsec3_match *)malloc(sizeof(nsec3_match));
+	m->name = (char *)malloc(strlen(label) + strlen(p->zone) + 2);
+	sprintf(m->name, "%s.%s", label, p->zone);
+	memcpy(m->typemap, r->typemap, 32);
+	m->next = p->matches;
+	p->matches = m;
+	p->matched++;
+}
+
+
+/*
+ * Hashes the candidate labels of a slice of the wordlist, SHA1_LANES
+ * names at a time. Names too long for a single SHA-1 block are hashed
+ * one by one.
+ */
+static void *crack_slice(void *arg)
+{
+	crack_params *p = (crack_params *)arg;
+	unsigned char blocks[SHA1_LANES][64];
+	unsigned char wire[512], digest[20];
+	unsigned long long bits;
+	sha1_vec w[16], iter_w[16], state[5];
+	char name[512];
+	int lane_idx[SHA1_LANES];
+	int i, j, k, t, lane, len, lanes, multi_iter;
+	nsec3_range *r;
+
+	/* Iterations hash the previous digest and the salt. These blocks
+	 * only differ in the digest, so the rest is prepared once. */
+	multi_iter = (20 + saltlen <= 55);
+	if (multi_iter)
+	{
+		memset(blocks[0], 0, 64);
+		memcpy(blocks[0] + 20, salt, saltlen);
+		blocks[0][20 + saltlen] = 0x80;
+		bits = (unsigned long long)(20 + saltlen) * 8;
+		for (k = 0; k < 8; k++)
+			blocks[0][63 - k] = (bits >> (k * 8)) & 0xFF;
+		for (lane = 1; lane < SHA1_LANES; lane++)
+			memcpy(blocks[lane], blocks[0], 64);
+		sha1_multi_load(iter_w, blocks);
+	}
+
+	i = p->first;
+	while (i < p->last)
+	{
+		lanes = 0;
+		memset(blocks, 0, sizeof(blocks));
+
+		/* Fill the lanes with names that fit into one block */
+		while ((lanes < SHA1_LANES) && (i < p->last))
+		{
+			snprintf(name, sizeof(name), "%s.%s", p->labels[i], p->zone);
+			len = name_encode(name, wire, 1);
+			if (len < 0)
+			{
+				i++;
+				continue;
+			}
+			memcpy(wire + len, salt, saltlen);
+			len += saltlen;
+
+			if ((len > 55) || !multi_iter)
+			{
+				if ((hash_name(name, digest) == 0) && ((r = lookup_hash(digest)) != NULL))
+					add_match(p, p->labels[i], r);
+				i++;
+				continue;
+			}
+
+			memcpy(blocks[lanes], wire, len);
+			blocks[lanes][len] = 0x80;
+			bits = (unsigned long long)len * 8;
+			for (k = 0; k < 8; k++)
+				blocks[lanes][63 - k] = (bits >> (k * 8)) & 0xFF;
+			lane_idx[lanes++] = i++;
+		}
+
+		if (lanes == 0)
+			continue;
+
+		sha1_multi_load(w, blocks);
+		sha1_multi(w, state);
+
+		for (j = 0; j < iterations; j++)
+		{
+			for (t = 0; t < 5; t++)
+				iter_w[t] = state[t];
+			sha1_multi(iter_w, state);
+		}
+
+		for (lane = 0; lane < lanes; lane++)
+		{
+			for (t = 0; t < 5; t++)
+			{
+				digest[t * 4] = (state[t][lane] >> 24) & 0xFF;
+				digest[t * 4 + 1] = (state[t][lane] >> 16) & 0xFF;
+				digest[t * 4 + 2] = (state[t][lane] >> 8) & 0xFF;
+				digest[t * 4 + 3] = state[t][lane] & 0xFF;
+			}
+			if ((r = lookup_hash(digest)) != NULL)
+				add_match(p, p->labels[lane_idx[lane]], r);
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Hashes the candidate labels below zone offline and compares them with
+ * the collected hashes. The work is split among all online processors.
+ * Returns the number of names found.
+ */
+int nsec3_crack(char **labels, int count, char *zone, nsec3_match **matches)
+{
+	crack_params *slices;
+	pthread_t *threads;
+	nsec3_match *m;
+	int i, nthreads, matched = 0;
+
+	*matches = NULL;
+	if (!have_params)
+		return -7;
+
+	build_known();
+
+	nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+
+	slices = (crack_params *)calloc(nthreads, sizeof(crack_params));
+	threads = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+
+	logline(LOG_INFO, "    Hashing %d candidates using %d threads...", count, nthreads);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		slices[i].labels = labels;
+		slices[i].first = (int)((long long)count * i / nthreads);
+		slices[i].last = (int)((long long)count * (i + 1) / nthreads);
+		slices[i].zone = zone;
+		if (pthread_create(&threads[i], NULL, crack_slice, &slices[i]))
+		{
+			/* Do the slice ourselves */
+			crack_slice(&slices[i]);
+			slices[i].first = -1;
+		}
+	}
+
+	for (i = 0; i < nthreads; i++)
+	{
+		if (slices[i].first >= 0)
+			pthread_join(threads[i], NULL);
+
+		/* Merge matches of this slice */
+		if (slices[i].matches)
+		{
+			m = slices[i].matches;
+			while (m->next)
+				m = m->next;
+			m->next = *matches;
+			*matches = slices[i].matches;
+		}
+		matched += slices[i].matched;
+	}
+
+	free(slices);
+	free(threads);
+	free(known);
+	known = NULL;
+	known_count = 0;
+
+	return matched;
+}
+
+
+/*
+ * Returns the number of NSEC3 records collected.
+ */
+int nsec3_hash_count(void)
+{
+	return range_count;
+}
+
+
+/*
+ * Frees the collected records.
+ */
+void nsec3_free(void)
+{
+	free(ranges);
+	ranges = NULL;
+	range_count = 0;
+	range_size = 0;
+	have_params = 0;
+}
+
+
+/*
+ * Frees a list of matches.
+ */
+void nsec3_free_matches(nsec3_match *matches)
+{
+	nsec3_match *next;
+
+	while (matches)
+	{
+		next = matches->next;
+		free(matches->name);
+		free(matches);
+		matches = next;
+	}
+}
@@ -0,0 +1,40 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef NSEC3_H
+#define NSEC3_H
+
+/* Default number of queries used to collect the hashes of a zone */
+#define NSEC3_MAX_QUERIES 500
+
+/* Name whose hash matched one of the collected hashes */
+typedef struct nsec3_match
+{
+	char *name;
+	unsigned char typemap[32];  // record types present at this name
+	struct nsec3_match *next;
+} nsec3_match;
+
+int nsec3_collect(char *server, char *zone, int max_queries);
+int nsec3_crack(char **labels, int count, char *zone, nsec3_match **matches);
+int nsec3_hash_count(void);
+void nsec3_free(void);
+void nsec3_free_matches(nsec3_match *matches);
+
+#endif /* NSEC3_H */
@@ -0,0 +1,203 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <string.h>
+#include "sha1.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define SHA1_H0 0x67452301
+#define SHA1_H1 0xEFCDAB89
+#define SHA1_H2 0x98BADCFE
+#define SHA1_H3 0x10325476
+#define SHA1_H4 0xC3D2E1F0
+
+
+/*
+ * Compresses a single 64 byte block into state.
+ */
+static void sha1_block(unsigned int state[5], const unsigned char *block)
+{
+	unsigned int w[80];
+	unsigned int a, b, c, d, e, f, k, tmp;
+	int t;
+
+	for (t = 0; t < 16; t++)
+	{
+		w[t] = ((unsigned int)block[t * 4] << 24) | ((unsigned int)block[t * 4 + 1] << 16) |
+			((unsigned int)block[t * 4 + 2] << 8) | (unsigned int)block[t * 4 + 3];
+	}
+	for (t = 16; t < 80; t++)
+		w[t] = ROL(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+
+	for (t = 0; t < 80; t++)
+	{
+		if (t < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if (t < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if (t < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+
+		tmp = ROL(a, 5) + f + e + k + w[t];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = tmp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+
+/*
+ * Computes the SHA-1 digest of a message of any length.
+ */
+void sha1(const unsigned char *data, int len, unsigned char digest[20])
+{
+	unsigned int state[5] = { SHA1_H0, SHA1_H1, SHA1_H2, SHA1_H3, SHA1_H4 };
+	unsigned char block[64];
+	unsigned long long bits = (unsigned long long)len * 8;
+	int i, rest;
+
+	for (i = 0; i + 64 <= len; i += 64)
+		sha1_block(state, data + i);
+
+	/* Pad the remaining bytes, the length goes into the last 8 bytes */
+	rest = len - i;
+	memset(block, 0, sizeof(block));
+	memcpy(block, data + i, rest);
+	block[rest] = 0x80;
+	if (rest >= 56)
+	{
+		sha1_block(state, block);
+		memset(block, 0, sizeof(block));
+	}
+	for (i = 0; i < 8; i++)
+		block[63 - i] = (bits >> (i * 8)) & 0xFF;
+	sha1_block(state, block);
+
+	for (i = 0; i < 5; i++)
+	{
+		digest[i * 4] = (state[i] >> 24) & 0xFF;
+		digest[i * 4 + 1] = (state[i] >> 16) & 0xFF;
+		digest[i * 4 + 2] = (state[i] >> 8) & 0xFF;
+		digest[i * 4 + 3] = state[i] & 0xFF;
+	}
+}
+
+
+/*
+ * Loads one padded 64 byte block per lane into the message words
+ * used by sha1_multi.
+ */
+void sha1_multi_load(sha1_vec w[16], unsigned char blocks[SHA1_LANES][64])
+{
+	int t, lane;
+	const unsigned char *p;
+
+	for (t = 0; t < 16; t++)
+	{
+		for (lane = 0; lane < SHA1_LANES; lane++)
+		{
+			p = &blocks[lane][t * 4];
+			w[t][lane] = ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+				((unsigned int)p[2] << 8) | (unsigned int)p[3];
+		}
+	}
+}
+
+
+/*
+ * Computes the SHA-1 digests of SHA1_LANES single block messages at
+ * once. Every lane of w holds one padded message block; the digest
+ * words of each lane are returned in state. The message schedule is
+ * kept in a 16 word ring so it stays in vector registers.
+ */
+void sha1_multi(sha1_vec w[16], sha1_vec state[5])
+{
+	sha1_vec a, b, c, d, e, f, tmp;
+	sha1_vec x[16];
+	int t;
+
+	for (t = 0; t < 16; t++)
+		x[t] = w[t];
+
+	a = (sha1_vec){ 0 } + SHA1_H0;
+	b = (sha1_vec){ 0 } + SHA1_H1;
+	c = (sha1_vec){ 0 } + SHA1_H2;
+	d = (sha1_vec){ 0 } + SHA1_H3;
+	e = (sha1_vec){ 0 } + SHA1_H4;
+
+	for (t = 0; t < 80; t++)
+	{
+		if (t >= 16)
+		{
+			tmp = x[(t - 3) & 15] ^ x[(t - 8) & 15] ^ x[(t - 14) & 15] ^ x[t & 15];
+			x[t & 15] = ROL(tmp, 1);
+		}
+
+		if (t < 20)
+			f = ((b & c) | (~b & d)) + 0x5A827999;
+		else if (t < 40)
+			f = (b ^ c ^ d) + 0x6ED9EBA1;
+		else if (t < 60)
+			f = ((b & c) | (b & d) | (c & d)) + 0x8F1BBCDC;
+		else
+			f = (b ^ c ^ d) + 0xCA62C1D6;
+
+		tmp = ROL(a, 5) + f + e + x[t & 15];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = tmp;
+	}
+
+	state[0] = a + SHA1_H0;
+	state[1] = b + SHA1_H1;
+	state[2] = c + SHA1_H2;
+	state[3] = d + SHA1_H3;
+	state[4] = e + SHA1_H4;
+}
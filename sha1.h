@@ -0,0 +1,33 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef SHA1_H
+#define SHA1_H
+
+/* Number of messages hashed in parallel by sha1_multi */
+#define SHA1_LANES 8
+
+/* One 32 bit word of each lane, processed with SIMD instructions */
+typedef unsigned int sha1_vec __attribute__((vector_size(SHA1_LANES * 4)));
+
+void sha1(const unsigned char *data, int len, unsigned char digest[20]);
+void sha1_multi(sha1_vec w[16], sha1_vec state[5]);
+void sha1_multi_load(sha1_vec w[16], unsigned char blocks[SHA1_LANES][64]);
+
+#endif /* SHA1_H */
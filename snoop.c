@@ -0,0 +1,305 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include "dns.h"
+#include "name.h"
+#include "log.h"
+#include "snoop.h"
+
+/* Rank of a name in the recursive sweep, lower ranks come first */
+#define RANK_CACHED   0
+#define RANK_NEIGHBOR 1
+#define RANK_UNKNOWN  2
+#define RANK_NEGATIVE 3
+#define RANK_COUNT    4
+
+/* Work shared by all snooping threads */
+typedef struct
+{
+	char **servers;
+	int server_count;
+	char **hosts;
+	int count;
+	unsigned char *states;
+	int next;  // index of the next host to snoop, taken atomically
+} snoop_job;
+
+
+/*
+ * Derives the cache state of a name from the reply to a query sent
+ * without the recursion desired bit.
+ */
+static int classify_reply(struct DNS_REPLY *reply)
+{
+	int i;
+
+	if (reply->rcode == DNS_RCODE_NXDOMAIN)
+		return SNOOP_NEGATIVE;
+	if (reply->rcode != DNS_RCODE_NOERROR)
+		return SNOOP_UNKNOWN;
+	if (reply->ans_count > 0)
+		return SNOOP_CACHED;
+
+	/* A cached NODATA answer carries the SOA record of the zone, while
+	 * an uncached name is answered with a referral to name servers */
+	for (i = 0; i < reply->auth_count; i++)
+	{
+		if (reply->authority[i].type == DNS_RES_REC_SOA)
+			return SNOOP_CACHED;
+	}
+
+	return SNOOP_UNKNOWN;
+}
+
+
+/*
+ * Checks whether a resolver can be snooped. It must answer queries
+ * without recursion and must not recurse anyway when asked not to,
+ * which is tested with a random name below zone. Returns 0 if the
+ * resolver can be snooped, -1 if not and -2 if it did not answer.
+ */
+int snoop_check_server(char *server, char *zone)
+{
+	struct DNS_REPLY reply;
+	char host[NAME_TEXT_MAX];
+	unsigned int seed;
+
+	seed = (unsigned int)time(NULL) ^ (unsigned int)(unsigned long)server;
+	if (name_random(zone, host, sizeof(host), &seed) < 0)
+		return -1;
+
+	if (dns_query(server, host, DNS_RES_REC_A, DNS_QF_NORECURSE, &reply) < 0)
+		return -2;
+
+	if ((reply.rcode != DNS_RCODE_NOERROR) && (reply.rcode != DNS_RCODE_NXDOMAIN))
+	{
+		logline(LOG_DEBUG, "    Resolver %s refuses non-recursive queries (rcode %d)", server, reply.rcode);
+		return -1;
+	}
+	if (reply.ans_count > 0)
+	{
+		logline(LOG_DEBUG, "    Resolver %s recurses although asked not to", server);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Snoops the caches of the resolvers for the hosts handed out by the
+ * job until none are left.
+ */
+static void *snoop_hosts(void *arg)
+{
+	snoop_job *job = (snoop_job *)arg;
+	struct DNS_REPLY *reply;
+	int i, j, ret;
+
+	/* A reply is too large for the thread stack */
+	reply = (struct DNS_REPLY *)malloc(sizeof(struct DNS_REPLY));
+	if (reply == NULL)
+		return NULL;
+
+	while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count)
+	{
+		job->states[i] = SNOOP_UNKNOWN;
+
+		/* A name counts as cached if any of the resolvers holds it */
+		for (j = 0; j < job->server_count; j++)
+		{
+			ret = dns_query(job->servers[j], job->hosts[i], DNS_RES_REC_A, DNS_QF_NORECURSE, reply);
+			if (ret < 0)
+			{
+				logline(LOG_DEBUG, "    Snooping %s at %s failed. Error code: %d", job->hosts[i], job->servers[j], ret);
+				continue;
+			}
+
+			ret = classify_reply(reply);
+			if (ret == SNOOP_CACHED)
+			{
+				logline(LOG_DEBUG, "    %s is cached by %s", job->hosts[i], job->servers[j]);
+				job->states[i] = SNOOP_CACHED;
+				break;
+			}
+			if (ret == SNOOP_NEGATIVE)
+				job->states[i] = SNOOP_NEGATIVE;
+		}
+	}
+
+	free(reply);
+	return NULL;
+}
+
+
+/*
+ * Asks the resolvers without recursion whether they hold each of the
+ * hosts in their cache and stores the SNOOP_* state of hosts[i] in
+ * states[i]. The queries put no recursion load on the resolvers.
+ * Returns the number of cached hosts or -1 on error.
+ */
+int snoop_cache(char *servers[], int server_count, char **hosts, int count, unsigned char *states)
+{
+	pthread_t threads[SNOOP_THREADS];
+	snoop_job job;
+	int i, started, cached = 0;
+
+	job.servers = servers;
+	job.server_count = server_count;
+	job.hosts = hosts;
+	job.count = count;
+	job.states = states;
+	job.next = 0;
+
+	memset(states, SNOOP_UNKNOWN, count);
+
+	for (started = 0; started < SNOOP_THREADS; started++)
+	{
+		if (pthread_create(&threads[started], NULL, snoop_hosts, &job))
+		{
+			logline(LOG_ERROR, "    Snooping thread %d: Could not be created", started + 1);
+			break;
+		}
+	}
+	if (started == 0)
+		return -1;
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < count; i++)
+	{
+		if (states[i] == SNOOP_CACHED)
+			cached++;
+	}
+
+	return cached;
+}
+
+
+/*
+ * Writes the stem of a host to dest: the first label without digits
+ * and dashes, followed by the rest of the name. Hosts like www1,
+ * www-2 and www share a stem. Returns -1 if the label has no letters.
+ */
+static int host_stem(const char *host, char *dest, int len)
+{
+	int i = 0;
+
+	for (; *host && (*host != '.'); host++)
+	{
+		if (isdigit((unsigned char)*host) || (*host == '-'))
+			continue;
+		if (i < len - 1)
+			dest[i++] = tolower((unsigned char)*host);
+	}
+	if (i == 0)
+		return -1;
+
+	snprintf(dest + i, len - i, "%s", host);
+	return 0;
+}
+
+
+/*
+ * Compares two stems for qsort and bsearch.
+ */
+static int compare_stems(const void *a, const void *b)
+{
+	return strcasecmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/*
+ * Orders the hosts for the recursive sweep based on their cache states:
+ * cached hosts first, then the hosts sharing a stem with a cached one,
+ * then the unknown ones and last those with a cached NXDOMAIN. The
+ * order within each group is kept. order receives the indexes of the
+ * hosts in the new order. Returns the number of neighbors moved up or
+ * -1 on error.
+ */
+int snoop_rank(char **hosts, unsigned char *states, int count, int *order)
+{
+	char **stems;
+	char stem[256], *key;
+	unsigned char *ranks;
+	int start[RANK_COUNT + 1] = { 0 };
+	int i, stem_count = 0, neighbors = 0;
+
+	stems = (char **)malloc(sizeof(char *) * (count + 1));
+	ranks = (unsigned char *)malloc(count + 1);
+	if ((stems == NULL) || (ranks == NULL))
+	{
+		free(stems);
+		free(ranks);
+		return -1;
+	}
+
+	/* Collect the stems of all cached hosts */
+	for (i = 0; i < count; i++)
+	{
+		if ((states[i] == SNOOP_CACHED) && (host_stem(hosts[i], stem, sizeof(stem)) == 0))
+			stems[stem_count++] = strdup(stem);
+	}
+	qsort(stems, stem_count, sizeof(char *), compare_stems);
+
+	for (i = 0; i < count; i++)
+	{
+		if (states[i] == SNOOP_CACHED)
+		{
+			ranks[i] = RANK_CACHED;
+		}
+		else if (states[i] == SNOOP_NEGATIVE)
+		{
+			ranks[i] = RANK_NEGATIVE;
+		}
+		else
+		{
+			ranks[i] = RANK_UNKNOWN;
+			key = stem;
+			if ((stem_count > 0) && (host_stem(hosts[i], stem, sizeof(stem)) == 0) &&
+				bsearch(&key, stems, stem_count, sizeof(char *), compare_stems))
+			{
+				ranks[i] = RANK_NEIGHBOR;
+				neighbors++;
+			}
+		}
+		start[ranks[i] + 1]++;
+	}
+
+	/* Stable counting sort by rank */
+	for (i = 1; i <= RANK_COUNT; i++)
+		start[i] += start[i - 1];
+	for (i = 0; i < count; i++)
+		order[start[ranks[i]]++] = i;
+
+	for (i = 0; i < stem_count; i++)
+		free(stems[i]);
+	free(stems);
+	free(ranks);
+
+	return neighbors;
+}
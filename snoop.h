@@ -0,0 +1,35 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef SNOOP_H
+#define SNOOP_H
+
+/* Number of threads sending snooping queries in parallel */
+#define SNOOP_THREADS 10
+
+/* Cache state of a name as reported by a resolver */
+#define SNOOP_UNKNOWN  0  // not cached, or the resolver did not tell
+#define SNOOP_CACHED   1  // resolver holds records or a NODATA entry
+#define SNOOP_NEGATIVE 2  // resolver holds a cached NXDOMAIN
+
+int snoop_check_server(char *server, char *zone);
+int snoop_cache(char *servers[], int server_count, char **hosts, int count, unsigned char *states);
+int snoop_rank(char **hosts, unsigned char *states, int count, int *order);
+
+#endif /* SNOOP_H */
@@ -0,0 +1,569 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include "log.h"
+#include "trace.h"
+#include "stats.h"
+
+/* Counters of one thread. Only the thread itself writes them, readers
+ * sum up the counters of all threads without taking a lock */
+typedef struct stats_counters
+{
+	unsigned long sent;
+	unsigned long answered;
+	unsigned long timeouts;
+	unsigned long failed;
+	unsigned long retries;
+	unsigned long rcodes[16];
+	unsigned long queries[STATS_MAX_SERVERS];
+	unsigned long lost[STATS_MAX_SERVERS];
+	unsigned long long last_answer[STATS_MAX_SERVERS];  // microseconds since the epoch
+	unsigned int latency[STATS_MAX_SERVERS][STATS_BUCKETS];
+	int orphaned;        // thread has ended, counters may be taken over
+	struct stats_counters *next;
+} stats_counters;
+
+/* Counters are only written by their thread, a plain increment would
+ * do if readers did not need to see whole values */
+#define BUMP(counter) __atomic_store_n(&(counter), (counter) + 1, __ATOMIC_RELAXED)
+#define READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+static stats_counters *threads = NULL;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t counters_key;
+static int key_created = 0;
+static unsigned int server_addrs[STATS_MAX_SERVERS];
+static char server_names[STATS_MAX_SERVERS][16];
+static int server_count = 0;
+static unsigned long long started;
+static double cpu_started;
+static pthread_t progress;
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress_cond = PTHREAD_COND_INITIALIZER;
+static int progress_interval = 0;
+static int stopping = 0;
+
+
+/*
+ * Returns the CPU time used by the process so far, in seconds.
+ */
+static double cpu_seconds(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		return 0;
+
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+		(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+
+/*
+ * Returns the bucket counting a latency of us microseconds.
+ */
+static int bucket_of(unsigned int us)
+{
+	int shift;
+
+	if (us < STATS_SUB_BUCKETS)
+		return us;
+	shift = 31 - __builtin_clz(us) - 6;
+
+	return (shift + 1) * STATS_SUB_BUCKETS + ((us >> shift) & (STATS_SUB_BUCKETS - 1));
+}
+
+
+/*
+ * Returns the latency in the middle of a bucket, in milliseconds.
+ */
+static double bucket_value(int bucket)
+{
+	int shift;
+
+	if (bucket < STATS_SUB_BUCKETS)
+		return bucket / 1000.0;
+	shift = bucket / STATS_SUB_BUCKETS - 1;
+
+	return ((double)((STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) << shift) + ((1 << shift) - 1) / 2.0) / 1000.0;
+}
+
+
+/*
+ * Returns the latency below which a fraction p of the latencies counted
+ * in hist lie, in milliseconds.
+ */
+static double percentile(const unsigned long *hist, unsigned long total, double p)
+{
+	unsigned long rank = (unsigned long)(p * total + 0.999999);
+	unsigned long seen = 0;
+	int i;
+
+	if (total == 0)
+		return 0;
+	if (rank == 0)
+		rank = 1;
+	for (i = 0; i < STATS_BUCKETS; i++)
+	{
+		seen += hist[i];
+		if (seen >= rank)
+			return bucket_value(i);
+	}
+
+	return bucket_value(STATS_BUCKETS - 1);
+}
+
+
+/*
+ * Hands the counters of an ending thread over to threads started
+ * later, which keep adding to them.
+ */
+static void orphan_counters(void *arg)
+{
+	stats_counters *counters = (stats_counters *)arg;
+
+	pthread_mutex_lock(&threads_lock);
+	counters->orphaned = 1;
+	pthread_mutex_unlock(&threads_lock);
+}
+
+
+/*
+ * Returns the counters of the calling thread, creating them on its
+ * first query. Returns NULL if there is no memory for them.
+ */
+static stats_counters *own_counters(void)
+{
+	stats_counters *counters;
+
+	if (!__atomic_load_n(&key_created, __ATOMIC_ACQUIRE))
+	{
+		pthread_mutex_lock(&threads_lock);
+		if (!key_created && (pthread_key_create(&counters_key, orphan_counters) == 0))
+			__atomic_store_n(&key_created, 1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&threads_lock);
+		if (!key_created)
+			return NULL;
+	}
+
+	counters = (stats_counters *)pthread_getspecific(counters_key);
+	if (counters)
+		return counters;
+
+	pthread_mutex_lock(&threads_lock);
+	for (counters = threads; counters; counters = counters->next)
+	{
+		if (counters->orphaned)
+		{
+			counters->orphaned = 0;
+			break;
+		}
+	}
+	if (counters == NULL)
+	{
+		counters = (stats_counters *)calloc(1, sizeof(stats_counters));
+		if (counters)
+		{
+			counters->next = threads;
+			__atomic_store_n(&threads, counters, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&threads_lock);
+
+	if (counters)
+		pthread_setspecific(counters_key, counters);
+
+	return counters;
+}
+
+
+/*
+ * Returns the slot of a server, assigning the next free one on its
+ * first query.
+ */
+static int server_slot(const char *server)
+{
+	unsigned int addr = inet_addr(server);
+	int count = __atomic_load_n(&server_count, __ATOMIC_ACQUIRE);
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (server_addrs[i] == addr)
+			return i;
+	}
+
+	pthread_mutex_lock(&threads_lock);
+	for (i = 0; i < server_count; i++)
+	{
+		if (server_addrs[i] == addr)
+			break;
+	}
+	if ((i == server_count) && (server_count < STATS_MAX_SERVERS))
+	{
+		server_addrs[i] = addr;
+		snprintf(server_names[i], sizeof(server_names[i]), "%s", server);
+		__atomic_store_n(&server_count, i + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&threads_lock);
+
+	return (i < STATS_MAX_SERVERS) ? i : STATS_MAX_SERVERS - 1;
+}
+
+
+/*
+ * Counts a query about to be sent.
+ */
+void stats_sent(void)
+{
+	stats_counters *counters = own_counters();
+
+	if (counters)
+		BUMP(counters->sent);
+}
+
+
+/*
+ * Counts the outcome of a query sent to server at time sent, received
+ * and kind as recorded in the trace.
+ */
+void stats_done(const char *server, unsigned long long sent, unsigned long long received, int rcode, int kind)
+{
+	stats_counters *counters = own_counters();
+	int slot, bucket;
+
+	if (counters == NULL)
+		return;
+
+	slot = server_slot(server);
+	BUMP(counters->queries[slot]);
+	switch (kind)
+	{
+		case TRACE_ANSWERED:
+			bucket = bucket_of((received > sent) ? (unsigned int)(received - sent) : 0);
+			BUMP(counters->latency[slot][bucket]);
+			__atomic_store_n(&counters->last_answer[slot], received, __ATOMIC_RELAXED);
+			BUMP(counters->rcodes[rcode & 15]);
+			BUMP(counters->answered);
+			break;
+		case TRACE_TIMEOUT:
+			BUMP(counters->lost[slot]);
+			BUMP(counters->timeouts);
+			break;
+		default:
+			BUMP(counters->lost[slot]);
+			BUMP(counters->failed);
+	}
+}
+
+
+/*
+ * Counts a name queued again after a timeout.
+ */
+void stats_retry(void)
+{
+	stats_counters *counters = own_counters();
+
+	if (counters)
+		BUMP(counters->retries);
+}
+
+
+/*
+ * Sums up the counters of all threads. The latencies are summed per
+ * server only if latency is given, into one histogram per server.
+ */
+static void sum_counters(stats_counters *total, unsigned long (*latency)[STATS_BUCKETS])
+{
+	stats_counters *counters;
+	int i, j;
+
+	memset(total, 0, sizeof(stats_counters));
+	if (latency)
+		memset(latency, 0, STATS_MAX_SERVERS * sizeof(*latency));
+
+	for (counters = __atomic_load_n(&threads, __ATOMIC_ACQUIRE); counters; counters = counters->next)
+	{
+		total->sent += READ(counters->sent);
+		total->answered += READ(counters->answered);
+		total->timeouts += READ(counters->timeouts);
+		total->failed += READ(counters->failed);
+		total->retries += READ(counters->retries);
+		for (i = 0; i < 16; i++)
+			total->rcodes[i] += READ(counters->rcodes[i]);
+		for (i = 0; i < STATS_MAX_SERVERS; i++)
+		{
+			total->queries[i] += READ(counters->queries[i]);
+			total->lost[i] += READ(counters->lost[i]);
+			if (READ(counters->last_answer[i]) > total->last_answer[i])
+				total->last_answer[i] = READ(counters->last_answer[i]);
+			if (latency == NULL)
+				continue;
+			for (j = 0; j < STATS_BUCKETS; j++)
+				latency[i][j] += READ(counters->latency[i][j]);
+		}
+	}
+}
+
+
+/*
+ * Progress thread. Logs a line with the rates of the last interval and
+ * the latencies so far.
+ */
+static void *show_progress(void *arg)
+{
+	static stats_counters total;
+	static unsigned long latency[STATS_MAX_SERVERS][STATS_BUCKETS];
+	unsigned long all[STATS_BUCKETS];
+	unsigned long last_sent = 0;
+	unsigned long last_answered = 0;
+	struct timespec until;
+	int i, j;
+
+	(void)arg;
+	clock_gettime(CLOCK_REALTIME, &until);
+	pthread_mutex_lock(&progress_lock);
+	while (1)
+	{
+		until.tv_sec += progress_interval;
+		while (!stopping && (pthread_cond_timedwait(&progress_cond, &progress_lock, &until) != ETIMEDOUT))
+			;
+		if (stopping)
+			break;
+
+		sum_counters(&total, latency);
+		memset(all, 0, sizeof(all));
+		for (i = 0; i < STATS_MAX_SERVERS; i++)
+			for (j = 0; j < STATS_BUCKETS; j++)
+				all[j] += latency[i][j];
+
+		logline(LOG_INFO, "Progress: %lu sent (%lu/s), %lu answered (%lu/s), %lu outstanding, %lu timeouts, %lu retries, p50 %.1f ms, p99 %.1f ms",
+			total.sent, (total.sent - last_sent) / progress_interval,
+			total.answered, (total.answered - last_answered) / progress_interval,
+			total.sent - total.answered - total.timeouts - total.failed,
+			total.timeouts, total.retries,
+			percentile(all, total.answered, 0.5), percentile(all, total.answered, 0.99));
+		last_sent = total.sent;
+		last_answered = total.answered;
+	}
+	pthread_mutex_unlock(&progress_lock);
+
+	return NULL;
+}
+
+
+/*
+ * Starts counting queries afresh, and logs the progress every interval
+ * seconds unless interval is 0. No other thread may send queries
+ * meanwhile. Returns -1 if the progress thread cannot be started.
+ */
+int stats_start(int interval)
+{
+	stats_counters *counters;
+	sigset_t mask, old_mask;
+	int ret;
+
+	/* Queries of earlier phases are not counted */
+	pthread_mutex_lock(&threads_lock);
+	for (counters = threads; counters; counters = counters->next)
+	{
+		memset(counters, 0, offsetof(stats_counters, orphaned));
+	}
+	pthread_mutex_unlock(&threads_lock);
+
+	started = trace_now();
+	cpu_started = cpu_seconds();
+	progress_interval = interval;
+	stopping = 0;
+	if (interval == 0)
+		return 0;
+
+	/* Signals are left to the other threads */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+	ret = pthread_create(&progress, NULL, show_progress, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (ret != 0)
+	{
+		progress_interval = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Stops logging the progress.
+ */
+void stats_stop(void)
+{
+	if (progress_interval == 0)
+		return;
+
+	pthread_mutex_lock(&progress_lock);
+	stopping = 1;
+	pthread_cond_signal(&progress_cond);
+	pthread_mutex_unlock(&progress_lock);
+	pthread_join(progress, NULL);
+	progress_interval = 0;
+}
+
+
+/*
+ * Logs the counts of all queries sent since stats_start, and the
+ * latency percentiles of each server.
+ */
+void stats_report(void)
+{
+	static stats_counters total;
+	static unsigned long latency[STATS_MAX_SERVERS][STATS_BUCKETS];
+	unsigned long answered;
+	double seconds;
+	double cpu;
+	char rcodes[256];
+	int len = 0;
+	int i, j;
+
+	sum_counters(&total, latency);
+	if (total.sent == 0)
+		return;
+
+	seconds = (trace_now() - started) / 1000000.0;
+	logline(LOG_INFO, "Query statistics:");
+	logline(LOG_INFO, "    Queries sent      : %lu in %.1f seconds (%.0f per second)", total.sent, seconds,
+		(seconds > 0) ? total.sent / seconds : 0);
+	cpu = cpu_seconds() - cpu_started;
+	logline(LOG_INFO, "    CPU time          : %.2f seconds (%.1f us per query)", cpu, 1000000.0 * cpu / total.sent);
+	logline(LOG_INFO, "    Answered          : %lu", total.answered);
+	logline(LOG_INFO, "    Timed out         : %lu", total.timeouts);
+	logline(LOG_INFO, "    Failed            : %lu", total.failed);
+	logline(LOG_INFO, "    Retries           : %lu", total.retries);
+
+	rcodes[0] = '\0';
+	for (i = 0; i < 16; i++)
+	{
+		if (total.rcodes[i] == 0)
+			continue;
+		len += snprintf(rcodes + len, sizeof(rcodes) - len, " %s=%lu",
+			(i == 0) ? "NOERROR" : (i == 2) ? "SERVFAIL" : (i == 3) ? "NXDOMAIN" : (i == 5) ? "REFUSED" : "other",
+			total.rcodes[i]);
+		if (len >= (int)sizeof(rcodes))
+			break;
+	}
+	if (rcodes[0])
+		logline(LOG_INFO, "    Response codes    :%s", rcodes);
+
+	logline(LOG_INFO, "    Latency per server in ms (p50 / p90 / p99 / p999 / max):");
+	for (i = 0; i < server_count; i++)
+	{
+		answered = 0;
+		for (j = 0; j < STATS_BUCKETS; j++)
+			answered += latency[i][j];
+		logline(LOG_INFO, "        %-15s : %.2f / %.2f / %.2f / %.2f / %.2f, %lu queries, %.2f%% lost",
+			server_names[i],
+			percentile(latency[i], answered, 0.5), percentile(latency[i], answered, 0.9),
+			percentile(latency[i], answered, 0.99), percentile(latency[i], answered, 0.999),
+			percentile(latency[i], answered, 1.0),
+			total.queries[i], total.queries[i] ? 100.0 * total.lost[i] / total.queries[i] : 0);
+	}
+}
+
+
+/*
+ * Writes the counters and the latencies of each server in the text
+ * format of Prometheus. A server counts as healthy while it answered
+ * within the last STATS_HEALTHY seconds, or was not queried yet.
+ */
+void stats_write_metrics(FILE *out)
+{
+	static stats_counters total;
+	static unsigned long latency[STATS_MAX_SERVERS][STATS_BUCKETS];
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	unsigned long long now = trace_now();
+	unsigned long answered;
+	int i, j;
+
+	/* The buffers are shared by all callers */
+	pthread_mutex_lock(&progress_lock);
+	sum_counters(&total, latency);
+
+	fprintf(out, "# HELP dnsninja_queries_sent_total Queries sent.\n");
+	fprintf(out, "# TYPE dnsninja_queries_sent_total counter\n");
+	fprintf(out, "dnsninja_queries_sent_total %lu\n", total.sent);
+	fprintf(out, "# HELP dnsninja_queries_answered_total Queries answered.\n");
+	fprintf(out, "# TYPE dnsninja_queries_answered_total counter\n");
+	fprintf(out, "dnsninja_queries_answered_total %lu\n", total.answered);
+	fprintf(out, "# HELP dnsninja_queries_timeouts_total Queries not answered in time.\n");
+	fprintf(out, "# TYPE dnsninja_queries_timeouts_total counter\n");
+	fprintf(out, "dnsninja_queries_timeouts_total %lu\n", total.timeouts);
+	fprintf(out, "# HELP dnsninja_queries_failed_total Queries not sent or answered malformed.\n");
+	fprintf(out, "# TYPE dnsninja_queries_failed_total counter\n");
+	fprintf(out, "dnsninja_queries_failed_total %lu\n", total.failed);
+	fprintf(out, "# HELP dnsninja_retries_total Names queued again after a timeout.\n");
+	fprintf(out, "# TYPE dnsninja_retries_total counter\n");
+	fprintf(out, "dnsninja_retries_total %lu\n", total.retries);
+	fprintf(out, "# HELP dnsninja_queries_outstanding Queries waiting for an answer.\n");
+	fprintf(out, "# TYPE dnsninja_queries_outstanding gauge\n");
+	fprintf(out, "dnsninja_queries_outstanding %lu\n", total.sent - total.answered - total.timeouts - total.failed);
+	fprintf(out, "# HELP dnsninja_responses_total Answers by response code.\n");
+	fprintf(out, "# TYPE dnsninja_responses_total counter\n");
+	for (i = 0; i < 16; i++)
+	{
+		if (total.rcodes[i] > 0)
+			fprintf(out, "dnsninja_responses_total{rcode=\"%d\"} %lu\n", i, total.rcodes[i]);
+	}
+
+	fprintf(out, "# HELP dnsninja_server_queries_total Queries sent to a server.\n");
+	fprintf(out, "# TYPE dnsninja_server_queries_total counter\n");
+	for (i = 0; i < server_count; i++)
+		fprintf(out, "dnsninja_server_queries_total{server=\"%s\"} %lu\n", server_names[i], total.queries[i]);
+	fprintf(out, "# HELP dnsninja_server_lost_total Queries to a server which timed out or failed.\n");
+	fprintf(out, "# TYPE dnsninja_server_lost_total counter\n");
+	for (i = 0; i < server_count; i++)
+		fprintf(out, "dnsninja_server_lost_total{server=\"%s\"} %lu\n", server_names[i], total.lost[i]);
+	fprintf(out, "# HELP dnsninja_server_healthy Whether a server answered in the last %d seconds.\n", STATS_HEALTHY);
+	fprintf(out, "# TYPE dnsninja_server_healthy gauge\n");
+	for (i = 0; i < server_count; i++)
+		fprintf(out, "dnsninja_server_healthy{server=\"%s\"} %d\n", server_names[i],
+			(total.queries[i] == 0) || (total.last_answer[i] + STATS_HEALTHY * 1000000ULL > now));
+	fprintf(out, "# HELP dnsninja_server_latency_seconds Latency of the answers of a server.\n");
+	fprintf(out, "# TYPE dnsninja_server_latency_seconds summary\n");
+	for (i = 0; i < server_count; i++)
+	{
+		answered = 0;
+		for (j = 0; j < STATS_BUCKETS; j++)
+			answered += latency[i][j];
+		for (j = 0; j < 4; j++)
+			fprintf(out, "dnsninja_server_latency_seconds{server=\"%s\",quantile=\"%g\"} %.6f\n", server_names[i],
+				quantiles[j], percentile(latency[i], answered, quantiles[j]) / 1000.0);
+		fprintf(out, "dnsninja_server_latency_seconds_count{server=\"%s\"} %lu\n", server_names[i], answered);
+	}
+	pthread_mutex_unlock(&progress_lock);
+}
@@ -0,0 +1,44 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+/* Servers told apart, further servers share the last slot */
+#define STATS_MAX_SERVERS  16
+
+/* Latencies in microseconds are counted in buckets of 1/64 of a power
+ * of two, values below 64 exactly. Percentiles are accurate to 1.6% */
+#define STATS_SUB_BUCKETS  64
+#define STATS_BUCKETS      (27 * STATS_SUB_BUCKETS)
+
+/* Seconds a server may go without answering and still count as healthy */
+#define STATS_HEALTHY      30
+
+void stats_sent(void);
+void stats_done(const char *server, unsigned long long sent, unsigned long long received, int rcode, int kind);
+void stats_retry(void);
+int stats_start(int interval);
+void stats_stop(void);
+void stats_report(void);
+void stats_write_metrics(FILE *out);
+
+#endif /* STATS_H */
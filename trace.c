@@ -0,0 +1,284 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "trace.h"
+
+/* Records of one thread waiting to be written */
+typedef struct trace_buffer
+{
+	trace_record records[TRACE_BUFFER];
+	int count;
+	int attempt;         // attempt of the name being queried
+	int orphaned;        // thread has ended, buffer may be taken over
+	struct trace_buffer *next;
+} trace_buffer;
+
+/* Read by dns_query before taking the time */
+int trace_enabled = 0;
+
+static FILE *trace_file = NULL;
+static int write_failed = 0;
+static trace_buffer *buffers = NULL;
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t buffer_key;
+static unsigned int servers[TRACE_MAX_SERVERS];
+static int server_count = 0;
+
+
+/*
+ * Returns the current time in microseconds since the epoch.
+ */
+unsigned long long trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*
+ * Writes the records of a buffer to the file. The caller holds the
+ * file lock.
+ */
+static void flush_buffer(trace_buffer *buffer)
+{
+	if (buffer->count == 0)
+		return;
+	if (fwrite(buffer->records, sizeof(trace_record), buffer->count, trace_file) != (size_t)buffer->count)
+		write_failed = 1;
+	buffer->count = 0;
+}
+
+
+/*
+ * Writes the records of an ending thread and hands its buffer over to
+ * threads started later.
+ */
+static void orphan_buffer(void *arg)
+{
+	trace_buffer *buffer = (trace_buffer *)arg;
+
+	pthread_mutex_lock(&file_lock);
+	flush_buffer(buffer);
+	buffer->orphaned = 1;
+	pthread_mutex_unlock(&file_lock);
+}
+
+
+/*
+ * Returns the buffer of the calling thread, taking over the buffer of
+ * an ended thread or creating one. Returns NULL if there is no memory
+ * for it.
+ */
+static trace_buffer *own_buffer(void)
+{
+	trace_buffer *buffer = (trace_buffer *)pthread_getspecific(buffer_key);
+
+	if (buffer)
+		return buffer;
+
+	pthread_mutex_lock(&file_lock);
+	for (buffer = buffers; buffer; buffer = buffer->next)
+	{
+		if (buffer->orphaned)
+		{
+			buffer->orphaned = 0;
+			break;
+		}
+	}
+	if (buffer == NULL)
+	{
+		buffer = (trace_buffer *)malloc(sizeof(trace_buffer));
+		if (buffer)
+		{
+			buffer->count = 0;
+			buffer->orphaned = 0;
+			buffer->next = buffers;
+			buffers = buffer;
+		}
+	}
+	pthread_mutex_unlock(&file_lock);
+
+	if (buffer)
+	{
+		buffer->attempt = 0;
+		pthread_setspecific(buffer_key, buffer);
+	}
+
+	return buffer;
+}
+
+
+/*
+ * Returns the index of a server, defining a new one in the trace on
+ * its first query.
+ */
+static int server_index(const char *server)
+{
+	trace_record def;
+	unsigned int addr = inet_addr(server);
+	int count = __atomic_load_n(&server_count, __ATOMIC_ACQUIRE);
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (servers[i] == addr)
+			return i;
+	}
+
+	pthread_mutex_lock(&file_lock);
+	for (i = 0; i < server_count; i++)
+	{
+		if (servers[i] == addr)
+			break;
+	}
+	if ((i == server_count) && (server_count < TRACE_MAX_SERVERS))
+	{
+		memset(&def, 0, sizeof(def));
+		def.latency = addr;
+		def.server = i;
+		def.kind = TRACE_SERVER;
+		if (fwrite(&def, sizeof(def), 1, trace_file) != 1)
+			write_failed = 1;
+		servers[i] = addr;
+		__atomic_store_n(&server_count, i + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&file_lock);
+
+	return (i < TRACE_MAX_SERVERS) ? i : TRACE_MAX_SERVERS - 1;
+}
+
+
+/*
+ * Creates a trace file and starts recording queries. Returns -1 if the
+ * file cannot be created.
+ */
+int trace_open(const char *file)
+{
+	trace_header header;
+
+	trace_file = fopen(file, "wb");
+	if (trace_file == NULL)
+		return -1;
+	if (pthread_key_create(&buffer_key, orphan_buffer) != 0)
+	{
+		fclose(trace_file);
+		trace_file = NULL;
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.started = trace_now();
+	if (fwrite(&header, sizeof(header), 1, trace_file) != 1)
+		write_failed = 1;
+	trace_enabled = 1;
+
+	return 0;
+}
+
+
+/*
+ * Tells the trace which attempt the next queries of the calling thread
+ * belong to.
+ */
+void trace_set_attempt(int attempt)
+{
+	trace_buffer *buffer;
+
+	if (!trace_enabled)
+		return;
+	buffer = own_buffer();
+	if (buffer)
+		buffer->attempt = attempt;
+}
+
+
+/*
+ * Records a query sent to server at time sent and answered at time
+ * received. rcode and size describe the reply, if there is one. The
+ * record goes to the buffer of the calling thread, only a full buffer
+ * takes the file lock.
+ */
+void trace_query(const char *server, int qtype, unsigned long long sent, unsigned long long received, int rcode, int size, int kind)
+{
+	trace_buffer *buffer;
+	trace_record *rec;
+
+	if (!trace_enabled)
+		return;
+	buffer = own_buffer();
+	if (buffer == NULL)
+		return;
+
+	rec = &buffer->records[buffer->count++];
+	rec->sent = sent;
+	rec->latency = (received > sent) ? (unsigned int)(received - sent) : 0;
+	rec->qtype = qtype;
+	rec->size = (size > 0) ? size : 0;
+	rec->server = server_index(server);
+	rec->rcode = rcode;
+	rec->attempt = (buffer->attempt < 255) ? buffer->attempt : 255;
+	rec->kind = kind;
+
+	if (buffer->count == TRACE_BUFFER)
+	{
+		pthread_mutex_lock(&file_lock);
+		flush_buffer(buffer);
+		pthread_mutex_unlock(&file_lock);
+	}
+}
+
+
+/*
+ * Writes the records left in the buffers and closes the trace. The
+ * threads tracing must have ended, except for the calling one.
+ * Returns -1 if the trace could not be written completely.
+ */
+int trace_close(void)
+{
+	trace_buffer *buffer;
+
+	if (trace_file == NULL)
+		return 0;
+	trace_enabled = 0;
+
+	while (buffers)
+	{
+		buffer = buffers->next;
+		flush_buffer(buffers);
+		free(buffers);
+		buffers = buffer;
+	}
+	pthread_setspecific(buffer_key, NULL);
+	pthread_key_delete(buffer_key);
+	if (fclose(trace_file) != 0)
+		write_failed = 1;
+	trace_file = NULL;
+
+	return write_failed ? -1 : 0;
+}
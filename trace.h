@@ -0,0 +1,69 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Identifies the file format, bumped on incompatible changes */
+#define TRACE_MAGIC         "DNSNT001"
+
+/* Records buffered per thread before they are written */
+#define TRACE_BUFFER        4096
+
+/* Servers told apart in a trace, further servers share the last index */
+#define TRACE_MAX_SERVERS   256
+
+/* Outcome of a query */
+#define TRACE_ANSWERED      0
+#define TRACE_TIMEOUT       1   // no reply within the timeout
+#define TRACE_FAILED        2   // not sent or reply malformed
+#define TRACE_SERVER        3   // no query, defines a server index
+
+/* Start of a trace file, followed by the records */
+typedef struct
+{
+	char magic[8];
+	unsigned long long started;    // microseconds since the epoch
+} trace_header;
+
+/* One query. A record of kind TRACE_SERVER instead holds the IPv4
+ * address of a server in latency, stored in network byte order */
+#pragma pack(push, 1)
+typedef struct
+{
+	unsigned long long sent;       // microseconds since the epoch
+	unsigned int latency;          // microseconds until the reply
+	unsigned short qtype;
+	unsigned short size;           // bytes of the reply, 0 if none
+	unsigned char server;          // index of the server
+	unsigned char rcode;
+	unsigned char attempt;         // 0 for the first query of a name
+	unsigned char kind;            // TRACE_ANSWERED, TRACE_TIMEOUT, ...
+} trace_record;
+#pragma pack(pop)
+
+int trace_open(const char *file);
+void trace_set_attempt(int attempt);
+void trace_query(const char *server, int qtype, unsigned long long sent, unsigned long long received, int rcode, int size, int kind);
+unsigned long long trace_now(void);
+int trace_close(void);
+
+extern int trace_enabled;
+
+#endif /* TRACE_H */
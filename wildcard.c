@@ -0,0 +1,427 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "dns.h"
+#include "name.h"
+#include "hashset.h"
+#include "log.h"
+#include "wildcard.h"
+
+/* Number of slots in a fingerprint hash set (power of two) */
+#define FP_SLOTS 256
+
+/* Zone probing states */
+#define ZONE_EMPTY   0
+#define ZONE_PROBING 1
+#define ZONE_READY   2
+#define ZONE_UNKNOWN 3   // no probe was answered, probed again after next_probe
+
+/* Answers a wildcard record synthesizes for a zone */
+typedef struct
+{
+	unsigned long long keys[FP_SLOTS];  // hashed addresses and cname targets
+	unsigned int max_ttl;               // highest ttl seen while probing
+	int count;
+} fingerprint;
+
+/* Slot of the zone table */
+typedef struct
+{
+	unsigned long long hash;
+	int state;
+	int attempts;       // probes of the zone none of which was answered
+	time_t next_probe;  // earliest time an unknown zone is probed again
+	fingerprint *fp;    // NULL if the zone has no wildcard record
+} zone_entry;
+
+static zone_entry *zones = NULL;
+static int zones_used = 0;
+static pthread_rwlock_t zones_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t probe_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t probe_done = PTHREAD_COND_INITIALIZER;
+
+
+/*
+ * Builds the fingerprint key of an ip address.
+ */
+static unsigned long long addr_key(const char *ip)
+{
+	return (1ULL << 32) | (unsigned int)inet_addr(ip);
+}
+
+
+/*
+ * Builds the fingerprint key of a cname target.
+ */
+static unsigned long long cname_key(const char *target)
+{
+	return (1ULL << 63) | hashset_hash_name(target);
+}
+
+
+/*
+ * Adds a key to a fingerprint.
+ */
+static void fp_add(fingerprint *fp, unsigned long long key)
+{
+	unsigned int i = (unsigned int)(key ^ (key >> 29)) & (FP_SLOTS - 1);
+
+	while (fp->keys[i] != 0)
+	{
+		if (fp->keys[i] == key)
+			return;
+		i = (i + 1) & (FP_SLOTS - 1);
+	}
+
+	/* Keep at least one free slot so lookups terminate */
+	if (fp->count < FP_SLOTS - 1)
+	{
+		fp->keys[i] = key;
+		fp->count++;
+	}
+}
+
+
+/*
+ * Checks whether a fingerprint contains a key.
+ */
+static int fp_contains(fingerprint *fp, unsigned long long key)
+{
+	unsigned int i = (unsigned int)(key ^ (key >> 29)) & (FP_SLOTS - 1);
+
+	while (fp->keys[i] != 0)
+	{
+		if (fp->keys[i] == key)
+			return 1;
+		i = (i + 1) & (FP_SLOTS - 1);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Checks whether the answers of a reply could have been synthesized by
+ * the wildcard record described by fp. The first cname of a chain is
+ * owned by the queried name, so it alone decides for aliases. Address
+ * answers must all be known and must not carry a ttl higher than the
+ * wildcard's.
+ */
+static int fp_match(fingerprint *fp, struct DNS_REPLY *reply)
+{
+	int i, addrs = 0;
+	struct DNS_RR *rr;
+
+	for (i = 0; i < reply->ans_count; i++)
+	{
+		rr = &reply->answers[i];
+
+		if (rr->type == DNS_RES_REC_CNAME)
+		{
+			return fp_contains(fp, cname_key(rr->data));
+		}
+		else if (rr->type == DNS_RES_REC_A)
+		{
+			if (!fp_contains(fp, addr_key(rr->data)) || (rr->ttl > fp->max_ttl))
+				return 0;
+			addrs++;
+		}
+	}
+
+	return addrs > 0;
+}
+
+
+/*
+ * Queries random labels below zone. Stores the fingerprint of the
+ * wildcard answers in result, or NULL if the zone has no wildcard
+ * record. Returns -1 if no probe was answered, so nothing is known
+ * about the zone.
+ */
+static int probe_zone(char *server, char *zone, fingerprint **result)
+{
+	struct DNS_REPLY reply;
+	fingerprint *fp;
+	char host[NAME_TEXT_MAX];
+	unsigned int seed;
+	int i, j, ret, answered = 0;
+
+	*result = NULL;
+	fp = (fingerprint *)calloc(1, sizeof(fingerprint));
+	if (fp == NULL)
+		return -1;
+
+	seed = (unsigned int)time(NULL) ^ (unsigned int)hashset_hash_name(zone);
+
+	for (i = 0; i < WILDCARD_PROBES; i++)
+	{
+		if (name_random(zone, host, sizeof(host), &seed) < 0)
+			break;
+
+		ret = dns_query(server, host, DNS_RES_REC_A, 0, &reply);
+		if (ret < 0)
+		{
+			logline(LOG_DEBUG, "    Wildcard probe %s failed. Error code: %d", host, ret);
+			continue;
+		}
+
+		/* A single non-existent random name rules out a wildcard */
+		if ((reply.rcode != DNS_RCODE_NOERROR) || (reply.ans_count == 0))
+		{
+			free(fp);
+			return 0;
+		}
+
+		answered++;
+		for (j = 0; j < reply.ans_count; j++)
+		{
+			if (reply.answers[j].type == DNS_RES_REC_CNAME)
+			{
+				fp_add(fp, cname_key(reply.answers[j].data));
+				break;
+			}
+			else if (reply.answers[j].type == DNS_RES_REC_A)
+			{
+				fp_add(fp, addr_key(reply.answers[j].data));
+				if (reply.answers[j].ttl > fp->max_ttl)
+					fp->max_ttl = reply.answers[j].ttl;
+			}
+		}
+	}
+
+	if (answered == 0)
+	{
+		free(fp);
+		return -1;
+	}
+	if (fp->count == 0)
+	{
+		free(fp);
+		return 0;
+	}
+
+	logline(LOG_INFO, "Wildcard record detected for zone %s (%d fingerprints, ttl %u)",
+		zone, fp->count, fp->max_ttl);
+
+	*result = fp;
+	return 0;
+}
+
+
+/*
+ * Finds the slot of a zone. Returns the slot index or -1 if the
+ * zone is unknown. Must be called with zones_lock held.
+ */
+static int find_zone(unsigned long long hash)
+{
+	unsigned int i = (unsigned int)(hash ^ (hash >> 32)) & (WILDCARD_MAX_ZONES - 1);
+
+	while (zones[i].state != ZONE_EMPTY)
+	{
+		if (zones[i].hash == hash)
+			return i;
+		i = (i + 1) & (WILDCARD_MAX_ZONES - 1);
+	}
+
+	return -1;
+}
+
+
+/*
+ * Allocates the zone table.
+ */
+int wildcard_init(void)
+{
+	zones = (zone_entry *)calloc(WILDCARD_MAX_ZONES, sizeof(zone_entry));
+	if (zones == NULL)
+		return -1;
+
+	zones_used = 0;
+
+	return 0;
+}
+
+
+/*
+ * Checks whether the reply to host is an answer synthesized by a wildcard
+ * record of the zone host belongs to. The zone is probed the first time
+ * it is seen; concurrent callers wait for a running probe to finish. If
+ * no probe is answered, the zone is probed again after
+ * WILDCARD_RETRY_DELAY seconds, up to WILDCARD_MAX_ATTEMPTS times, and
+ * is taken to have no wildcard record after that. Returns 1 if the reply
+ * matches the zone's wildcard fingerprint, 0 otherwise.
+ */
+int wildcard_check(char *server, char *host, struct DNS_REPLY *reply)
+{
+	unsigned long long hash;
+	unsigned int i;
+	fingerprint *fp;
+	time_t now;
+	char *zone;
+	int idx, ret;
+
+	if ((zones == NULL) || (reply->rcode != DNS_RCODE_NOERROR) || (reply->ans_count == 0))
+		return 0;
+
+	zone = strchr(host, '.');
+	if ((zone == NULL) || (strchr(zone + 1, '.') == NULL))
+		return 0;
+	zone++;
+
+	hash = hashset_hash_name(zone);
+	now = time(NULL);
+
+	/* Fast path: zone has been probed already */
+	pthread_rwlock_rdlock(&zones_lock);
+	idx = find_zone(hash);
+	if ((idx >= 0) && (zones[idx].state == ZONE_READY))
+	{
+		fp = zones[idx].fp;
+		pthread_rwlock_unlock(&zones_lock);
+		return fp ? fp_match(fp, reply) : 0;
+	}
+	if ((idx >= 0) && (zones[idx].state == ZONE_UNKNOWN) && (now < zones[idx].next_probe))
+	{
+		pthread_rwlock_unlock(&zones_lock);
+		return 0;
+	}
+	pthread_rwlock_unlock(&zones_lock);
+
+	pthread_mutex_lock(&probe_lock);
+	pthread_rwlock_wrlock(&zones_lock);
+	idx = find_zone(hash);
+
+	/* Another thread is probing this zone, wait for it */
+	while ((idx >= 0) && (zones[idx].state == ZONE_PROBING))
+	{
+		pthread_rwlock_unlock(&zones_lock);
+		pthread_cond_wait(&probe_done, &probe_lock);
+		pthread_rwlock_wrlock(&zones_lock);
+	}
+	if ((idx >= 0) && (zones[idx].state == ZONE_READY))
+	{
+		fp = zones[idx].fp;
+		pthread_rwlock_unlock(&zones_lock);
+		pthread_mutex_unlock(&probe_lock);
+		return fp ? fp_match(fp, reply) : 0;
+	}
+	if ((idx >= 0) && (now < zones[idx].next_probe))
+	{
+		/* Another thread has just probed the zone without an answer */
+		pthread_rwlock_unlock(&zones_lock);
+		pthread_mutex_unlock(&probe_lock);
+		return 0;
+	}
+
+	if (idx >= 0)
+	{
+		/* No probe was answered last time, try again */
+		i = idx;
+	}
+	else if (zones_used >= WILDCARD_MAX_ZONES / 2)
+	{
+		/* Table is full, don't filter this zone */
+		pthread_rwlock_unlock(&zones_lock);
+		pthread_mutex_unlock(&probe_lock);
+		return 0;
+	}
+	else
+	{
+		/* Claim a slot and probe the zone ourselves */
+		i = (unsigned int)(hash ^ (hash >> 32)) & (WILDCARD_MAX_ZONES - 1);
+		while (zones[i].state != ZONE_EMPTY)
+			i = (i + 1) & (WILDCARD_MAX_ZONES - 1);
+		zones[i].hash = hash;
+		zones[i].attempts = 0;
+		zones[i].next_probe = 0;
+		zones[i].fp = NULL;
+		zones_used++;
+	}
+	zones[i].state = ZONE_PROBING;
+	pthread_rwlock_unlock(&zones_lock);
+	pthread_mutex_unlock(&probe_lock);
+
+	ret = probe_zone(server, zone, &fp);
+
+	pthread_mutex_lock(&probe_lock);
+	pthread_rwlock_wrlock(&zones_lock);
+	zones[i].fp = fp;
+	zones[i].state = ZONE_READY;
+	if ((ret < 0) && (++zones[i].attempts < WILDCARD_MAX_ATTEMPTS))
+	{
+		logline(LOG_INFO, "No answer to the wildcard probes of zone %s, probing it again later", zone);
+		zones[i].state = ZONE_UNKNOWN;
+		zones[i].next_probe = time(NULL) + WILDCARD_RETRY_DELAY;
+	}
+	else if (ret < 0)
+		logline(LOG_INFO, "No answer to the wildcard probes of zone %s, assuming it has no wildcard record", zone);
+	pthread_rwlock_unlock(&zones_lock);
+	pthread_cond_broadcast(&probe_done);
+	pthread_mutex_unlock(&probe_lock);
+
+	/* Nothing is known about the zone if no probe was answered, the
+	 * reply is taken as it is */
+	return fp ? fp_match(fp, reply) : 0;
+}
+
+
+/*
+ * Returns the number of zones that have a wildcard record.
+ */
+int wildcard_zone_count(void)
+{
+	int i, count = 0;
+
+	if (zones == NULL)
+		return 0;
+
+	pthread_rwlock_rdlock(&zones_lock);
+	for (i = 0; i < WILDCARD_MAX_ZONES; i++)
+	{
+		if ((zones[i].state == ZONE_READY) && (zones[i].fp != NULL))
+			count++;
+	}
+	pthread_rwlock_unlock(&zones_lock);
+
+	return count;
+}
+
+
+/*
+ * Frees the zone table and all fingerprints.
+ */
+void wildcard_free(void)
+{
+	int i;
+
+	if (zones == NULL)
+		return;
+
+	for (i = 0; i < WILDCARD_MAX_ZONES; i++)
+		free(zones[i].fp);
+
+	free(zones);
+	zones = NULL;
+}
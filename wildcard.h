@@ -0,0 +1,42 @@
+/******************************************************************************
+ *    Copyright 2012 André Gasser
+ *
+ *    This file is part of DNSNINJA.
+ *
+ *    DNSNINJA is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    DNSNINJA is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with DNSNINJA.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include "dns.h"
+
+/* Number of random labels probed per zone */
+#define WILDCARD_PROBES   3
+
+/* Times a zone is probed while none of its probes is answered, and the
+ * seconds between those attempts. The zone is taken to have no wildcard
+ * record after the last one */
+#define WILDCARD_MAX_ATTEMPTS 3
+#define WILDCARD_RETRY_DELAY  30
+
+/* Size of the zone table (power of two) */
+#define WILDCARD_MAX_ZONES 65536
+
+int wildcard_init(void);
+int wildcard_check(char *server, char *host, struct DNS_REPLY *reply);
+int wildcard_zone_count(void);
+void wildcard_free(void);
+
+#endif /* WILDCARD_H */